@@ -13,7 +13,13 @@
 
 DEP_FINDPARAMS := -x "*/.svn*" -x ".*" -x "*:*" -x "*\!*" -x "* *" -x "*\\\#*" -x "*/.*_check" -x "*/.*.swp" -x "*/.pkgdir*"
 
-find_md5=find $(wildcard $(1)) -type f $(patsubst -x,-and -not -path,$(DEP_FINDPARAMS) $(2)) | mkhash md5
+# use the native tool from the host staging dir once prereq has built it
+DEP_TREESTAMP:=$(if $(STAGING_DIR_HOST),$(wildcard $(STAGING_DIR_HOST)/bin/treestamp))
+DEP_TIMESTAMP:=$(if $(DEP_TREESTAMP),$(DEP_TREESTAMP),$(TOPDIR)/scripts/timestamp.pl)
+
+find_md5=$(if $(DEP_TREESTAMP), \
+	$(DEP_TREESTAMP) -m $(DEP_FINDPARAMS) $(2) $(wildcard $(1)), \
+	find $(wildcard $(1)) -type f $(patsubst -x,-and -not -path,$(DEP_FINDPARAMS) $(2)) | mkhash md5)
 
 define rdep
   .PRECIOUS: $(2)
@@ -30,7 +36,7 @@ ifneq ($(wildcard $(2)),)
 	) \
 	{ \
 		[ -f "$(2)_check.1" ] && mv "$(2)_check.1"; \
-	    $(TOPDIR)/scripts/timestamp.pl $(DEP_FINDPARAMS) $(4) -n $(2) $(1) && { \
+	    $(DEP_TIMESTAMP) $(DEP_FINDPARAMS) $(4) -n $(2) $(1) && { \
 			$(call debug_eval,$(SUBDIR),r,echo "No need to rebuild $(2)";) \
 			touch -r "$(2)" "$(2)_check"; \
 		} \
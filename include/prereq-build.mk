@@ -155,10 +155,22 @@ $(eval $(call SetupHostCommand,file,Please install the 'file' package, \
 
 $(STAGING_DIR_HOST)/bin/mkhash: $(SCRIPT_DIR)/mkhash.c
 	mkdir -p $(dir $@)
-	$(CC) -O2 -I$(TOPDIR)/tools/include -o $@ $<
+	$(CC) -O2 -I$(TOPDIR)/tools/include -pthread -o $@ $<
 
 prereq: $(STAGING_DIR_HOST)/bin/mkhash
 
+$(STAGING_DIR_HOST)/bin/ipkg-make-index: $(SCRIPT_DIR)/ipkg-make-index.c $(SCRIPT_DIR)/mkhash.c
+	mkdir -p $(dir $@)
+	$(CC) -O2 -I$(TOPDIR)/tools/include -pthread -o $@ $<
+
+prereq: $(STAGING_DIR_HOST)/bin/ipkg-make-index
+
+$(STAGING_DIR_HOST)/bin/treestamp: $(SCRIPT_DIR)/treestamp.c $(SCRIPT_DIR)/mkhash.c
+	mkdir -p $(dir $@)
+	$(CC) -O2 -I$(TOPDIR)/tools/include -o $@ $<
+
+prereq: $(STAGING_DIR_HOST)/bin/treestamp
+
 # Install ldconfig stub
 $(eval $(call TestHostCommand,ldconfig-stub,Failed to install stub, \
 	touch $(STAGING_DIR_HOST)/bin/ldconfig && \
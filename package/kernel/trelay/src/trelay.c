@@ -19,38 +19,250 @@
 #include <linux/netdevice.h>
 #include <linux/rtnetlink.h>
 #include <linux/debugfs.h>
+#include <linux/interrupt.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/version.h>
 
 #define trelay_log(loglevel, tr, fmt, ...) \
 	printk(loglevel "trelay: %s <-> %s: " fmt "\n", \
 		tr->dev1->name, tr->dev2->name, ##__VA_ARGS__);
 
+/* Frames queued per CPU before fast mode hands them to the driver */
+#define TRELAY_BATCH		16
+#define TRELAY_MAX_BYPASS	8
+
 static LIST_HEAD(trelay_devs);
+static DEFINE_MUTEX(trelay_bypass_lock);
 static struct dentry *debugfs_dir;
 
+struct trelay_stats {
+	u64 packets;
+	u64 bytes;
+	u64 dropped;
+	u64 bypassed;
+	struct u64_stats_sync syncp;
+};
+
+/* Ethertypes passed up to the local stack, replaced as a whole under RCU */
+struct trelay_bypass {
+	struct rcu_head rcu;
+	int n;
+	__be16 proto[TRELAY_MAX_BYPASS];
+};
+
+/* One relay direction, registered as rx_handler_data of the rx device */
+struct trelay_port {
+	struct trelay *tr;
+	struct net_device *dev;
+	struct net_device *peer;
+	struct trelay_stats __percpu *stats;
+};
+
 struct trelay {
 	struct list_head list;
 	struct net_device *dev1, *dev2;
+	struct trelay_port port[2];
 	struct dentry *debugfs;
 	int to_remove;
+	bool fast;
+	struct trelay_bypass __rcu *bypass;
 	char name[];
 };
 
+struct trelay_queue {
+	struct sk_buff_head skbs;
+	struct tasklet_struct tasklet;
+};
+
+static DEFINE_PER_CPU(struct trelay_queue, trelay_queues);
+
+struct trelay_skb_cb {
+	struct trelay_port *port;
+};
+
+#define TRELAY_SKB_CB(skb)	((struct trelay_skb_cb *)(skb)->cb)
+
+static void trelay_count(struct trelay_port *port, unsigned int len, bool ok)
+{
+	struct trelay_stats *st = this_cpu_ptr(port->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	if (ok) {
+		st->packets++;
+		st->bytes += len;
+	} else {
+		st->dropped++;
+	}
+	u64_stats_update_end(&st->syncp);
+}
+
+static void trelay_count_bypass(struct trelay_port *port)
+{
+	struct trelay_stats *st = this_cpu_ptr(port->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	st->bypassed++;
+	u64_stats_update_end(&st->syncp);
+}
+
+/*
+ * Hand the queued frames to the drivers, taking each tx queue lock once
+ * per run of frames for the same device and flagging all but the last
+ * one with xmit_more so the driver can defer its doorbell write. Frames
+ * a stopped queue or a busy driver did not take go through the qdisc.
+ */
+static void trelay_xmit_queue(struct sk_buff_head *q)
+{
+	struct sk_buff_head busy;
+	struct sk_buff *skb, *next;
+
+	__skb_queue_head_init(&busy);
+
+	skb = __skb_dequeue(q);
+	while (skb) {
+		struct net_device *dev = skb->dev;
+		u16 queue = skb_get_queue_mapping(skb);
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, queue);
+
+		HARD_TX_LOCK(dev, txq, smp_processor_id());
+
+		for (; skb; skb = next) {
+			struct trelay_port *port = TRELAY_SKB_CB(skb)->port;
+			unsigned int len = skb->len;
+			netdev_tx_t rc = NETDEV_TX_BUSY;
+
+			next = skb_peek(q);
+			if (next && (next->dev != dev ||
+				     skb_get_queue_mapping(next) != queue))
+				next = NULL;
+			if (next)
+				__skb_unlink(next, q);
+
+			if (!netif_xmit_frozen_or_drv_stopped(txq))
+				rc = netdev_start_xmit(skb, dev, txq, !!next);
+
+			if (!dev_xmit_complete(rc)) {
+				__skb_queue_tail(&busy, skb);
+				continue;
+			}
+
+			trelay_count(port, len, rc == NETDEV_TX_OK);
+		}
+
+		HARD_TX_UNLOCK(dev, txq);
+
+		while ((skb = __skb_dequeue(&busy)) != NULL) {
+			struct trelay_port *port = TRELAY_SKB_CB(skb)->port;
+			unsigned int len = skb->len;
+			int ret = dev_queue_xmit(skb);
+
+			trelay_count(port, len, !net_xmit_eval(ret));
+		}
+
+		skb = __skb_dequeue(q);
+	}
+}
+
+static void trelay_tasklet(unsigned long data)
+{
+	struct trelay_queue *q = this_cpu_ptr(&trelay_queues);
+
+	trelay_xmit_queue(&q->skbs);
+}
+
+static u16 trelay_pick_tx(struct net_device *dev, struct sk_buff *skb)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0)
+	return netdev_pick_tx(dev, skb, NULL);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+	return skb_tx_hash(dev, NULL, skb);
+#else
+	return skb_tx_hash(dev, skb);
+#endif
+}
+
+static void trelay_xmit_fast(struct trelay_port *port, struct sk_buff *skb)
+{
+	struct net_device *dev = skb->dev;
+	struct trelay_queue *q;
+
+	/* Some drivers deliver frames outside of softirq context */
+	local_bh_disable();
+
+	q = this_cpu_ptr(&trelay_queues);
+	skb_set_queue_mapping(skb, trelay_pick_tx(dev, skb));
+	TRELAY_SKB_CB(skb)->port = port;
+	__skb_queue_tail(&q->skbs, skb);
+
+	if (skb_queue_len(&q->skbs) >= TRELAY_BATCH)
+		trelay_xmit_queue(&q->skbs);
+	else
+		tasklet_schedule(&q->tasklet);
+
+	local_bh_enable();
+}
+
+static bool trelay_bypass(struct trelay *tr, __be16 proto)
+{
+	struct trelay_bypass *b = rcu_dereference(tr->bypass);
+	int i;
+
+	for (i = 0; b && i < b->n; i++)
+		if (b->proto[i] == proto)
+			return true;
+
+	return false;
+}
+
+/*
+ * The fast path skips validate_xmit_skb(), so anything that may need the
+ * software fallbacks of the stack (segmentation, checksum, VLAN tag
+ * insertion, linearization) still goes through dev_queue_xmit(). So do
+ * frames for drivers that pick their own tx queue.
+ */
+static bool trelay_can_fast(struct trelay_port *port, struct sk_buff *skb)
+{
+	struct net_device *dev = port->peer;
+
+	if (!netif_running(dev) || dev->netdev_ops->ndo_select_queue ||
+	    skb_is_gso(skb) || skb->ip_summed == CHECKSUM_PARTIAL ||
+	    skb_vlan_tag_present(skb))
+		return false;
+
+	if (skb_is_nonlinear(skb) && !(dev->features & NETIF_F_SG))
+		return false;
+
+	return true;
+}
+
 rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb)
 {
-	struct net_device *dev;
+	struct trelay_port *port;
 	struct sk_buff *skb = *pskb;
+	unsigned int len;
+	int ret;
 
-	dev = rcu_dereference(skb->dev->rx_handler_data);
-	if (!dev)
+	port = rcu_dereference(skb->dev->rx_handler_data);
+	if (!port)
 		return RX_HANDLER_PASS;
 
-	if (skb->protocol == htons(ETH_P_PAE))
+	if (trelay_bypass(port->tr, skb->protocol)) {
+		trelay_count_bypass(port);
 		return RX_HANDLER_PASS;
+	}
 
 	skb_push(skb, ETH_HLEN);
-	skb->dev = dev;
+	skb->dev = port->peer;
 	skb_forward_csum(skb);
-	dev_queue_xmit(skb);
+
+	if (READ_ONCE(port->tr->fast) && trelay_can_fast(port, skb)) {
+		trelay_xmit_fast(port, skb);
+		return RX_HANDLER_CONSUMED;
+	}
+
+	len = skb->len;
+	ret = dev_queue_xmit(skb);
+	trelay_count(port, len, !net_xmit_eval(ret));
 
 	return RX_HANDLER_CONSUMED;
 }
@@ -61,6 +273,14 @@ static int trelay_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static void trelay_flush_queues(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		tasklet_kill(&per_cpu(trelay_queues, cpu).tasklet);
+}
+
 static int trelay_do_remove(struct trelay *tr)
 {
 	list_del(&tr->list);
@@ -69,14 +289,20 @@ static int trelay_do_remove(struct trelay *tr)
 	 * to prevent dangling pointer in file->private_data */
 	debugfs_remove_recursive(tr->debugfs);
 
-	dev_put(tr->dev1);
-	dev_put(tr->dev2);
-
 	netdev_rx_handler_unregister(tr->dev1);
 	netdev_rx_handler_unregister(tr->dev2);
 
+	/* Frames queued by the fast path still point to the ports */
+	trelay_flush_queues();
+
+	dev_put(tr->dev1);
+	dev_put(tr->dev2);
+
 	trelay_log(KERN_INFO, tr, "stopped");
 
+	free_percpu(tr->port[0].stats);
+	free_percpu(tr->port[1].stats);
+	kfree(rcu_dereference_protected(tr->bypass, 1));
 	kfree(tr);
 
 	return 0;
@@ -146,9 +372,149 @@ static const struct file_operations fops_remove = {
 };
 
 
+static void trelay_port_stats(struct trelay_port *port, struct trelay_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct trelay_stats *st = per_cpu_ptr(port->stats, cpu);
+		u64 packets, bytes, dropped, bypassed;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_irq(&st->syncp);
+			packets = st->packets;
+			bytes = st->bytes;
+			dropped = st->dropped;
+			bypassed = st->bypassed;
+		} while (u64_stats_fetch_retry_irq(&st->syncp, start));
+
+		sum->packets += packets;
+		sum->bytes += bytes;
+		sum->dropped += dropped;
+		sum->bypassed += bypassed;
+	}
+}
+
+static ssize_t trelay_stats_read(struct file *file, char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct trelay *tr = file->private_data;
+	struct trelay_stats sum;
+	char buf[256];
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tr->port); i++) {
+		struct trelay_port *port = &tr->port[i];
+
+		trelay_port_stats(port, &sum);
+		len += scnprintf(buf + len, sizeof(buf) - len,
+				 "%s -> %s: packets %llu bytes %llu dropped %llu bypassed %llu\n",
+				 port->dev->name, port->peer->name,
+				 sum.packets, sum.bytes, sum.dropped,
+				 sum.bypassed);
+	}
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static const struct file_operations fops_stats = {
+	.owner = THIS_MODULE,
+	.open = trelay_open,
+	.read = trelay_stats_read,
+	.llseek = default_llseek,
+};
+
+static ssize_t trelay_bypass_read(struct file *file, char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	struct trelay *tr = file->private_data;
+	char buf[8 * TRELAY_MAX_BYPASS + 2];
+	struct trelay_bypass *b;
+	int i, len = 0;
+
+	rcu_read_lock();
+	b = rcu_dereference(tr->bypass);
+	for (i = 0; b && i < b->n; i++)
+		len += scnprintf(buf + len, sizeof(buf) - len, "%s0x%04x",
+				 i ? " " : "", ntohs(b->proto[i]));
+	rcu_read_unlock();
+
+	len += scnprintf(buf + len, sizeof(buf) - len, "\n");
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+/*
+ * Takes a whitespace separated list of ethertypes which are passed up to
+ * the local stack instead of being relayed. An empty write relays all of
+ * them, including EAPOL.
+ */
+static ssize_t trelay_bypass_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct trelay *tr = file->private_data;
+	struct trelay_bypass *b, *old;
+	char buf[128], *cur, *tok;
+	u16 proto;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = 0;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	cur = buf;
+	while ((tok = strsep(&cur, " \t\n,")) != NULL) {
+		if (!*tok)
+			continue;
+
+		if (b->n == TRELAY_MAX_BYPASS) {
+			kfree(b);
+			return -ENOSPC;
+		}
+
+		if (kstrtou16(tok, 0, &proto)) {
+			kfree(b);
+			return -EINVAL;
+		}
+
+		b->proto[b->n++] = htons(proto);
+	}
+
+	/* Frames in flight keep using the old list until it is freed */
+	mutex_lock(&trelay_bypass_lock);
+	old = rcu_dereference_protected(tr->bypass,
+					lockdep_is_held(&trelay_bypass_lock));
+	rcu_assign_pointer(tr->bypass, b);
+	mutex_unlock(&trelay_bypass_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return count;
+}
+
+static const struct file_operations fops_bypass = {
+	.owner = THIS_MODULE,
+	.open = trelay_open,
+	.read = trelay_bypass_read,
+	.write = trelay_bypass_write,
+	.llseek = default_llseek,
+};
+
+
 static int trelay_do_add(char *name, char *devn1, char *devn2)
 {
 	struct net_device *dev1, *dev2;
+	struct trelay_bypass *b;
 	struct trelay *tr, *tr1;
 	int ret;
 
@@ -156,6 +522,17 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!tr)
 		return -ENOMEM;
 
+	ret = -ENOMEM;
+	tr->port[0].stats = netdev_alloc_pcpu_stats(struct trelay_stats);
+	tr->port[1].stats = netdev_alloc_pcpu_stats(struct trelay_stats);
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!tr->port[0].stats || !tr->port[1].stats || !b)
+		goto free;
+
+	/* Keep 802.1X authentication local by default */
+	b->proto[b->n++] = htons(ETH_P_PAE);
+	RCU_INIT_POINTER(tr->bypass, b);
+
 	rtnl_lock();
 	rcu_read_lock();
 
@@ -171,11 +548,18 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!dev1 || !dev2)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, dev2);
+	tr->port[0].tr = tr;
+	tr->port[0].dev = dev1;
+	tr->port[0].peer = dev2;
+	tr->port[1].tr = tr;
+	tr->port[1].dev = dev2;
+	tr->port[1].peer = dev1;
+
+	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, &tr->port[0]);
 	if (ret < 0)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, dev1);
+	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, &tr->port[1]);
 	if (ret < 0) {
 		netdev_rx_handler_unregister(dev1);
 		goto out;
@@ -193,13 +577,22 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 
 	tr->debugfs = debugfs_create_dir(name, debugfs_dir);
 	debugfs_create_file("remove", S_IWUSR, tr->debugfs, tr, &fops_remove);
+	debugfs_create_file("stats", S_IRUSR, tr->debugfs, tr, &fops_stats);
+	debugfs_create_file("bypass", S_IRUSR | S_IWUSR, tr->debugfs, tr,
+			    &fops_bypass);
+	debugfs_create_bool("fast", S_IRUSR | S_IWUSR, tr->debugfs, &tr->fast);
 	ret = 0;
 
 out:
 	rcu_read_unlock();
 	rtnl_unlock();
-	if (ret < 0)
+free:
+	if (ret < 0) {
+		free_percpu(tr->port[0].stats);
+		free_percpu(tr->port[1].stats);
+		kfree(b);
 		kfree(tr);
+	}
 
 	return ret;
 }
@@ -256,7 +649,14 @@ static struct notifier_block tr_dev_notifier = {
 
 static int __init trelay_init(void)
 {
-	int ret;
+	int cpu, ret;
+
+	for_each_possible_cpu(cpu) {
+		struct trelay_queue *q = &per_cpu(trelay_queues, cpu);
+
+		skb_queue_head_init(&q->skbs);
+		tasklet_init(&q->tasklet, trelay_tasklet, 0);
+	}
 
 	debugfs_dir = debugfs_create_dir("trelay", NULL);
 	if (!debugfs_dir)
@@ -278,6 +678,7 @@ error:
 static void __exit trelay_exit(void)
 {
 	struct trelay *tr, *tmp;
+	int cpu;
 
 	unregister_netdevice_notifier(&tr_dev_notifier);
 
@@ -286,6 +687,10 @@ static void __exit trelay_exit(void)
 		trelay_do_remove(tr);
 	rtnl_unlock();
 
+	trelay_flush_queues();
+	for_each_possible_cpu(cpu)
+		skb_queue_purge(&per_cpu(trelay_queues, cpu).skbs);
+
 	debugfs_remove_recursive(debugfs_dir);
 }
 
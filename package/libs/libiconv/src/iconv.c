@@ -31,6 +31,9 @@
 #define TIS_620     011
 #define JIS_0201    012
 
+/* dest charmaps are numbered from here on */
+#define CHARMAP     040
+
 /* some programs like php need this */
 int _libiconv_version = _LIBICONV_VERSION;
 
@@ -103,13 +106,75 @@ static int find_charset(const char *name)
 	return *s;
 }
 
+/*
+ * Reverse charmap for encoding, two levels keyed by the high and low
+ * byte of the code point. Only the 256 code point pages that the map
+ * actually uses are allocated, page 0 maps nothing.
+ */
+struct revmap {
+	unsigned char index[256];
+	unsigned char page[][256];
+};
+
+static struct revmap *revmaps[sizeof(charmaps) / sizeof(charmaps[0])];
+
+static struct revmap *build_revmap(const unsigned char *map)
+{
+	unsigned char index[256] = { 0 };
+	struct revmap *r;
+	unsigned c;
+	int i, n = 1;
+
+	if (map[0] != UCS2_8BIT)
+		return NULL;
+
+	for (i = 0; i < 128; i++) {
+		c = map[4 + 2*i] << 8 | map[5 + 2*i];
+		if (c != 0xffff && !index[c >> 8])
+			index[c >> 8] = n++;
+	}
+
+	if (!(r = calloc(1, sizeof(*r) + n * sizeof(r->page[0]))))
+		return NULL;
+
+	memcpy(r->index, index, sizeof(index));
+
+	for (i = 0; i < 128; i++) {
+		c = map[4 + 2*i] << 8 | map[5 + 2*i];
+		if (c != 0xffff && !r->page[index[c >> 8]][c & 0xff])
+			r->page[index[c >> 8]][c & 0xff] = 0x80 + i;
+	}
+
+	return r;
+}
+
+/* built on first use and kept, charmaps nobody encodes to cost nothing */
+static int charmap_reverse(int m)
+{
+	struct revmap *r;
+
+	if (revmaps[m])
+		return 0;
+
+	if (!(r = build_revmap(charmaps[m].map)))
+		return -1;
+
+	if (!__sync_bool_compare_and_swap(&revmaps[m], NULL, r))
+		free(r);
+
+	return 0;
+}
+
 iconv_t iconv_open(const char *to, const char *from)
 {
 	unsigned f, t;
 	int m;
 
-	if ((t = find_charset(to)) > 8)
-		return -1;
+	if ((t = find_charset(to)) > 8) {
+		if ((m = find_charmap(to)) < 0 || charmap_reverse(m))
+			return -1;
+		t = CHARMAP + m;
+	}
 
 	if ((f = find_charset(from)) < 255)
 		return 0 | (t<<1) | (f<<8);
@@ -138,6 +203,10 @@ static inline void put_16(unsigned char *s, wchar_t c, int endian)
 	s[endian^1] = c;
 }
 
+/*
+ * Unlike decoding, encoding has no state to track: the code point is
+ * already validated and its magnitude alone gives the sequence length.
+ */
 static inline int utf8enc_wchar(char *outb, wchar_t c)
 {
 	if (c <= 0x7F) {
@@ -168,89 +237,121 @@ static inline int utf8enc_wchar(char *outb, wchar_t c)
 	}
 }
 
-static inline int utf8seq_is_overlong(char *s, int n)
-{
-	switch (n)
-	{
-	case 2:
-		/* 1100000x (10xxxxxx) */
-		return (((*s >> 1) == 0x60) &&
-				((*(s+1) >> 6) == 0x02));
-
-	case 3:
-		/* 11100000 100xxxxx (10xxxxxx) */
-		return ((*s == 0xE0) &&
-				((*(s+1) >> 5) == 0x04) &&
-				((*(s+2) >> 6) == 0x02));
-
-	case 4:
-		/* 11110000 1000xxxx (10xxxxxx 10xxxxxx) */
-		return ((*s == 0xF0) &&
-				((*(s+1) >> 4) == 0x08) &&
-				((*(s+2) >> 6) == 0x02) &&
-				((*(s+3) >> 6) == 0x02));
-	}
+/* utf-8 decoder states, the remaining ones wait for continuation bytes */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 1
+
+/*
+ * Byte classes for the utf-8 decoder:
+ * 0: 00-7F, 1: 80-8F, 2: 90-9F, 3: A0-BF, 4: C0-C1 F5-FF, 5: C2-DF,
+ * 6: E0, 7: E1-EC EE-EF, 8: ED, 9: F0, 10: F1-F3, 11: F4
+ */
+static const unsigned char utf8_class[256] = {
+	[0x00 ... 0x7F] = 0,
+	[0x80 ... 0x8F] = 1,
+	[0x90 ... 0x9F] = 2,
+	[0xA0 ... 0xBF] = 3,
+	[0xC0 ... 0xC1] = 4,
+	[0xC2 ... 0xDF] = 5,
+	[0xE0]          = 6,
+	[0xE1 ... 0xEC] = 7,
+	[0xED]          = 8,
+	[0xEE ... 0xEF] = 7,
+	[0xF0]          = 9,
+	[0xF1 ... 0xF3] = 10,
+	[0xF4]          = 11,
+	[0xF5 ... 0xFF] = 4,
+};
 
-	return 0;
-}
+/* payload bits of a lead byte of the given class */
+static const unsigned char utf8_lead_mask[12] = {
+	0x7F, 0, 0, 0, 0, 0x1F, 0x0F, 0x0F, 0x0F, 0x07, 0x07, 0x07
+};
 
-static inline int utf8seq_is_surrogate(char *s, int n)
-{
-	return ((n == 3) && (*s == 0xED) && (*(s+1) >= 0xA0) && (*(s+1) <= 0xBF));
-}
+/*
+ * Transitions, overlong forms (E0 80-9F, F0 80-8F), surrogates (ED A0-BF)
+ * and code points above U+10FFFF (F4 90-BF) are rejected here already.
+ *
+ * 2: one byte missing, 3: two bytes missing, 4: after E0, 5: after ED,
+ * 6: three bytes missing, 7: after F0, 8: after F4
+ */
+static const unsigned char utf8_trans[9][12] = {
+	{ 0, 1, 1, 1, 1, 2, 4, 3, 5, 7, 6, 8 },
+	{ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 3, 3, 3, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 1, 3, 3, 1, 1, 1, 1, 1, 1, 1, 1 },
+	{ 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+};
 
-static inline int utf8seq_is_illegal(char *s, int n)
+static inline int utf8dec_wchar(wchar_t *c, unsigned char *in, size_t inb)
 {
-	return ((n == 3) && (*s == 0xEF) && (*(s+1) == 0xBF) &&
-	        (*(s+2) >= 0xBE) && (*(s+2) <= 0xBF));
+	unsigned int state, type;
+	wchar_t cp;
+	size_t n;
+
+	type = utf8_class[*in];
+	cp = *in & utf8_lead_mask[type];
+	state = utf8_trans[UTF8_ACCEPT][type];
+
+	for (n = 1; state > UTF8_REJECT; n++) {
+		/* starved? */
+		if (n >= inb)
+			return -2;
+
+		type = utf8_class[in[n]];
+		cp = (cp << 6) | (in[n] & 0x3F);
+		state = utf8_trans[state][type];
+	}
+
+	/* reject invalid sequences and the noncharacters U+FFFE, U+FFFF */
+	if (state == UTF8_REJECT || cp == 0xFFFE || cp == 0xFFFF)
+		return -1;
+
+	*c = cp;
+	return n;
 }
 
-static inline int utf8dec_wchar(wchar_t *c, unsigned char *in, size_t inb)
+/*
+ * Copy the leading run of ascii characters, a word at a time as long as
+ * no byte has the high bit set. Returns the number of bytes copied.
+ */
+static inline size_t ascii_copy(unsigned char *out, const unsigned char *in,
+                                size_t n)
 {
-	int i;
-	int n = -1;
+	const size_t high = (size_t)-1 / 0xFF * 0x80;
+	size_t i, w;
 
-	/* trivial char */
-	if (*in <= 0x7F) {
-		*c = *in;
-		return 1;
+	for (i = 0; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, in + i, sizeof(w));
+		if (w & high)
+			break;
+		memcpy(out + i, &w, sizeof(w));
 	}
 
-	/* find utf8 sequence length */
-	if      ((*in & 0xE0) == 0xC0) n = 2;
-	else if ((*in & 0xF0) == 0xE0) n = 3;
-	else if ((*in & 0xF8) == 0xF0) n = 4;
-	else if ((*in & 0xFC) == 0xF8) n = 5;
-	else if ((*in & 0xFE) == 0xFC) n = 6;
-
-	/* starved? */
-	if (n > inb)
-		return -2;
-
-	/* decode ... */
-	if (n > 1 && n < 5) {
-		/* reject invalid sequences */
-		if (utf8seq_is_overlong(in, n) ||
-			utf8seq_is_surrogate(in, n) ||
-			utf8seq_is_illegal(in, n))
-			return -1;
-
-		/* decode ... */
-		*c = (char)(*in++ & (0x7F >> n));
+	for (; i < n && in[i] < 0x80; i++)
+		out[i] = in[i];
 
-		for (i = 1; i < n; i++) {
-			/* illegal continuation byte */
-			if (*in < 0x80 || *in > 0xBF)
-				return -1;
+	return i;
+}
 
-			*c = (*c << 6) | (*in++ & 0x3F);
-		}
+/* Same for the 16 bit and wchar_t targets, one character at a time */
+static inline size_t ascii_widen(unsigned char *out, const unsigned char *in,
+                                 size_t n, int to)
+{
+	size_t i;
 
-		return n;
+	for (i = 0; i < n && in[i] < 0x80; i++) {
+		if (to == WCHAR_T)
+			((wchar_t *)out)[i] = in[i];
+		else
+			put_16(out + 2 * i, in[i], to);
 	}
 
-	/* unmapped sequence (> 4) */
-	return -1;
+	return i;
 }
 
 static inline wchar_t latin9_translit(wchar_t c)
@@ -275,10 +376,11 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	unsigned char to = (cd>>1)&127;
 	unsigned char from = 255;
 	const unsigned char *map = 0;
+	const struct revmap *rev;
 	char tmp[MB_LEN_MAX];
 	wchar_t c, d;
 	size_t k, l;
-	int err;
+	int err, ascii;
 
 	if (!in || !*in || !*inb) return 0;
 
@@ -287,7 +389,40 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 	else
 		from = cd>>8;
 
+	/* ascii superset source, runs of ascii skip the per character switch */
+	ascii = from >= UTF_8 ? (to >= CHARMAP ? LATIN_1 : to) : -1;
+
 	for (; *inb; *in+=l, *inb-=l) {
+		if (!(**in & 0x80)) switch (ascii) {
+		case UTF_8:
+		case US_ASCII:
+		case LATIN_1:
+		case LATIN_9:
+			k = *inb < *outb ? *inb : *outb;
+			l = ascii_copy((unsigned char *)*out,
+			               (unsigned char *)*in, k);
+			if (l) {
+				*out += l;
+				*outb -= l;
+				continue;
+			}
+			break;
+		case UTF_16BE:
+		case UTF_16LE:
+		case WCHAR_T:
+			k = ascii == WCHAR_T ? sizeof(wchar_t) : 2;
+			k = *inb < *outb / k ? *inb : *outb / k;
+			l = ascii_widen((unsigned char *)*out,
+			                (unsigned char *)*in, k, ascii);
+			if (l) {
+				k = l * (ascii == WCHAR_T ? sizeof(wchar_t) : 2);
+				*out += k;
+				*outb -= k;
+				continue;
+			}
+			break;
+		}
+
 		c = *(unsigned char *)*in;
 		l = 1;
 		if (from >= UTF_8 && c < 0x80) goto charok;
@@ -302,6 +437,14 @@ size_t iconv(iconv_t cd, char **in, size_t *inb, char **out, size_t *outb)
 			if (!l) l++;
 			else if (l == (size_t)-1) goto ilseq;
 			else if (l == (size_t)-2) goto starved;
+			/* already validated, no need to encode it again */
+			if (to == UTF_8) {
+				if (*outb < l) goto toobig;
+				memcpy(*out, *in, l);
+				*out += l;
+				*outb -= l;
+				continue;
+			}
 			break;
 		case US_ASCII:
 			goto ilseq;
@@ -425,7 +568,18 @@ charok:
 			*outb -= 4;
 			break;
 		default:
-			goto badf;
+			if (to < CHARMAP) goto badf;
+			if (c >= 0x80) {
+				rev = revmaps[to - CHARMAP];
+				if (c > 0xffff) goto ilseq;
+				c = rev->page[rev->index[c >> 8]][c & 0xff];
+				if (!c) goto ilseq;
+			}
+			if (!*outb) goto toobig;
+			**out = c;
+			++*out;
+			--*outb;
+			break;
 		}
 	}
 	return x;
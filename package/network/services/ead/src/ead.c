@@ -167,6 +167,23 @@ get_random_bytes(void *ptr, int len)
 	close(fd);
 }
 
+/* Build the table for g^x once, so that forked servers inherit it */
+static void
+prepare_exp_base(void)
+{
+	struct t_confent *ce = gettcid(tpe.index);
+	BigInteger n, g;
+
+	if (!ce)
+		return;
+
+	n = BigIntegerFromBytes(ce->modulus.data, ce->modulus.len);
+	g = BigIntegerFromBytes(ce->generator.data, ce->generator.len);
+	BigIntegerSetExpBase(g, n);
+	BigIntegerFree(g);
+	BigIntegerFree(n);
+}
+
 static bool
 prepare_password(void)
 {
@@ -250,7 +267,7 @@ hash_password:
 	/* x = H(s, H(u, ':', p)) */
 	x = BigIntegerFromBytes(dig, sizeof(dig));
 
-	BigIntegerModExp(v, g, x, n);
+	BigIntegerModExpBase(v, g, x, n);
 	tpe.password.len = BigIntegerToBytes(v, (unsigned char *)pwbuf);
 
 	BigIntegerFree(v);
@@ -959,6 +976,7 @@ int main(int argc, char **argv)
 	get_random_bytes(ethmac + 3, 3);
 	nid = *(((u16_t *) ethmac) + 2);
 
+	prepare_exp_base();
 	start_servers(false);
 	br_init();
 	tv.tv_sec = 1;
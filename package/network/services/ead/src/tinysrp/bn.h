@@ -74,7 +74,7 @@ extern "C" {
 #undef BN_SQR_COMBA
 #undef BN_RECURSION
 #undef RECP_MUL_MOD
-#undef MONT_MUL_MOD
+#define MONT_MUL_MOD
 
 #if defined(SIZEOF_LONG_LONG) && SIZEOF_LONG_LONG == 8
 # if SIZEOF_LONG == 4
@@ -272,6 +272,18 @@ typedef struct bn_recp_ctx_st
 	int flags;
 	} BN_RECP_CTX;
 
+/* Precomputed powers of a fixed base for BN_mod_exp_fixed_base() */
+#define BN_FIXED_BASE_WINDOW	4
+
+typedef struct bn_fixed_base_st
+	{
+	BN_MONT_CTX mont; /* context for the modulus */
+	BIGNUM g;         /* the base as passed in */
+	BIGNUM *table;    /* g^(2^(window*i)) in montgomery form */
+	int num;          /* number of table entries */
+	int window;       /* exponent bits per table entry */
+	} BN_FIXED_BASE;
+
 #define BN_to_montgomery(r,a,mont,ctx)  BN_mod_mul_montgomery(\
 	r,a,&((mont)->RR),(mont),ctx)
 
@@ -348,8 +360,6 @@ int     BN_mod_exp(BIGNUM *r, BIGNUM *a, const BIGNUM *p,
 		   const BIGNUM *m,BN_CTX *ctx);
 int     BN_mod_exp_mont(BIGNUM *r, BIGNUM *a, const BIGNUM *p,
 			const BIGNUM *m, BN_CTX *ctx, BN_MONT_CTX *m_ctx);
-int     BN_mod_exp_mont_word(BIGNUM *r, BN_ULONG a, const BIGNUM *p,
-			const BIGNUM *m, BN_CTX *ctx, BN_MONT_CTX *m_ctx);
 int     BN_mod_exp_simple(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
 	const BIGNUM *m,BN_CTX *ctx);
 int     BN_mask_bits(BIGNUM *a,int n);
@@ -382,6 +392,12 @@ void BN_MONT_CTX_free(BN_MONT_CTX *mont);
 int BN_MONT_CTX_set(BN_MONT_CTX *mont,const BIGNUM *modulus,BN_CTX *ctx);
 BN_MONT_CTX *BN_MONT_CTX_copy(BN_MONT_CTX *to,BN_MONT_CTX *from);
 
+BN_FIXED_BASE *BN_FIXED_BASE_new(const BIGNUM *g, const BIGNUM *m,
+				 int max_bits, BN_CTX *ctx);
+void BN_FIXED_BASE_free(BN_FIXED_BASE *fb);
+int BN_mod_exp_fixed_base(BIGNUM *r, const BIGNUM *p, BN_FIXED_BASE *fb,
+			  BN_CTX *ctx);
+
 void BN_set_params(int mul,int high,int low,int mont);
 int BN_get_params(int which); /* 0, mul, 1 high, 2 low, 3 mont */
 
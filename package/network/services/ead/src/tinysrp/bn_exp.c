@@ -111,6 +111,7 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "bn_lcl.h"
 
 #define TABLE_SIZE      32
@@ -155,15 +156,7 @@ int BN_mod_exp(BIGNUM *r, BIGNUM *a, const BIGNUM *p, const BIGNUM *m,
 /*      if ((m->d[m->top-1]&BN_TBIT) && BN_is_odd(m)) */
 
 	if (BN_is_odd(m))
-		{
-		if (a->top == 1)
-			{
-			BN_ULONG A = a->d[0];
-			ret=BN_mod_exp_mont_word(r,A,p,m,ctx,NULL);
-			}
-		else
-			ret=BN_mod_exp_mont(r,a,p,m,ctx,NULL);
-		}
+		{ ret=BN_mod_exp_mont(r,a,p,m,ctx,NULL); }
 	else
 #endif
 #ifdef RECP_MUL_MOD
@@ -176,6 +169,142 @@ int BN_mod_exp(BIGNUM *r, BIGNUM *a, const BIGNUM *p, const BIGNUM *m,
 	}
 
 
+int BN_mod_exp_mont(BIGNUM *rr, BIGNUM *a, const BIGNUM *p,
+		    const BIGNUM *m, BN_CTX *ctx, BN_MONT_CTX *in_mont)
+	{
+	int i,j,bits,ret=0,wstart,wend,window,wvalue;
+	int start=1,ts=0;
+	BIGNUM *d,*r;
+	BIGNUM *aa;
+	BIGNUM val[TABLE_SIZE];
+	BN_MONT_CTX *mont=NULL;
+
+	bn_check_top(a);
+	bn_check_top(p);
+	bn_check_top(m);
+
+	if (!(m->d[0] & 1))
+		{
+		return(0);
+		}
+	bits=BN_num_bits(p);
+	if (bits == 0)
+		{
+		BN_one(rr);
+		return(1);
+		}
+	BN_CTX_start(ctx);
+	d = BN_CTX_get(ctx);
+	r = BN_CTX_get(ctx);
+	if (d == NULL || r == NULL) goto err;
+
+	/* If this is not done, things will break in the montgomery
+	 * part */
+
+	if (in_mont != NULL)
+		mont=in_mont;
+	else
+		{
+		if ((mont=BN_MONT_CTX_new()) == NULL) goto err;
+		if (!BN_MONT_CTX_set(mont,m,ctx)) goto err;
+		}
+
+	BN_init(&val[0]);
+	ts=1;
+	if (BN_ucmp(a,m) >= 0)
+		{
+		if (!BN_mod(&(val[0]),a,m,ctx))
+			goto err;
+		aa= &(val[0]);
+		}
+	else
+		aa=a;
+	if (!BN_to_montgomery(&(val[0]),aa,mont,ctx)) goto err; /* 1 */
+
+	window = BN_window_bits_for_exponent_size(bits);
+	if (window > 1)
+		{
+		if (!BN_mod_mul_montgomery(d,&(val[0]),&(val[0]),mont,ctx)) goto err; /* 2 */
+		j=1<<(window-1);
+		for (i=1; i<j; i++)
+			{
+			BN_init(&(val[i]));
+			if (!BN_mod_mul_montgomery(&(val[i]),&(val[i-1]),d,mont,ctx))
+				goto err;
+			}
+		ts=i;
+		}
+
+	start=1;        /* This is used to avoid multiplication etc
+			 * when there is only the value '1' in the
+			 * buffer. */
+	wvalue=0;       /* The 'value' of the window */
+	wstart=bits-1;  /* The top bit of the window */
+	wend=0;         /* The bottom bit of the window */
+
+	if (!BN_to_montgomery(r,BN_value_one(),mont,ctx)) goto err;
+	for (;;)
+		{
+		if (BN_is_bit_set(p,wstart) == 0)
+			{
+			if (!start)
+				{
+				if (!BN_mod_mul_montgomery(r,r,r,mont,ctx))
+				goto err;
+				}
+			if (wstart == 0) break;
+			wstart--;
+			continue;
+			}
+		/* We now have wstart on a 'set' bit, we now need to work out
+		 * how bit a window to do.  To do this we need to scan
+		 * forward until the last set bit before the end of the
+		 * window */
+		j=wstart;
+		wvalue=1;
+		wend=0;
+		for (i=1; i<window; i++)
+			{
+			if (wstart-i < 0) break;
+			if (BN_is_bit_set(p,wstart-i))
+				{
+				wvalue<<=(i-wend);
+				wvalue|=1;
+				wend=i;
+				}
+			}
+
+		/* wend is the size of the current window */
+		j=wend+1;
+		/* add the 'bytes above' */
+		if (!start)
+			for (i=0; i<j; i++)
+				{
+				if (!BN_mod_mul_montgomery(r,r,r,mont,ctx))
+					goto err;
+				}
+
+		/* wvalue will be an odd number < 2^window */
+		if (!BN_mod_mul_montgomery(r,r,&(val[wvalue>>1]),mont,ctx))
+			goto err;
+
+		/* move the 'window' down further */
+		wstart-=wend+1;
+		wvalue=0;
+		start=0;
+		if (wstart < 0) break;
+		}
+	if (!BN_from_montgomery(rr,r,mont,ctx)) goto err;
+	ret=1;
+err:
+	if ((in_mont == NULL) && (mont != NULL)) BN_MONT_CTX_free(mont);
+	BN_CTX_end(ctx);
+	for (i=0; i<ts; i++)
+		BN_clear_free(&(val[i]));
+	return(ret);
+	}
+
+
 #ifdef RECP_MUL_MOD
 int BN_mod_exp_recp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
 		    const BIGNUM *m, BN_CTX *ctx)
@@ -393,3 +522,145 @@ err:
 	return(ret);
 	}
 #endif
+
+/* Fixed base exponentiation (Brickell, Gordon, McCurley and Wilson).
+ * The powers g^(2^(window*i)) are computed once, after which g^p costs
+ * about bits/window + 2^window multiplications and no squarings. This
+ * pays off when the same generator is raised to many random exponents,
+ * as the SRP server does for every login. */
+BN_FIXED_BASE *BN_FIXED_BASE_new(const BIGNUM *g, const BIGNUM *m,
+				 int max_bits, BN_CTX *ctx)
+	{
+	BN_FIXED_BASE *fb;
+	BIGNUM *t;
+	int i,j;
+
+	bn_check_top(g);
+	bn_check_top(m);
+
+	if (!BN_is_odd(m) || max_bits <= 0)
+		return(NULL);
+
+	if ((fb=(BN_FIXED_BASE *)malloc(sizeof(BN_FIXED_BASE))) == NULL)
+		return(NULL);
+
+	BN_MONT_CTX_init(&fb->mont);
+	BN_init(&fb->g);
+	fb->window=BN_FIXED_BASE_WINDOW;
+	fb->num=(max_bits+fb->window-1)/fb->window;
+	fb->table=(BIGNUM *)malloc(fb->num*sizeof(BIGNUM));
+	if (fb->table == NULL)
+		{
+		free(fb);
+		return(NULL);
+		}
+	for (i=0; i<fb->num; i++)
+		BN_init(&fb->table[i]);
+
+	BN_CTX_start(ctx);
+	if ((t = BN_CTX_get(ctx)) == NULL) goto err;
+	if (!BN_MONT_CTX_set(&fb->mont,m,ctx)) goto err;
+	if (BN_copy(&fb->g,g) == NULL) goto err;
+	if (!BN_mod(t,g,m,ctx)) goto err;
+	if (!BN_to_montgomery(&fb->table[0],t,&fb->mont,ctx)) goto err;
+
+	for (i=1; i<fb->num; i++)
+		{
+		if (BN_copy(t,&fb->table[i-1]) == NULL) goto err;
+		for (j=1; j<fb->window; j++)
+			if (!BN_mod_mul_montgomery(t,t,t,&fb->mont,ctx))
+				goto err;
+		if (!BN_mod_mul_montgomery(&fb->table[i],t,t,&fb->mont,ctx))
+			goto err;
+		}
+
+	BN_CTX_end(ctx);
+	return(fb);
+err:
+	BN_CTX_end(ctx);
+	BN_FIXED_BASE_free(fb);
+	return(NULL);
+	}
+
+void BN_FIXED_BASE_free(BN_FIXED_BASE *fb)
+	{
+	int i;
+
+	if (fb == NULL)
+		return;
+
+	for (i=0; i<fb->num; i++)
+		BN_clear_free(&fb->table[i]);
+	free(fb->table);
+	BN_free(&fb->g);
+	BN_MONT_CTX_free(&fb->mont);
+	free(fb);
+	}
+
+static int fixed_base_digit(const BIGNUM *p, int i, int window)
+	{
+	int j,d=0;
+
+	for (j=window-1; j>=0; j--)
+		d=(d<<1)|BN_is_bit_set(p,i*window+j);
+	return(d);
+	}
+
+int BN_mod_exp_fixed_base(BIGNUM *r, const BIGNUM *p, BN_FIXED_BASE *fb,
+			  BN_CTX *ctx)
+	{
+	int i,d,digits,bits,ret=0;
+	int a_one=1,b_one=1;
+	BIGNUM *A,*B;
+
+	bn_check_top(p);
+
+	bits=BN_num_bits(p);
+	if (bits == 0)
+		{
+		BN_one(r);
+		return(1);
+		}
+
+	/* Exponent is wider than the table, use the generic path */
+	if (bits > fb->num*fb->window)
+		return(BN_mod_exp_mont(r,&fb->g,p,&fb->mont.N,ctx,&fb->mont));
+
+	BN_CTX_start(ctx);
+	A = BN_CTX_get(ctx);
+	B = BN_CTX_get(ctx);
+	if (A == NULL || B == NULL) goto err;
+
+	/* B collects every table entry whose digit is at least d, so that
+	 * A ends up as the product of table[i]^digit(i) */
+	digits=(bits+fb->window-1)/fb->window;
+	for (d=(1<<fb->window)-1; d>0; d--)
+		{
+		for (i=0; i<digits; i++)
+			{
+			if (fixed_base_digit(p,i,fb->window) != d)
+				continue;
+			if (b_one)
+				{
+				if (BN_copy(B,&fb->table[i]) == NULL) goto err;
+				b_one=0;
+				}
+			else if (!BN_mod_mul_montgomery(B,B,&fb->table[i],&fb->mont,ctx))
+				goto err;
+			}
+		if (b_one)
+			continue;
+		if (a_one)
+			{
+			if (BN_copy(A,B) == NULL) goto err;
+			a_one=0;
+			}
+		else if (!BN_mod_mul_montgomery(A,A,B,&fb->mont,ctx))
+			goto err;
+		}
+
+	ret=BN_from_montgomery(r,A,&fb->mont,ctx);
+err:
+	BN_CTX_end(ctx);
+	return(ret);
+	}
@@ -163,6 +163,10 @@ _TYPE( void ) BigIntegerModExp P((BigInteger result, BigInteger base,
 				BigInteger expt, BigInteger modulus));
 _TYPE( void ) BigIntegerModExpInt P((BigInteger result, BigInteger base,
 				   unsigned int expt, BigInteger modulus));
+/* For BigIntegerModExpBase: base is expected to repeat across calls */
+_TYPE( void ) BigIntegerSetExpBase P((BigInteger base, BigInteger modulus));
+_TYPE( void ) BigIntegerModExpBase P((BigInteger result, BigInteger base,
+				BigInteger expt, BigInteger modulus));
 _TYPE( int ) BigIntegerCheckPrime P((BigInteger n));
 _TYPE( void ) BigIntegerFree P((BigInteger b));
 
@@ -155,6 +155,47 @@ BigIntegerModExp(r, b, e, m)
   BN_CTX_free(ctx);
 }
 
+/* Table of powers for the one base that is raised over and over (g) */
+#define FIXED_BASE_BITS 256
+
+static BN_FIXED_BASE * fixed_base = NULL;
+
+static BN_FIXED_BASE *
+fixed_base_get(b, m, ctx)
+     BigInteger b, m;
+     BN_CTX * ctx;
+{
+  if(fixed_base != NULL && BN_cmp(&fixed_base->g, b) == 0 &&
+     BN_cmp(&fixed_base->mont.N, m) == 0)
+    return fixed_base;
+
+  BN_FIXED_BASE_free(fixed_base);
+  fixed_base = BN_FIXED_BASE_new(b, m, FIXED_BASE_BITS, ctx);
+  return fixed_base;
+}
+
+void
+BigIntegerSetExpBase(b, m)
+     BigInteger b, m;
+{
+  BN_CTX * ctx = BN_CTX_new();
+  fixed_base_get(b, m, ctx);
+  BN_CTX_free(ctx);
+}
+
+void
+BigIntegerModExpBase(r, b, e, m)
+     BigInteger r, b, e, m;
+{
+  BN_CTX * ctx = BN_CTX_new();
+  BN_FIXED_BASE * fb = fixed_base_get(b, m, ctx);
+  if(fb != NULL)
+    BN_mod_exp_fixed_base(r, e, fb, ctx);
+  else
+    BN_mod_exp(r, b, e, m, ctx);
+  BN_CTX_free(ctx);
+}
+
 void
 BigIntegerModExpInt(r, b, e, m)
      BigInteger r, b;
@@ -17,11 +17,17 @@
 #include "sta_info.h"
 #include "ubus.h"
 #include "ap_drv_ops.h"
+#include "ieee802_11.h"
 #include "beacon.h"
 #include "rrm.h"
 #include "wnm_ap.h"
 #include "taxonomy.h"
 
+#define HOSTAPD_UBUS_RESP_TIMEOUT	100	/* ms */
+#define HOSTAPD_UBUS_VERDICT_TTL	5000	/* ms */
+#define HOSTAPD_UBUS_PROBE_BATCH	64	/* clients per notification */
+#define HOSTAPD_UBUS_CLIENT_GONE_TTL	60	/* s */
+
 static struct ubus_context *ctx;
 static struct blob_buf b;
 static int ctx_ref;
@@ -41,6 +47,56 @@ struct ubus_banned_client {
 	u8 addr[ETH_ALEN];
 };
 
+struct ubus_event_req {
+	struct ubus_notify_request nreq;
+	struct list_head list;
+	struct hostapd_data *hapd;
+	enum hostapd_ubus_event_type type;
+	u8 addr[ETH_ALEN];
+	int resp;
+	bool done;
+
+	/* copy of a deferred auth/assoc frame */
+	int ssi_signal;
+	size_t frame_len;
+	u8 frame[];
+};
+
+/* Last state of a station as reported by get_clients */
+struct ubus_client_state {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	u32 generation;
+	struct os_reltime removed;
+	bool seen;
+
+	u32 flags;
+	u16 aid;
+	u8 rrm_enabled_capa[WLAN_RRM_CAPABILITIES_IE_LEN];
+	size_t taxonomy_len;
+};
+
+struct ubus_probe_client {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	u8 target[ETH_ALEN];
+	struct os_reltime first_seen;
+	struct os_reltime last_seen;
+	unsigned int count;
+	int signal;
+	bool has_ht, has_vht;
+	struct ieee80211_ht_capabilities ht;
+	struct ieee80211_vht_capabilities vht;
+};
+
+struct ubus_sta_verdict {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	struct os_reltime expires[HOSTAPD_UBUS_TYPE_MAX];
+	int resp[HOSTAPD_UBUS_TYPE_MAX];
+	struct ubus_event_req *deferred[HOSTAPD_UBUS_TYPE_MAX];
+};
+
 static void ubus_receive(int sock, void *eloop_ctx, void *sock_ctx)
 {
 	struct ubus_context *ctx = eloop_ctx;
@@ -146,6 +202,208 @@ hostapd_bss_ban_client(struct hostapd_data *hapd, u8 *addr, int time)
 	eloop_register_timeout(0, time * 1000, hostapd_bss_del_ban, ban, hapd);
 }
 
+/* Entries outlive their verdicts until pending requests are done */
+static int
+hostapd_bss_verdict_gc_time(struct hostapd_data *hapd)
+{
+	if (hapd->ubus.verdict_ttl < HOSTAPD_UBUS_RESP_TIMEOUT)
+		return HOSTAPD_UBUS_RESP_TIMEOUT;
+
+	return hapd->ubus.verdict_ttl;
+}
+
+static void
+hostapd_bss_del_verdict(void *eloop_data, void *user_ctx)
+{
+	struct ubus_sta_verdict *v = eloop_data;
+	struct hostapd_data *hapd = user_ctx;
+	int i;
+
+	for (i = 0; i < HOSTAPD_UBUS_TYPE_MAX; i++) {
+		if (!v->deferred[i])
+			continue;
+
+		/* Still waiting for a reply, look again later */
+		eloop_register_timeout(0, hostapd_bss_verdict_gc_time(hapd) * 1000,
+				       hostapd_bss_del_verdict, v, hapd);
+		return;
+	}
+
+	avl_delete(&hapd->ubus.verdicts, &v->avl);
+	free(v);
+}
+
+static struct ubus_sta_verdict *
+hostapd_bss_get_verdict(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct ubus_sta_verdict *v;
+
+	v = avl_find_element(&hapd->ubus.verdicts, addr, v, avl);
+	if (v)
+		return v;
+
+	v = os_zalloc(sizeof(*v));
+	if (!v)
+		return NULL;
+
+	memcpy(v->addr, addr, sizeof(v->addr));
+	v->avl.key = v->addr;
+	avl_insert(&hapd->ubus.verdicts, &v->avl);
+	eloop_register_timeout(0, hostapd_bss_verdict_gc_time(hapd) * 1000,
+			       hostapd_bss_del_verdict, v, hapd);
+
+	return v;
+}
+
+static void
+hostapd_bss_set_verdict(struct hostapd_data *hapd, const u8 *addr,
+			enum hostapd_ubus_event_type type, int resp)
+{
+	struct ubus_sta_verdict *v;
+	int ttl = hapd->ubus.verdict_ttl;
+
+	if (ttl <= 0)
+		return;
+
+	v = hostapd_bss_get_verdict(hapd, addr);
+	if (!v)
+		return;
+
+	os_get_reltime(&v->expires[type]);
+	v->expires[type].sec += ttl / 1000;
+	v->expires[type].usec += (ttl % 1000) * 1000;
+	if (v->expires[type].usec >= 1000000) {
+		v->expires[type].sec++;
+		v->expires[type].usec -= 1000000;
+	}
+	v->resp[type] = resp;
+
+	eloop_cancel_timeout(hostapd_bss_del_verdict, v, hapd);
+	eloop_register_timeout(0, ttl * 1000, hostapd_bss_del_verdict, v, hapd);
+}
+
+static bool
+hostapd_bss_cached_verdict(struct ubus_sta_verdict *v,
+			   enum hostapd_ubus_event_type type, int *resp)
+{
+	struct os_reltime now;
+
+	if (!v || !os_reltime_initialized(&v->expires[type]))
+		return false;
+
+	os_get_reltime(&now);
+	if (os_reltime_before(&v->expires[type], &now))
+		return false;
+
+	*resp = v->resp[type];
+	return true;
+}
+
+static void ubus_event_timeout(void *eloop_data, void *user_ctx);
+static void ubus_event_replay(void *eloop_data, void *user_ctx);
+
+static void
+hostapd_ubus_event_free(struct ubus_event_req *ureq)
+{
+	struct hostapd_data *hapd = ureq->hapd;
+	struct ubus_sta_verdict *v;
+
+	eloop_cancel_timeout(ubus_event_timeout, ureq, hapd);
+	eloop_cancel_timeout(ubus_event_replay, ureq, hapd);
+
+	if (!ureq->done)
+		ubus_abort_request(ctx, &ureq->nreq.req);
+
+	v = avl_find_element(&hapd->ubus.verdicts, ureq->addr, v, avl);
+	if (v && v->deferred[ureq->type] == ureq)
+		v->deferred[ureq->type] = NULL;
+
+	list_del(&ureq->list);
+	free(ureq);
+}
+
+/*
+ * Called once the subscribers answered or the request timed out. An
+ * answer is cached for later frames of the same type from this station,
+ * a timeout is not, the next frame asks again. A deferred frame is
+ * processed again from the event loop with the verdict.
+ */
+static void
+hostapd_ubus_event_done(struct ubus_event_req *ureq, bool answered)
+{
+	struct hostapd_data *hapd = ureq->hapd;
+
+	if (ureq->done)
+		return;
+
+	ureq->done = true;
+	eloop_cancel_timeout(ubus_event_timeout, ureq, hapd);
+	if (answered)
+		hostapd_bss_set_verdict(hapd, ureq->addr, ureq->type,
+					ureq->resp);
+
+	if (ureq->frame_len) {
+		eloop_register_timeout(0, 0, ubus_event_replay, ureq, hapd);
+		return;
+	}
+
+	hostapd_ubus_event_free(ureq);
+}
+
+static void
+ubus_event_status_cb(struct ubus_notify_request *req, int idx, int ret)
+{
+	struct ubus_event_req *ureq = container_of(req, struct ubus_event_req, nreq);
+
+	ureq->resp = ret;
+}
+
+static void
+ubus_event_complete_cb(struct ubus_notify_request *req, int idx, int ret)
+{
+	struct ubus_event_req *ureq = container_of(req, struct ubus_event_req, nreq);
+
+	hostapd_ubus_event_done(ureq, true);
+}
+
+static void
+ubus_event_timeout(void *eloop_data, void *user_ctx)
+{
+	struct ubus_event_req *ureq = eloop_data;
+
+	ubus_abort_request(ctx, &ureq->nreq.req);
+	hostapd_ubus_event_done(ureq, false);
+}
+
+static void
+ubus_event_replay(void *eloop_data, void *user_ctx)
+{
+	struct ubus_event_req *ureq = eloop_data;
+	struct hostapd_data *hapd = user_ctx;
+	struct hostapd_frame_info fi = {
+		.ssi_signal = ureq->ssi_signal,
+	};
+
+	ieee802_11_mgmt(hapd, ureq->frame, ureq->frame_len, &fi);
+	hostapd_ubus_event_free(ureq);
+}
+
+static void
+hostapd_ubus_free_verdicts(struct hostapd_data *hapd)
+{
+	struct ubus_event_req *ureq, *tmp;
+	struct ubus_sta_verdict *v, *vtmp;
+
+	list_for_each_entry_safe(ureq, tmp, &hapd->ubus.requests, list)
+		hostapd_ubus_event_free(ureq);
+
+	avl_for_each_element_safe(&hapd->ubus.verdicts, v, avl, vtmp) {
+		eloop_cancel_timeout(hostapd_bss_del_verdict, v, hapd);
+		avl_delete(&hapd->ubus.verdicts, &v->avl);
+		free(v);
+	}
+}
+
 static int
 hostapd_bss_reload(struct ubus_context *ctx, struct ubus_object *obj,
 		   struct ubus_request_data *req, const char *method,
@@ -155,15 +413,149 @@ hostapd_bss_reload(struct ubus_context *ctx, struct ubus_object *obj,
 	return hostapd_reload_config(hapd->iface, 1);
 }
 
+static void
+blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const u8 *addr)
+{
+	char *s;
+
+	s = blobmsg_alloc_string_buffer(buf, name, 20);
+	sprintf(s, MACSTR, MAC2STR(addr));
+	blobmsg_add_string_buffer(buf);
+}
+
+static bool
+hostapd_client_state_changed(struct ubus_client_state *cs, struct sta_info *sta)
+{
+	size_t taxonomy_len = 0;
+	bool changed;
+
+#ifdef CONFIG_TAXONOMY
+	if (sta->probe_ie_taxonomy)
+		taxonomy_len += wpabuf_len(sta->probe_ie_taxonomy);
+	if (sta->assoc_ie_taxonomy)
+		taxonomy_len += wpabuf_len(sta->assoc_ie_taxonomy);
+#endif
+
+	changed = cs->flags != sta->flags || cs->aid != sta->aid ||
+		  cs->taxonomy_len != taxonomy_len ||
+		  memcmp(cs->rrm_enabled_capa, sta->rrm_enabled_capa,
+			 sizeof(cs->rrm_enabled_capa));
+
+	cs->flags = sta->flags;
+	cs->aid = sta->aid;
+	cs->taxonomy_len = taxonomy_len;
+	memcpy(cs->rrm_enabled_capa, sta->rrm_enabled_capa,
+	       sizeof(cs->rrm_enabled_capa));
+
+	return changed;
+}
+
+/*
+ * Compare the station list against what get_clients saw last time and
+ * assign a new generation to every station that was added, changed or
+ * removed since. Removed stations are remembered for a while so that
+ * incremental callers learn about them.
+ */
+static void
+hostapd_ubus_update_clients(struct hostapd_data *hapd)
+{
+	struct ubus_client_state *cs, *tmp;
+	struct os_reltime now;
+	struct sta_info *sta;
+
+	os_get_reltime(&now);
+
+	avl_for_each_element(&hapd->ubus.clients, cs, avl)
+		cs->seen = false;
+
+	for (sta = hapd->sta_list; sta; sta = sta->next) {
+		cs = avl_find_element(&hapd->ubus.clients, sta->addr, cs, avl);
+		if (!cs) {
+			cs = os_zalloc(sizeof(*cs));
+			if (!cs)
+				continue;
+
+			memcpy(cs->addr, sta->addr, sizeof(cs->addr));
+			cs->avl.key = cs->addr;
+			avl_insert(&hapd->ubus.clients, &cs->avl);
+		}
+
+		if (hostapd_client_state_changed(cs, sta) || !cs->generation ||
+		    os_reltime_initialized(&cs->removed)) {
+			cs->generation = ++hapd->ubus.client_generation;
+			os_memset(&cs->removed, 0, sizeof(cs->removed));
+		}
+		cs->seen = true;
+	}
+
+	avl_for_each_element_safe(&hapd->ubus.clients, cs, avl, tmp) {
+		if (cs->seen)
+			continue;
+
+		if (!os_reltime_initialized(&cs->removed)) {
+			cs->removed = now;
+			cs->generation = ++hapd->ubus.client_generation;
+			continue;
+		}
+
+		if (!os_reltime_expired(&now, &cs->removed,
+					HOSTAPD_UBUS_CLIENT_GONE_TTL))
+			continue;
+
+		if (cs->generation > hapd->ubus.client_purged)
+			hapd->ubus.client_purged = cs->generation;
+
+		avl_delete(&hapd->ubus.clients, &cs->avl);
+		free(cs);
+	}
+}
+
+static void
+hostapd_ubus_free_clients(struct hostapd_data *hapd)
+{
+	struct ubus_client_state *cs, *tmp;
+
+	avl_remove_all_elements(&hapd->ubus.clients, cs, avl, tmp)
+		free(cs);
+}
+
+enum {
+	CLIENT_FIELD_FLAGS = (1 << 0),
+	CLIENT_FIELD_RRM = (1 << 1),
+	CLIENT_FIELD_AID = (1 << 2),
+	CLIENT_FIELD_SIGNATURE = (1 << 3),
+};
+
+static const char * const client_fields[] = {
+	"flags", "rrm", "aid", "signature",
+};
+
+enum {
+	GET_CLIENTS_SINCE,
+	GET_CLIENTS_FIELDS,
+	__GET_CLIENTS_MAX
+};
+
+static const struct blobmsg_policy get_clients_policy[__GET_CLIENTS_MAX] = {
+	[GET_CLIENTS_SINCE] = { "since", BLOBMSG_TYPE_INT32 },
+	[GET_CLIENTS_FIELDS] = { "fields", BLOBMSG_TYPE_ARRAY },
+};
+
 static int
 hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 			struct ubus_request_data *req, const char *method,
 			struct blob_attr *msg)
 {
 	struct hostapd_data *hapd = container_of(obj, struct hostapd_data, ubus.obj);
+	struct blob_attr *tb[__GET_CLIENTS_MAX], *cur;
+	struct ubus_client_state *cs;
 	struct sta_info *sta;
 	void *list, *c;
 	char mac_buf[20];
+	unsigned int fields = ~0;
+	bool full = true;
+	u32 since = 0;
+	int rem;
 	static const struct {
 		const char *name;
 		uint32_t flag;
@@ -180,32 +572,89 @@ hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 		{ "mfp", WLAN_STA_MFP },
 	};
 
+	blobmsg_parse(get_clients_policy, __GET_CLIENTS_MAX, tb,
+		      blob_data(msg), blob_len(msg));
+
+	if (tb[GET_CLIENTS_FIELDS]) {
+		fields = 0;
+		blobmsg_for_each_attr(cur, tb[GET_CLIENTS_FIELDS], rem) {
+			int i;
+
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			for (i = 0; i < ARRAY_SIZE(client_fields); i++)
+				if (!strcmp(blobmsg_get_string(cur), client_fields[i]))
+					break;
+
+			if (i == ARRAY_SIZE(client_fields))
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			fields |= 1 << i;
+		}
+	}
+
+	hostapd_ubus_update_clients(hapd);
+
+	/*
+	 * Fall back to a full list if removals the caller missed are gone, or
+	 * if its generation is from before a restart of hostapd
+	 */
+	if (tb[GET_CLIENTS_SINCE]) {
+		since = blobmsg_get_u32(tb[GET_CLIENTS_SINCE]);
+		full = since < hapd->ubus.client_purged ||
+		       since > hapd->ubus.client_generation;
+	}
+
 	blob_buf_init(&b, 0);
 	blobmsg_add_u32(&b, "freq", hapd->iface->freq);
+	blobmsg_add_u32(&b, "generation", hapd->ubus.client_generation);
+	if (tb[GET_CLIENTS_SINCE])
+		blobmsg_add_u8(&b, "full", full);
 	list = blobmsg_open_table(&b, "clients");
 	for (sta = hapd->sta_list; sta; sta = sta->next) {
 		void *r;
 		int i;
 
+		cs = avl_find_element(&hapd->ubus.clients, sta->addr, cs, avl);
+		if (!full && cs && cs->generation <= since)
+			continue;
+
 		sprintf(mac_buf, MACSTR, MAC2STR(sta->addr));
 		c = blobmsg_open_table(&b, mac_buf);
-		for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
-			blobmsg_add_u8(&b, sta_flags[i].name,
-				       !!(sta->flags & sta_flags[i].flag));
-
-		r = blobmsg_open_array(&b, "rrm");
-		for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
-			blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
-		blobmsg_close_array(&b, r);
-		blobmsg_add_u32(&b, "aid", sta->aid);
+		if (fields & CLIENT_FIELD_FLAGS)
+			for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
+				blobmsg_add_u8(&b, sta_flags[i].name,
+					       !!(sta->flags & sta_flags[i].flag));
+
+		if (fields & CLIENT_FIELD_RRM) {
+			r = blobmsg_open_array(&b, "rrm");
+			for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
+				blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
+			blobmsg_close_array(&b, r);
+		}
+		if (fields & CLIENT_FIELD_AID)
+			blobmsg_add_u32(&b, "aid", sta->aid);
 #ifdef CONFIG_TAXONOMY
-		r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
-		if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
-			blobmsg_add_string_buffer(&b);
+		if (fields & CLIENT_FIELD_SIGNATURE) {
+			r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
+			if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
+				blobmsg_add_string_buffer(&b);
+		}
 #endif
 		blobmsg_close_table(&b, c);
 	}
 	blobmsg_close_array(&b, list);
+
+	if (!full) {
+		list = blobmsg_open_array(&b, "removed");
+		avl_for_each_element(&hapd->ubus.clients, cs, avl)
+			if (os_reltime_initialized(&cs->removed) &&
+			    cs->generation > since)
+				blobmsg_add_macaddr(&b, NULL, cs->addr);
+		blobmsg_close_array(&b, list);
+	}
+
 	ubus_send_reply(ctx, req, b.head);
 
 	return 0;
@@ -228,11 +677,13 @@ hostapd_bss_get_features(struct ubus_context *ctx, struct ubus_object *obj,
 
 enum {
 	NOTIFY_RESPONSE,
+	NOTIFY_VERDICT_TTL,
 	__NOTIFY_MAX
 };
 
 static const struct blobmsg_policy notify_policy[__NOTIFY_MAX] = {
 	[NOTIFY_RESPONSE] = { "notify_response", BLOBMSG_TYPE_INT32 },
+	[NOTIFY_VERDICT_TTL] = { "verdict_ttl", BLOBMSG_TYPE_INT32 },
 };
 
 static int
@@ -254,6 +705,9 @@ hostapd_notify_response(struct ubus_context *ctx, struct ubus_object *obj,
 
 	hapd->ubus.notify_response = blobmsg_get_u32(tb[NOTIFY_RESPONSE]);
 
+	if (tb[NOTIFY_VERDICT_TTL])
+		hapd->ubus.verdict_ttl = blobmsg_get_u32(tb[NOTIFY_VERDICT_TTL]);
+
 	return UBUS_STATUS_OK;
 }
 
@@ -315,16 +769,6 @@ hostapd_bss_del_client(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
-static void
-blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const u8 *addr)
-{
-	char *s;
-
-	s = blobmsg_alloc_string_buffer(buf, name, 20);
-	sprintf(s, MACSTR, MAC2STR(addr));
-	blobmsg_add_string_buffer(buf);
-}
-
 static int
 hostapd_bss_list_bans(struct ubus_context *ctx, struct ubus_object *obj,
 		      struct ubus_request_data *req, const char *method,
@@ -344,6 +788,190 @@ hostapd_bss_list_bans(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
+static void
+hostapd_ubus_add_capabilities(const struct ieee80211_ht_capabilities *ht_capabilities,
+			      const struct ieee80211_vht_capabilities *vht_capabilities)
+{
+	if (ht_capabilities) {
+		void *ht_cap, *ht_cap_mcs_set, *mcs_set;
+
+		ht_cap = blobmsg_open_table(&b, "ht_capabilities");
+		blobmsg_add_u16(&b, "ht_capabilities_info", ht_capabilities->ht_capabilities_info);
+		ht_cap_mcs_set = blobmsg_open_table(&b, "supported_mcs_set");
+		blobmsg_add_u16(&b, "a_mpdu_params", ht_capabilities->a_mpdu_params);
+		blobmsg_add_u16(&b, "ht_extended_capabilities", ht_capabilities->ht_extended_capabilities);
+		blobmsg_add_u32(&b, "tx_bf_capability_info", ht_capabilities->tx_bf_capability_info);
+		blobmsg_add_u16(&b, "asel_capabilities", ht_capabilities->asel_capabilities);
+		mcs_set = blobmsg_open_array(&b, "supported_mcs_set");
+		for (int i = 0; i < 16; i++) {
+			blobmsg_add_u16(&b, NULL, (u16) ht_capabilities->supported_mcs_set[i]);
+		}
+		blobmsg_close_array(&b, mcs_set);
+		blobmsg_close_table(&b, ht_cap_mcs_set);
+		blobmsg_close_table(&b, ht_cap);
+	}
+	if (vht_capabilities) {
+		void *vht_cap, *vht_cap_mcs_set;
+
+		vht_cap = blobmsg_open_table(&b, "vht_capabilities");
+		blobmsg_add_u32(&b, "vht_capabilities_info", vht_capabilities->vht_capabilities_info);
+		vht_cap_mcs_set = blobmsg_open_table(&b, "vht_supported_mcs_set");
+		blobmsg_add_u16(&b, "rx_map", vht_capabilities->vht_supported_mcs_set.rx_map);
+		blobmsg_add_u16(&b, "rx_highest", vht_capabilities->vht_supported_mcs_set.rx_highest);
+		blobmsg_add_u16(&b, "tx_map", vht_capabilities->vht_supported_mcs_set.tx_map);
+		blobmsg_add_u16(&b, "tx_highest", vht_capabilities->vht_supported_mcs_set.tx_highest);
+		blobmsg_close_table(&b, vht_cap_mcs_set);
+		blobmsg_close_table(&b, vht_cap);
+	}
+}
+
+static void
+blobmsg_add_age(struct blob_buf *buf, const char *name,
+		struct os_reltime *now, struct os_reltime *t)
+{
+	struct os_reltime age;
+
+	os_reltime_sub(now, t, &age);
+	blobmsg_add_u32(buf, name, age.sec * 1000 + age.usec / 1000);
+}
+
+/*
+ * Publish the probe requests gathered since the last flush as a single
+ * "probe-batch" notification, one entry per client.
+ */
+static void
+hostapd_ubus_probe_flush(void *eloop_data, void *user_ctx)
+{
+	struct hostapd_data *hapd = eloop_data;
+	struct ubus_probe_client *pc, *tmp;
+	struct os_reltime now;
+	void *list, *c;
+
+	eloop_cancel_timeout(hostapd_ubus_probe_flush, hapd, NULL);
+
+	if (avl_is_empty(&hapd->ubus.probes))
+		return;
+
+	os_get_reltime(&now);
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u32(&b, "freq", hapd->iface->freq);
+	list = blobmsg_open_array(&b, "clients");
+	avl_remove_all_elements(&hapd->ubus.probes, pc, avl, tmp) {
+		c = blobmsg_open_table(&b, NULL);
+		blobmsg_add_macaddr(&b, "address", pc->addr);
+		blobmsg_add_macaddr(&b, "target", pc->target);
+		if (pc->signal)
+			blobmsg_add_u32(&b, "signal", pc->signal);
+		blobmsg_add_u32(&b, "count", pc->count);
+		blobmsg_add_age(&b, "first_seen", &now, &pc->first_seen);
+		blobmsg_add_age(&b, "last_seen", &now, &pc->last_seen);
+		hostapd_ubus_add_capabilities(pc->has_ht ? &pc->ht : NULL,
+					      pc->has_vht ? &pc->vht : NULL);
+		blobmsg_close_table(&b, c);
+
+		hapd->ubus.probe_suppressed += pc->count - 1;
+		free(pc);
+	}
+	blobmsg_close_array(&b, list);
+
+	ubus_notify(ctx, &hapd->ubus.obj, "probe-batch", b.head, -1);
+	hapd->ubus.probe_batches++;
+}
+
+static void
+hostapd_ubus_probe_add(struct hostapd_data *hapd, struct hostapd_ubus_request *req)
+{
+	const struct ieee80211_mgmt *mgmt = req->mgmt_frame;
+	struct ubus_probe_client *pc;
+
+	hapd->ubus.probe_events++;
+
+	pc = avl_find_element(&hapd->ubus.probes, mgmt->sa, pc, avl);
+	if (!pc) {
+		pc = os_zalloc(sizeof(*pc));
+		if (!pc)
+			return;
+
+		memcpy(pc->addr, mgmt->sa, sizeof(pc->addr));
+		pc->avl.key = pc->addr;
+		avl_insert(&hapd->ubus.probes, &pc->avl);
+		os_get_reltime(&pc->first_seen);
+		pc->last_seen = pc->first_seen;
+	} else {
+		os_get_reltime(&pc->last_seen);
+	}
+
+	memcpy(pc->target, mgmt->da, sizeof(pc->target));
+	if (req->ssi_signal && (!pc->signal || req->ssi_signal > pc->signal))
+		pc->signal = req->ssi_signal;
+	pc->count++;
+
+	if (req->elems && req->elems->ht_capabilities) {
+		memcpy(&pc->ht, req->elems->ht_capabilities, sizeof(pc->ht));
+		pc->has_ht = true;
+	}
+	if (req->elems && req->elems->vht_capabilities) {
+		memcpy(&pc->vht, req->elems->vht_capabilities, sizeof(pc->vht));
+		pc->has_vht = true;
+	}
+
+	if (hapd->ubus.probes.count >= HOSTAPD_UBUS_PROBE_BATCH)
+		hostapd_ubus_probe_flush(hapd, NULL);
+	else if (!eloop_is_timeout_registered(hostapd_ubus_probe_flush, hapd, NULL))
+		eloop_register_timeout(0, hapd->ubus.probe_interval * 1000,
+				       hostapd_ubus_probe_flush, hapd, NULL);
+}
+
+enum {
+	PROBE_COALESCE_INTERVAL,
+	__PROBE_COALESCE_MAX
+};
+
+static const struct blobmsg_policy probe_coalesce_policy[__PROBE_COALESCE_MAX] = {
+	[PROBE_COALESCE_INTERVAL] = { "interval", BLOBMSG_TYPE_INT32 },
+};
+
+static int
+hostapd_probe_coalesce(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct blob_attr *tb[__PROBE_COALESCE_MAX];
+	struct hostapd_data *hapd = get_hapd_from_object(obj);
+
+	blobmsg_parse(probe_coalesce_policy, __PROBE_COALESCE_MAX, tb,
+		      blob_data(msg), blob_len(msg));
+
+	if (tb[PROBE_COALESCE_INTERVAL]) {
+		hapd->ubus.probe_interval = blobmsg_get_u32(tb[PROBE_COALESCE_INTERVAL]);
+		if (hapd->ubus.probe_interval <= 0) {
+			hapd->ubus.probe_interval = 0;
+			hostapd_ubus_probe_flush(hapd, NULL);
+		}
+	}
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u32(&b, "interval", hapd->ubus.probe_interval);
+	blobmsg_add_u32(&b, "events", hapd->ubus.probe_events);
+	blobmsg_add_u32(&b, "suppressed", hapd->ubus.probe_suppressed);
+	blobmsg_add_u32(&b, "batches", hapd->ubus.probe_batches);
+	blobmsg_add_u32(&b, "pending", hapd->ubus.probes.count);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+static void
+hostapd_ubus_free_probes(struct hostapd_data *hapd)
+{
+	struct ubus_probe_client *pc, *tmp;
+
+	eloop_cancel_timeout(hostapd_ubus_probe_flush, hapd, NULL);
+	avl_remove_all_elements(&hapd->ubus.probes, pc, avl, tmp)
+		free(pc);
+}
+
 static int
 hostapd_bss_wps_start(struct ubus_context *ctx, struct ubus_object *obj,
 			struct ubus_request_data *req, const char *method,
@@ -1027,7 +1655,7 @@ hostapd_wnm_disassoc_imminent(struct ubus_context *ctx, struct ubus_object *obj,
 
 static const struct ubus_method bss_methods[] = {
 	UBUS_METHOD_NOARG("reload", hostapd_bss_reload),
-	UBUS_METHOD_NOARG("get_clients", hostapd_bss_get_clients),
+	UBUS_METHOD("get_clients", hostapd_bss_get_clients, get_clients_policy),
 	UBUS_METHOD("del_client", hostapd_bss_del_client, del_policy),
 	UBUS_METHOD_NOARG("list_bans", hostapd_bss_list_bans),
 	UBUS_METHOD_NOARG("wps_start", hostapd_bss_wps_start),
@@ -1039,6 +1667,7 @@ static const struct ubus_method bss_methods[] = {
 #endif
 	UBUS_METHOD("set_vendor_elements", hostapd_vendor_elements, ve_policy),
 	UBUS_METHOD("notify_response", hostapd_notify_response, notify_policy),
+	UBUS_METHOD("probe_coalesce", hostapd_probe_coalesce, probe_coalesce_policy),
 	UBUS_METHOD("bss_mgmt_enable", hostapd_bss_mgmt_enable, bss_mgmt_enable_policy),
 	UBUS_METHOD_NOARG("rrm_nr_get_own", hostapd_rrm_nr_get_own),
 	UBUS_METHOD_NOARG("rrm_nr_list", hostapd_rrm_nr_list),
@@ -1075,6 +1704,11 @@ void hostapd_ubus_add_bss(struct hostapd_data *hapd)
 		return;
 
 	avl_init(&hapd->ubus.banned, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.verdicts, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.probes, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.clients, avl_compare_macaddr, false, NULL);
+	INIT_LIST_HEAD(&hapd->ubus.requests);
+	hapd->ubus.verdict_ttl = HOSTAPD_UBUS_VERDICT_TTL;
 	obj->name = name;
 	obj->type = &bss_object_type;
 	obj->methods = bss_object_type.methods;
@@ -1092,6 +1726,9 @@ void hostapd_ubus_free_bss(struct hostapd_data *hapd)
 		return;
 
 	if (obj->id) {
+		hostapd_ubus_free_verdicts(hapd);
+		hostapd_ubus_free_probes(hapd);
+		hostapd_ubus_free_clients(hapd);
 		ubus_remove_object(ctx, obj);
 		hostapd_ubus_ref_dec();
 	}
@@ -1152,19 +1789,6 @@ void hostapd_ubus_free(struct hapd_interfaces *interfaces)
 	free(name);
 }
 
-struct ubus_event_req {
-	struct ubus_notify_request nreq;
-	int resp;
-};
-
-static void
-ubus_event_cb(struct ubus_notify_request *req, int idx, int ret)
-{
-	struct ubus_event_req *ureq = container_of(req, struct ubus_event_req, nreq);
-
-	ureq->resp = ret;
-}
-
 int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_request *req)
 {
 	struct ubus_banned_client *ban;
@@ -1174,8 +1798,11 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 		[HOSTAPD_UBUS_ASSOC_REQ] = "assoc",
 	};
 	const char *type = "mgmt";
-	struct ubus_event_req ureq = {};
+	struct ubus_event_req *ureq;
+	struct ubus_sta_verdict *v;
 	const u8 *addr;
+	bool defer;
+	int resp;
 
 	if (req->mgmt_frame)
 		addr = req->mgmt_frame->sa;
@@ -1189,6 +1816,25 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 	if (!hapd->ubus.obj.has_subscribers)
 		return WLAN_STATUS_SUCCESS;
 
+	v = avl_find_element(&hapd->ubus.verdicts, addr, v, avl);
+	if (v && req->type < HOSTAPD_UBUS_TYPE_MAX &&
+	    (ureq = v->deferred[req->type]) != NULL) {
+		/* The replayed frame carries the answer, retries wait for it */
+		if (ureq->done && (const u8 *) req->mgmt_frame == ureq->frame)
+			return ureq->resp;
+
+		return HOSTAPD_UBUS_RESP_DEFERRED;
+	}
+
+	if (req->type == HOSTAPD_UBUS_PROBE_REQ && req->mgmt_frame &&
+	    hapd->ubus.probe_interval > 0) {
+		/* Coalesced probes only get verdicts that are already cached */
+		resp = WLAN_STATUS_SUCCESS;
+		hostapd_bss_cached_verdict(v, req->type, &resp);
+		hostapd_ubus_probe_add(hapd, req);
+		return resp;
+	}
+
 	if (req->type < ARRAY_SIZE(types))
 		type = types[req->type];
 
@@ -1200,62 +1846,60 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 		blobmsg_add_u32(&b, "signal", req->ssi_signal);
 	blobmsg_add_u32(&b, "freq", hapd->iface->freq);
 
-	if (req->elems) {
-		if(req->elems->ht_capabilities)
-		{
-			struct ieee80211_ht_capabilities *ht_capabilities;
-			void *ht_cap, *ht_cap_mcs_set, *mcs_set;
-
-
-			ht_capabilities = (struct ieee80211_ht_capabilities*) req->elems->ht_capabilities;
-			ht_cap = blobmsg_open_table(&b, "ht_capabilities");
-			blobmsg_add_u16(&b, "ht_capabilities_info", ht_capabilities->ht_capabilities_info);
-			ht_cap_mcs_set = blobmsg_open_table(&b, "supported_mcs_set");
-			blobmsg_add_u16(&b, "a_mpdu_params", ht_capabilities->a_mpdu_params);
-			blobmsg_add_u16(&b, "ht_extended_capabilities", ht_capabilities->ht_extended_capabilities);
-			blobmsg_add_u32(&b, "tx_bf_capability_info", ht_capabilities->tx_bf_capability_info);
-			blobmsg_add_u16(&b, "asel_capabilities", ht_capabilities->asel_capabilities);
-			mcs_set = blobmsg_open_array(&b, "supported_mcs_set");
-			for (int i = 0; i < 16; i++) {
-				blobmsg_add_u16(&b, NULL, (u16) ht_capabilities->supported_mcs_set[i]);
-			}
-			blobmsg_close_array(&b, mcs_set);
-			blobmsg_close_table(&b, ht_cap_mcs_set);
-			blobmsg_close_table(&b, ht_cap);
-		}
-		if(req->elems->vht_capabilities)
-		{
-			struct ieee80211_vht_capabilities *vht_capabilities;
-			void *vht_cap, *vht_cap_mcs_set;
-
-			vht_capabilities = (struct ieee80211_vht_capabilities*) req->elems->vht_capabilities;
-			vht_cap = blobmsg_open_table(&b, "vht_capabilities");
-			blobmsg_add_u32(&b, "vht_capabilities_info", vht_capabilities->vht_capabilities_info);
-			vht_cap_mcs_set = blobmsg_open_table(&b, "vht_supported_mcs_set");
-			blobmsg_add_u16(&b, "rx_map", vht_capabilities->vht_supported_mcs_set.rx_map);
-			blobmsg_add_u16(&b, "rx_highest", vht_capabilities->vht_supported_mcs_set.rx_highest);
-			blobmsg_add_u16(&b, "tx_map", vht_capabilities->vht_supported_mcs_set.tx_map);
-			blobmsg_add_u16(&b, "tx_highest", vht_capabilities->vht_supported_mcs_set.tx_highest);
-			blobmsg_close_table(&b, vht_cap_mcs_set);
-			blobmsg_close_table(&b, vht_cap);
-		}
-	}
+	if (req->elems)
+		hostapd_ubus_add_capabilities(
+			(const struct ieee80211_ht_capabilities *) req->elems->ht_capabilities,
+			(const struct ieee80211_vht_capabilities *) req->elems->vht_capabilities);
 
 	if (!hapd->ubus.notify_response) {
 		ubus_notify(ctx, &hapd->ubus.obj, type, b.head, -1);
 		return WLAN_STATUS_SUCCESS;
 	}
 
-	if (ubus_notify_async(ctx, &hapd->ubus.obj, type, b.head, &ureq.nreq))
-		return WLAN_STATUS_SUCCESS;
-
-	ureq.nreq.status_cb = ubus_event_cb;
-	ubus_complete_request(ctx, &ureq.nreq.req, 100);
-
-	if (ureq.resp)
-		return ureq.resp;
+	/*
+	 * Never wait for the subscribers here. A cached verdict is applied
+	 * right away, otherwise probes are answered and auth/assoc frames
+	 * are put on hold until the reply arrives.
+	 */
+	resp = WLAN_STATUS_SUCCESS;
+	defer = false;
+	if (req->type < HOSTAPD_UBUS_TYPE_MAX &&
+	    !hostapd_bss_cached_verdict(v, req->type, &resp))
+		defer = req->type != HOSTAPD_UBUS_PROBE_REQ &&
+			req->mgmt_frame && req->frame_len;
+
+	ureq = os_zalloc(sizeof(*ureq) + (defer ? req->frame_len : 0));
+	if (!ureq)
+		return resp;
+
+	ureq->hapd = hapd;
+	ureq->type = req->type;
+	memcpy(ureq->addr, addr, sizeof(ureq->addr));
+
+	if (ubus_notify_async(ctx, &hapd->ubus.obj, type, b.head, &ureq->nreq)) {
+		free(ureq);
+		return resp;
+	}
 
-	return WLAN_STATUS_SUCCESS;
+	ureq->nreq.status_cb = ubus_event_status_cb;
+	ureq->nreq.complete_cb = ubus_event_complete_cb;
+	list_add_tail(&ureq->list, &hapd->ubus.requests);
+	ubus_complete_request_async(ctx, &ureq->nreq.req);
+	eloop_register_timeout(0, HOSTAPD_UBUS_RESP_TIMEOUT * 1000,
+			       ubus_event_timeout, ureq, hapd);
+
+	if (!defer || !(v = hostapd_bss_get_verdict(hapd, addr)))
+		return resp;
+
+	/* The retry flag would make hostapd drop the replay as a duplicate */
+	ureq->ssi_signal = req->ssi_signal;
+	ureq->frame_len = req->frame_len;
+	memcpy(ureq->frame, req->mgmt_frame, req->frame_len);
+	((struct ieee80211_mgmt *) ureq->frame)->frame_control &=
+		~host_to_le16(WLAN_FC_RETRY);
+	v->deferred[req->type] = ureq;
+
+	return HOSTAPD_UBUS_RESP_DEFERRED;
 }
 
 void hostapd_ubus_notify(struct hostapd_data *hapd, const char *type, const u8 *addr)
@@ -15,9 +15,13 @@ enum hostapd_ubus_event_type {
 	HOSTAPD_UBUS_TYPE_MAX
 };
 
+/* The frame is held until the subscriber answers and processed again */
+#define HOSTAPD_UBUS_RESP_DEFERRED	-2
+
 struct hostapd_ubus_request {
 	enum hostapd_ubus_event_type type;
 	const struct ieee80211_mgmt *mgmt_frame;
+	size_t frame_len;
 	const struct ieee802_11_elems *elems;
 	int ssi_signal; /* dBm */
 	const u8 *addr;
@@ -30,12 +34,24 @@ struct hapd_interfaces;
 #ifdef UBUS_SUPPORT
 
 #include <libubox/avl.h>
+#include <libubox/list.h>
 #include <libubus.h>
 
 struct hostapd_ubus_bss {
 	struct ubus_object obj;
 	struct avl_tree banned;
+	struct avl_tree verdicts;
+	struct avl_tree probes;
+	struct avl_tree clients;
+	struct list_head requests;
 	int notify_response;
+	int verdict_ttl; /* ms */
+	int probe_interval; /* ms, 0: notify every probe request */
+	unsigned int probe_events;
+	unsigned int probe_suppressed;
+	unsigned int probe_batches;
+	u32 client_generation;
+	u32 client_purged;
 };
 
 void hostapd_ubus_add_iface(struct hostapd_iface *iface);
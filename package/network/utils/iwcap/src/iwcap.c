@@ -26,15 +26,18 @@
 #include <signal.h>
 #include <syslog.h>
 #include <errno.h>
+#include <poll.h>
 #include <byteswap.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <linux/if_packet.h>
+#include <linux/filter.h>
 
 #define ARPHRD_IEEE80211_RADIOTAP	803
 
@@ -45,6 +48,11 @@
 #define FRAMETYPE_BEACON			0x80
 #define FRAMETYPE_DATA				0x08
 
+#define RX_BLOCK_SIZE				(64 * 1024)
+#define RX_BLOCK_NUM				8
+#define RX_FRAME_SIZE				2048
+#define RX_BLOCK_TIMEOUT			100 /* ms */
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define le16(x) __bswap_16(x)
 #else
@@ -56,7 +64,7 @@ uint8_t run_stop   = 0;
 uint8_t run_daemon = 0;
 
 uint32_t frames_captured = 0;
-uint32_t frames_filtered = 0;
+uint32_t frames_dropped  = 0;
 
 int capture_sock = -1;
 const char *ifname = NULL;
@@ -76,6 +84,12 @@ struct ringbuf_entry {
 	uint32_t usec;			 /* epoch microseconds */
 };
 
+struct rx_ring {
+	struct tpacket_req3 req; /* ring geometry */
+	uint32_t cur;            /* next block to read */
+	uint8_t *map;            /* mmap'ed blocks */
+};
+
 typedef struct pcap_hdr_s {
 	uint32_t magic_number;   /* magic number */
 	uint16_t version_major;  /* major version number */
@@ -145,6 +159,126 @@ int set_promisc(int on)
 }
 
 
+/*
+ * Drop unwanted frames in the kernel, before they are copied into the ring.
+ * Frames too short to hold a radiotap header and the frame control field
+ * are dropped as well, loads past the end of the packet abort the filter.
+ */
+int set_filter(uint8_t filter_beacon, uint8_t filter_data, uint32_t snaplen)
+{
+	struct sock_filter code[] = {
+		/* 0: frame must be longer than the radiotap header */
+		BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, sizeof(radiotap_hdr_t), 0, 11),
+
+		/* 2: X = radiotap it_len (little endian) */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 3),
+		BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 2),
+		BPF_STMT(BPF_ALU | BPF_OR  | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+
+		/* 8: A = 802.11 frame type */
+		BPF_STMT(BPF_LD  | BPF_B   | BPF_IND, 0),
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, FRAMETYPE_MASK),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FRAMETYPE_DATA,
+		         filter_data ? 2 : 0, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FRAMETYPE_BEACON,
+		         filter_beacon ? 1 : 0, 0),
+
+		/* 12: accept, truncated to snaplen */
+		BPF_STMT(BPF_RET | BPF_K, snaplen),
+
+		/* 13: drop */
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+
+	struct sock_fprog prog = {
+		.len    = sizeof(code) / sizeof(code[0]),
+		.filter = code
+	};
+
+	return setsockopt(capture_sock, SOL_SOCKET, SO_ATTACH_FILTER,
+	                  &prog, sizeof(prog));
+}
+
+int rx_ring_init(struct rx_ring *rx)
+{
+	int ver = TPACKET_V3;
+	size_t len;
+
+	memset(rx, 0, sizeof(*rx));
+
+	rx->req.tp_block_size = RX_BLOCK_SIZE;
+	rx->req.tp_block_nr = RX_BLOCK_NUM;
+	rx->req.tp_frame_size = RX_FRAME_SIZE;
+	rx->req.tp_frame_nr = RX_BLOCK_SIZE / RX_FRAME_SIZE * RX_BLOCK_NUM;
+	rx->req.tp_retire_blk_tov = RX_BLOCK_TIMEOUT;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_VERSION,
+	               &ver, sizeof(ver)) ||
+	    setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+	               &rx->req, sizeof(rx->req)))
+		return -1;
+
+	len = rx->req.tp_block_size * rx->req.tp_block_nr;
+	rx->map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	               MAP_SHARED, capture_sock, 0);
+
+	if (rx->map == MAP_FAILED)
+	{
+		rx->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct tpacket_block_desc * rx_ring_block(struct rx_ring *rx)
+{
+	struct tpacket_block_desc *b;
+
+	b = (void *)(rx->map + rx->cur * rx->req.tp_block_size);
+
+	if (!(b->hdr.bh1.block_status & TP_STATUS_USER))
+		return NULL;
+
+	__sync_synchronize();
+
+	return b;
+}
+
+void rx_ring_release(struct rx_ring *rx, struct tpacket_block_desc *b)
+{
+	__sync_synchronize();
+
+	b->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	rx->cur = (rx->cur + 1) % rx->req.tp_block_nr;
+}
+
+void rx_ring_free(struct rx_ring *rx)
+{
+	if (rx->map)
+		munmap(rx->map, rx->req.tp_block_size * rx->req.tp_block_nr);
+
+	rx->map = NULL;
+}
+
+/* Kernel counters are reset on every read, so accumulate them */
+void update_stats(void)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (getsockopt(capture_sock, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+		return;
+
+	frames_captured += st.tp_packets;
+	frames_dropped  += st.tp_drops;
+}
+
+
 void sig_dump(int sig)
 {
 	run_dump = 1;
@@ -219,20 +353,16 @@ struct ringbuf * ringbuf_init(uint32_t num_item, uint16_t len_item)
 	return NULL;
 }
 
-struct ringbuf_entry * ringbuf_add(struct ringbuf *r)
+struct ringbuf_entry * ringbuf_add(struct ringbuf *r,
+                                   uint32_t sec, uint32_t usec)
 {
-	struct timeval t;
 	struct ringbuf_entry *e;
 
-	gettimeofday(&t, NULL);
-
 	e = r->buf + (r->fill++ * r->slen);
 	r->fill %= r->len;
 
-	memset(e, 0, r->slen);
-
-	e->sec = t.tv_sec;
-	e->usec = t.tv_usec;
+	e->sec = sec;
+	e->usec = usec;
 
 	return e;
 }
@@ -271,18 +401,20 @@ void msg(const char *fmt, ...)
 int main(int argc, char **argv)
 {
 	int i, n;
-	struct ringbuf *ring;
+	struct ringbuf *ring = NULL;
 	struct ringbuf_entry *e;
 	struct sockaddr_ll local = {
 		.sll_family   = AF_PACKET,
 		.sll_protocol = htons(ETH_P_ALL)
 	};
 
-	radiotap_hdr_t *rhdr;
+	struct rx_ring rx;
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *frame;
+	struct pollfd pfd;
 
-	uint8_t frametype;
-	uint8_t pktbuf[0xFFFF];
-	ssize_t pktlen;
+	uint8_t *pkt;
+	uint32_t usec;
 
 	FILE *o;
 
@@ -419,13 +551,28 @@ int main(int argc, char **argv)
 		return 2;
 	}
 
-	if ((capture_sock = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+	/* Protocol 0 receives nothing until the socket is bound below */
+	if ((capture_sock = socket(PF_PACKET, SOCK_RAW, 0)) < 0)
 	{
 		msg("Unable to create raw socket: %s\n",
 				strerror(errno));
 		return 6;
 	}
 
+	if (set_filter(filter_beacon, filter_data, streaming ? 0xFFFF : pktcap))
+	{
+		msg("Unable to attach packet filter: %s\n",
+			strerror(errno));
+		return 6;
+	}
+
+	if (rx_ring_init(&rx))
+	{
+		msg("Unable to set up packet ring: %s\n",
+			strerror(errno));
+		return 6;
+	}
+
 	if (bind(capture_sock, (struct sockaddr *)&local, sizeof(local)) == -1)
 	{
 		msg("Unable to bind to interface: %s\n",
@@ -487,6 +634,9 @@ int main(int argc, char **argv)
 
 	promisc = set_promisc(1);
 
+	pfd.fd = capture_sock;
+	pfd.events = POLLIN | POLLERR;
+
 	/* capture loop */
 	while (1)
 	{
@@ -516,8 +666,10 @@ int main(int argc, char **argv)
 
 				fclose(o);
 
+				update_stats();
+
 				msg(" * %d frames captured\n", frames_captured);
-				msg(" * %d frames filtered\n", frames_filtered);
+				msg(" * %d frames dropped\n", frames_dropped);
 				msg(" * %d frames dumped\n", n);
 			}
 
@@ -530,53 +682,63 @@ int main(int argc, char **argv)
 			if (promisc)
 				set_promisc(0);
 
+			update_stats();
+
+			msg(" * %d frames captured\n", frames_captured);
+			msg(" * %d frames dropped\n", frames_dropped);
+
+			rx_ring_free(&rx);
+
 			if (ring)
 				ringbuf_free(ring);
 
 			return 0;
 		}
 
-		pktlen = recvfrom(capture_sock, pktbuf, sizeof(pktbuf), 0, NULL, 0);
-		frames_captured++;
-
-		/* check received frametype, if we should filter it, rewind the ring */
-		rhdr = (radiotap_hdr_t *)pktbuf;
-
-		if (pktlen <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= pktlen)
+		if (!(block = rx_ring_block(&rx)))
 		{
-			frames_filtered++;
+			/* Retired blocks show up at least every RX_BLOCK_TIMEOUT */
+			poll(&pfd, 1, 1000);
 			continue;
 		}
 
-		frametype = *(uint8_t *)(pktbuf + le16(rhdr->it_len));
+		frame = (void *)((uint8_t *)block +
+		                 block->hdr.bh1.offset_to_first_pkt);
 
-		if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
-		    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
+		for (i = 0; i < block->hdr.bh1.num_pkts; i++)
 		{
-			frames_filtered++;
-			continue;
-		}
+			pkt = (uint8_t *)frame + frame->tp_mac;
+			usec = frame->tp_nsec / 1000;
 
-		if (streaming)
-		{
-			if (!header_written)
+			if (streaming)
 			{
-				write_pcap_header(stdout);
-				header_written = 1;
+				if (!header_written)
+				{
+					write_pcap_header(stdout);
+					header_written = 1;
+				}
+
+				write_pcap_frame(stdout, &frame->tp_sec, &usec,
+				                 frame->tp_snaplen, frame->tp_len);
+				fwrite(pkt, 1, frame->tp_snaplen, stdout);
 			}
+			else
+			{
+				/* The filter already truncated the frame to pktcap */
+				e = ringbuf_add(ring, frame->tp_sec, usec);
+				e->olen = frame->tp_len;
+				e->len = (frame->tp_snaplen > pktcap) ? pktcap : frame->tp_snaplen;
 
-			write_pcap_frame(stdout, NULL, NULL, pktlen, pktlen);
-			fwrite(pktbuf, 1, pktlen, stdout);
-			fflush(stdout);
-		}
-		else
-		{
-			e = ringbuf_add(ring);
-			e->olen = pktlen;
-			e->len = (pktlen > pktcap) ? pktcap : pktlen;
+				memcpy((void *)e + sizeof(*e), pkt, e->len);
+			}
 
-			memcpy((void *)e + sizeof(*e), pktbuf, e->len);
+			frame = (void *)((uint8_t *)frame + frame->tp_next_offset);
 		}
+
+		rx_ring_release(&rx, block);
+
+		if (streaming)
+			fflush(stdout);
 	}
 
 	return 0;
@@ -612,7 +612,8 @@ static bool cidr_print6(struct cidr *a)
 }
 
 
-static struct cidr * cidr_parse(const char *op, const char *s, int af_hint)
+static struct cidr * cidr_parse(const char *op, const char *s, int af_hint,
+                                int *status)
 {
 	char *r;
 	struct cidr *a;
@@ -662,7 +663,9 @@ static struct cidr * cidr_parse(const char *op, const char *s, int af_hint)
 				op,
 				(af_hint == AF_INET) ? "ipv4" : "ipv6",
 				(af_hint != AF_INET) ? "ipv4" : "ipv6");
-		exit(4);
+		free(a);
+		*status = 4;
+		return NULL;
 	}
 
 	return a;
@@ -818,6 +821,25 @@ static void usage(const char *prog)
 			fprintf(stderr, "    Only applicable to ipv4-addresses.\n\n");
 	}
 
+	fprintf(stderr,
+	        "Batch mode:\n\n"
+	        "  %s -\n"
+	        "    Read one calculation per line from stdin, written as the "
+	        "arguments\n    above, and print one result line for each.\n\n"
+	        "Prefix sets:\n\n"
+	        "  %s aggregate [file ...]\n"
+	        "    Print the smallest list of prefixes covering all prefixes "
+	        "read from\n    the files or from stdin.\n\n"
+	        "  %s subtract file [file ...]\n"
+	        "    Print the prefixes read from stdin minus the ones in the "
+	        "files.\n\n"
+	        "  %s match file [file ...]\n"
+	        "    Print '1' or '0' for each address or prefix read from stdin, "
+	        "depending\n    on whether it is covered by the prefixes in the "
+	        "files.\n\n"
+	        "  Sets accept ipv4 and ipv6 prefixes, one per line.\n\n",
+	        prog, prog, prog, prog);
+
 	fprintf(stderr,
 	        "Examples:\n\n"
 	        " Calculate a DHCP range:\n\n"
@@ -858,10 +880,13 @@ static bool runop(char ***arg, int *status)
 					return false;
 				}
 
-				b = cidr_parse(ops[i].name, arg2, a->family);
+				b = cidr_parse(ops[i].name, arg2, a->family, status);
 
 				if (!b)
 				{
+					if (*status == 4)
+						return false;
+
 					fprintf(stderr, "invalid address argument for '%s'\n",
 							ops[i].name);
 
@@ -878,6 +903,7 @@ static bool runop(char ***arg, int *status)
 					        ops[i].name,
 							(a->family == AF_INET) ? "ipv4" : "ipv6");
 
+					free(b);
 					*status = 5;
 					return false;
 				}
@@ -885,6 +911,7 @@ static bool runop(char ***arg, int *status)
 				*status = !((a->family == AF_INET) ? ops[i].f4.a2(a, b)
 				                                   : ops[i].f6.a2(a, b));
 
+				free(b);
 				return true;
 			}
 			else
@@ -913,31 +940,36 @@ static bool runop(char ***arg, int *status)
 	return false;
 }
 
-int main(int argc, char **argv)
+static int calc(char **argv)
 {
 	int status = 0;
-	char **arg = argv+2;
+	char **arg = argv+1;
 	struct cidr *a;
 
-	if (argc < 3)
-		usage(argv[0]);
+	while (cidr_pop(stack));
 
-	a = strchr(argv[1], ':') ? cidr_parse6(argv[1]) : cidr_parse4(argv[1]);
+	quiet = false;
+	printed = false;
+
+	a = strchr(argv[0], ':') ? cidr_parse6(argv[0]) : cidr_parse4(argv[0]);
 
 	if (!a)
-		usage(argv[0]);
+		return -1;
 
 	cidr_push(a);
 
 	while (runop(&arg, &status));
 
+	if (status > 2)
+		return status;
+
 	if (*arg)
 	{
 		fprintf(stderr, "unknown operation '%s'\n", *arg);
-		exit(6);
+		return 6;
 	}
 
-	if (!printed && (status < 2))
+	if (!printed && (status < 2) && stack)
 	{
 		if (stack->family == AF_INET)
 			cidr_print4(stack);
@@ -945,6 +977,382 @@ int main(int argc, char **argv)
 			cidr_print6(stack);
 	}
 
+	return status;
+}
+
+static char * next_token(char **s)
+{
+	char *p = *s + strspn(*s, " \t\r\n");
+	char *e = p + strcspn(p, " \t\r\n");
+
+	*s = *e ? e + 1 : e;
+	*e = 0;
+
+	return *p ? p : NULL;
+}
+
+static int batch(void)
+{
+	char line[512], *p, **args = NULL;
+	int n, size = 0, status, rv = 0;
+
+	while (fgets(line, sizeof(line), stdin))
+	{
+		p = line;
+
+		for (n = 0; ; n++)
+		{
+			if (n + 1 >= size)
+			{
+				size += 16;
+				args = realloc(args, size * sizeof(*args));
+
+				if (!args)
+				{
+					fprintf(stderr, "out of memory\n");
+					exit(255);
+				}
+			}
+
+			if (!(args[n] = next_token(&p)))
+				break;
+		}
+
+		if (n == 0 || args[0][0] == '#')
+			continue;
+
+		status = calc(args);
+
+		if (status < 0)
+		{
+			fprintf(stderr, "invalid base address '%s'\n", args[0]);
+			status = 1;
+		}
+
+		/* exactly one output line per calculation, even if quiet */
+		printf("\n");
+
+		if (status)
+			rv = status;
+	}
+
+	free(args);
+
+	return rv;
+}
+
+
+/*
+ * Prefix sets are kept in one binary trie per address family. A full
+ * node covers the whole prefix it stands for and never has children,
+ * two full siblings are merged into their parent as soon as they occur,
+ * so the trie is always in aggregated form.
+ */
+
+struct node {
+	struct node *child[2];
+	bool full;
+};
+
+struct set {
+	struct node *v4;
+	struct node *v6;
+};
+
+static struct node * node_new(bool full)
+{
+	struct node *n = calloc(1, sizeof(*n));
+
+	if (!n)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(255);
+	}
+
+	n->full = full;
+
+	return n;
+}
+
+static void node_free(struct node *n)
+{
+	if (n)
+	{
+		node_free(n->child[0]);
+		node_free(n->child[1]);
+		free(n);
+	}
+}
+
+static int key_bit(const uint8_t *key, int i)
+{
+	return (key[i / 8] >> (7 - (i % 8))) & 1;
+}
+
+static void trie_insert(struct node **np, const uint8_t *key, int depth,
+                        int len)
+{
+	struct node *n = *np;
+
+	if (!n)
+		n = *np = node_new(false);
+
+	if (n->full)
+		return;
+
+	if (depth == len)
+	{
+		node_free(n->child[0]);
+		node_free(n->child[1]);
+		n->child[0] = n->child[1] = NULL;
+		n->full = true;
+		return;
+	}
+
+	trie_insert(&n->child[key_bit(key, depth)], key, depth + 1, len);
+
+	if (n->child[0] && n->child[0]->full &&
+	    n->child[1] && n->child[1]->full)
+	{
+		free(n->child[0]);
+		free(n->child[1]);
+		n->child[0] = n->child[1] = NULL;
+		n->full = true;
+	}
+}
+
+static void trie_remove(struct node **np, const uint8_t *key, int depth,
+                        int len)
+{
+	struct node *n = *np;
+
+	if (!n)
+		return;
+
+	if (depth == len)
+	{
+		node_free(n);
+		*np = NULL;
+		return;
+	}
+
+	/* punch a hole into a covering prefix by splitting it up */
+	if (n->full)
+	{
+		n->full = false;
+		n->child[0] = node_new(true);
+		n->child[1] = node_new(true);
+	}
+
+	trie_remove(&n->child[key_bit(key, depth)], key, depth + 1, len);
+
+	if (!n->child[0] && !n->child[1])
+	{
+		free(n);
+		*np = NULL;
+	}
+}
+
+static bool trie_contains(const struct node *n, const uint8_t *key, int len)
+{
+	int depth;
+
+	for (depth = 0; n; depth++)
+	{
+		if (n->full)
+			return true;
+
+		if (depth == len)
+			break;
+
+		n = n->child[key_bit(key, depth)];
+	}
+
+	return false;
+}
+
+static void trie_print(const struct node *n, uint8_t *key, int depth,
+                       int family)
+{
+	char buf[INET6_ADDRSTRLEN];
+	int bits = (family == AF_INET) ? 32 : 128;
+
+	if (!n)
+		return;
+
+	if (n->full)
+	{
+		inet_ntop(family, key, buf, sizeof(buf));
+
+		if (depth < bits)
+			printf("%s/%d\n", buf, depth);
+		else
+			printf("%s\n", buf);
+
+		return;
+	}
+
+	trie_print(n->child[0], key, depth + 1, family);
+
+	key[depth / 8] |= 0x80 >> (depth % 8);
+	trie_print(n->child[1], key, depth + 1, family);
+	key[depth / 8] &= ~(0x80 >> (depth % 8));
+}
+
+static struct cidr * set_parse_line(char *line, int *status)
+{
+	char *p = line;
+	struct cidr *a;
+
+	if (!(p = next_token(&p)) || *p == '#')
+		return NULL;
+
+	a = strchr(p, ':') ? cidr_parse6(p) : cidr_parse4(p);
+
+	if (!a)
+	{
+		fprintf(stderr, "invalid prefix '%s'\n", p);
+		*status = 3;
+	}
+
+	return a;
+}
+
+static uint8_t * cidr_key(struct cidr *a)
+{
+	return (a->family == AF_INET) ? (uint8_t *)&a->addr.v4
+	                              : a->addr.v6.s6_addr;
+}
+
+static struct node ** set_root(struct set *s, struct cidr *a)
+{
+	return (a->family == AF_INET) ? &s->v4 : &s->v6;
+}
+
+static int set_load(struct set *s, FILE *f, bool remove)
+{
+	char line[128];
+	int status = 0;
+	struct cidr *a;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (!(a = set_parse_line(line, &status)))
+			continue;
+
+		if (remove)
+			trie_remove(set_root(s, a), cidr_key(a), 0, a->prefix);
+		else
+			trie_insert(set_root(s, a), cidr_key(a), 0, a->prefix);
+
+		free(a);
+	}
+
+	return status;
+}
+
+static int set_load_files(struct set *s, char **files, bool remove)
+{
+	int status = 0;
+	FILE *f;
+
+	for (; *files; files++)
+	{
+		if (!(f = fopen(*files, "r")))
+		{
+			fprintf(stderr, "unable to open '%s'\n", *files);
+			exit(7);
+		}
+
+		if (set_load(s, f, remove))
+			status = 3;
+
+		fclose(f);
+	}
+
+	return status;
+}
+
+static void set_print(struct set *s)
+{
+	uint8_t key[16] = { 0 };
+
+	trie_print(s->v4, key, 0, AF_INET);
+	trie_print(s->v6, key, 0, AF_INET6);
+}
+
+static int set_match(struct set *s, FILE *f)
+{
+	char line[128];
+	int status = 0;
+	struct cidr *a;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (!(a = set_parse_line(line, &status)))
+			continue;
+
+		printf("%d\n", trie_contains(*set_root(s, a), cidr_key(a), a->prefix));
+		free(a);
+	}
+
+	return status;
+}
+
+static int setop(const char *op, char **files)
+{
+	struct set s = { };
+	int status;
+
+	if (!strcmp(op, "aggregate"))
+	{
+		status = *files ? set_load_files(&s, files, false)
+		                : set_load(&s, stdin, false);
+		set_print(&s);
+	}
+	else if (!strcmp(op, "subtract"))
+	{
+		status = set_load(&s, stdin, false);
+		status |= set_load_files(&s, files, true);
+		set_print(&s);
+	}
+	else
+	{
+		status = set_load_files(&s, files, false);
+		status |= set_match(&s, stdin);
+	}
+
+	node_free(s.v4);
+	node_free(s.v6);
+
+	return status ? 3 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int status;
+
+	if ((argc == 2) && !strcmp(argv[1], "-"))
+		return batch();
+
+	if ((argc >= 2) && !strcmp(argv[1], "aggregate"))
+		return setop(argv[1], argv+2);
+
+	if ((argc >= 3) && (!strcmp(argv[1], "subtract") ||
+	                    !strcmp(argv[1], "match")))
+		return setop(argv[1], argv+2);
+
+	if (argc < 3)
+		usage(argv[0]);
+
+	status = calc(argv+1);
+
+	if (status < 0)
+		usage(argv[0]);
+
+	if (status > 2)
+		exit(status);
+
 	qprintf("\n");
 
 	exit(status);
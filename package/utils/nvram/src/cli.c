@@ -143,9 +143,86 @@ static void usage(void)
 		"	nvram set variable=value [set ...]\n"
 		"	nvram unset variable [unset ...]\n"
 		"	nvram commit\n"
+		"	nvram daemon\n"
 	);
 }
 
+/* Forward all commands to a running nvram daemon */
+static int do_client(int fd, int argc, const char *argv[], int *done)
+{
+	char *reply;
+	int stat = 1;
+	int i;
+
+	for( i = 1; i < argc; i++ )
+	{
+		reply = NULL;
+
+		if( !strcmp(argv[i], "show") )
+		{
+			stat = nvram_client_request(fd, NVRAM_REQ_SHOW, NULL, &reply);
+			(*done)++;
+		}
+		else if( !strcmp(argv[i], "get") || !strcmp(argv[i], "unset") || !strcmp(argv[i], "set") )
+		{
+			if( (i+1) < argc )
+			{
+				switch(argv[i++][0])
+				{
+					case 'g':
+						stat = nvram_client_request(fd, NVRAM_REQ_GET, argv[i], &reply);
+						if( !stat )
+							printf("%s\n", reply);
+						free(reply);
+						reply = NULL;
+						break;
+
+					case 'u':
+						stat = nvram_client_request(fd, NVRAM_REQ_UNSET, argv[i], NULL);
+						break;
+
+					case 's':
+						stat = nvram_client_request(fd, NVRAM_REQ_SET, argv[i], NULL);
+						break;
+				}
+				(*done)++;
+			}
+			else
+			{
+				fprintf(stderr, "Command '%s' requires an argument!\n", argv[i]);
+				*done = 0;
+				break;
+			}
+		}
+		else if( !strcmp(argv[i], "commit") )
+		{
+			stat = nvram_client_request(fd, NVRAM_REQ_COMMIT, NULL, NULL);
+			(*done)++;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option '%s' !\n", argv[i]);
+			*done = 0;
+			break;
+		}
+
+		if( reply )
+		{
+			fputs(reply, stdout);
+			free(reply);
+		}
+
+		if( stat < 0 )
+		{
+			fprintf(stderr, "Lost connection to nvram daemon!\n");
+			stat = 1;
+			break;
+		}
+	}
+
+	return stat;
+}
+
 int main( int argc, const char *argv[] )
 {
 	nvram_handle_t *nvram;
@@ -153,6 +230,7 @@ int main( int argc, const char *argv[] )
 	int write = 0;
 	int stat = 1;
 	int done = 0;
+	int fd;
 	int i;
 
 	if( argc < 2 ) {
@@ -160,6 +238,24 @@ int main( int argc, const char *argv[] )
 		return 1;
 	}
 
+	if( !strcmp(argv[1], "daemon") )
+		return nvram_server_run(NVRAM_SOCKET);
+
+	/* Let a running daemon answer, "info" needs the raw image though */
+	if( strcmp(argv[1], "info") && (fd = nvram_client_open(NVRAM_SOCKET)) > -1 )
+	{
+		stat = do_client(fd, argc, argv, &done);
+		nvram_client_close(fd);
+
+		if( !done )
+		{
+			usage();
+			stat = 1;
+		}
+
+		return stat;
+	}
+
 	/* Ugly... iterate over arguments to see whether we can expect a write */
 	if( ( !strcmp(argv[1], "set")  && 2 < argc ) ||
 		( !strcmp(argv[1], "unset") && 2 < argc ) ||
@@ -0,0 +1,89 @@
+/*
+ * Client side of the resident NVRAM server
+ *
+ * Copyright OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "nvram.h"
+
+
+/* Connect to a running NVRAM server, returns a socket or -1. */
+int nvram_client_open(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if( strlen(path) >= sizeof(addr.sun_path) )
+		return -1;
+
+	strcpy(addr.sun_path, path);
+
+	if( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+		return -1;
+
+	if( connect(fd, (struct sockaddr *) &addr, sizeof(addr)) )
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Send one request to the NVRAM server, reply is malloc()ed if non-NULL. */
+int nvram_client_request(int fd, char cmd, const char *arg, char **reply)
+{
+	uint32_t len = 1 + (arg ? strlen(arg) : 0);
+	int32_t stat;
+	char *buf;
+
+	if( send(fd, &len, sizeof(len), MSG_NOSIGNAL) != sizeof(len) ||
+	    send(fd, &cmd, 1, MSG_NOSIGNAL) != 1 ||
+	    (len > 1 && send(fd, arg, len - 1, MSG_NOSIGNAL) != len - 1) )
+		return -1;
+
+	if( recv(fd, &len, sizeof(len), MSG_WAITALL) != sizeof(len) ||
+	    len < sizeof(stat) ||
+	    recv(fd, &stat, sizeof(stat), MSG_WAITALL) != sizeof(stat) )
+		return -1;
+
+	len -= sizeof(stat);
+
+	if( (buf = malloc(len + 1)) == NULL )
+		return -1;
+
+	if( len > 0 && recv(fd, buf, len, MSG_WAITALL) != len )
+	{
+		free(buf);
+		return -1;
+	}
+
+	buf[len] = '\0';
+
+	if( reply )
+		*reply = buf;
+	else
+		free(buf);
+
+	return stat;
+}
+
+/* Disconnect from the NVRAM server. */
+void nvram_client_close(int fd)
+{
+	close(fd);
+}
@@ -44,7 +44,7 @@ static void _nvram_free(nvram_handle_t *h)
 	nvram_tuple_t *t, *next;
 
 	/* Free hash table */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
+	for (i = 0; i < h->nvram_hash_size; i++) {
 		for (t = h->nvram_hash[i]; t; t = next) {
 			next = t->next;
 			if (t->value)
@@ -54,6 +54,8 @@ static void _nvram_free(nvram_handle_t *h)
 		h->nvram_hash[i] = NULL;
 	}
 
+	h->nvram_count = 0;
+
 	/* Free dead table */
 	for (t = h->nvram_dead; t; t = next) {
 		next = t->next;
@@ -96,6 +98,32 @@ static nvram_tuple_t * _nvram_realloc( nvram_handle_t *h, nvram_tuple_t *t,
 	return t;
 }
 
+/* Grow the hash table once the chains get too long. */
+static void _nvram_grow(nvram_handle_t *h)
+{
+	uint32_t i, j, size;
+	nvram_tuple_t **table, *t, *next;
+
+	size = h->nvram_hash_size * 2 + 1;
+
+	/* Keep using the old table if memory is tight */
+	if (!(table = calloc(size, sizeof(*table))))
+		return;
+
+	for (i = 0; i < h->nvram_hash_size; i++) {
+		for (t = h->nvram_hash[i]; t; t = next) {
+			next = t->next;
+			j = hash(t->name) % size;
+			t->next = table[j];
+			table[j] = t;
+		}
+	}
+
+	free(h->nvram_hash);
+	h->nvram_hash = table;
+	h->nvram_hash_size = size;
+}
+
 /* (Re)initialize the hash table. */
 static int _nvram_rehash(nvram_handle_t *h)
 {
@@ -136,6 +164,9 @@ static int _nvram_rehash(nvram_handle_t *h)
 		nvram_set(h, "sdram_ncdl", buf);
 	}
 
+	/* Table reflects the flash contents now */
+	h->dirty = 0;
+
 	return 0;
 }
 
@@ -161,7 +192,7 @@ char * nvram_get(nvram_handle_t *h, const char *name)
 		return NULL;
 
 	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	i = hash(name) % h->nvram_hash_size;
 
 	/* Find the associated tuple in the hash table */
 	for (t = h->nvram_hash[i]; t && strcmp(t->name, name); t = t->next);
@@ -178,16 +209,22 @@ int nvram_set(nvram_handle_t *h, const char *name, const char *value)
 	nvram_tuple_t *t, *u, **prev;
 
 	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	i = hash(name) % h->nvram_hash_size;
 
 	/* Find the associated tuple in the hash table */
 	for (prev = &h->nvram_hash[i], t = *prev;
 		 t && strcmp(t->name, name); prev = &t->next, t = *prev);
 
+	/* Unchanged value */
+	if (t && !strcmp(t->value, value))
+		return 0;
+
 	/* (Re)allocate tuple */
 	if (!(u = _nvram_realloc(h, t, name, value)))
 		return -12; /* -ENOMEM */
 
+	h->dirty = 1;
+
 	/* Value reallocated */
 	if (t && t == u)
 		return 0;
@@ -203,6 +240,9 @@ int nvram_set(nvram_handle_t *h, const char *name, const char *value)
 	u->next = h->nvram_hash[i];
 	h->nvram_hash[i] = u;
 
+	if (++h->nvram_count > h->nvram_hash_size * 2)
+		_nvram_grow(h);
+
 	return 0;
 }
 
@@ -216,7 +256,7 @@ int nvram_unset(nvram_handle_t *h, const char *name)
 		return 0;
 
 	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	i = hash(name) % h->nvram_hash_size;
 
 	/* Find the associated tuple in the hash table */
 	for (prev = &h->nvram_hash[i], t = *prev;
@@ -227,6 +267,8 @@ int nvram_unset(nvram_handle_t *h, const char *name)
 		*prev = t->next;
 		t->next = h->nvram_dead;
 		h->nvram_dead = t;
+		h->nvram_count--;
+		h->dirty = 1;
 	}
 
 	return 0;
@@ -240,7 +282,7 @@ nvram_tuple_t * nvram_getall(nvram_handle_t *h)
 
 	l = NULL;
 
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
+	for (i = 0; i < h->nvram_hash_size; i++) {
 		for (t = h->nvram_hash[i]; t; t = t->next) {
 			if( (x = (nvram_tuple_t *) malloc(sizeof(nvram_tuple_t))) != NULL )
 			{
@@ -297,7 +339,7 @@ int nvram_commit(nvram_handle_t *h)
 	end = (char *) header + nvram_part_size - h->offset - 2;
 
 	/* Write out all tuples */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
+	for (i = 0; i < h->nvram_hash_size; i++) {
 		for (t = h->nvram_hash[i]; t; t = t->next) {
 			if ((ptr + strlen(t->name) + 1 + strlen(t->value) + 1) > end)
 				break;
@@ -398,9 +440,13 @@ nvram_handle_t * nvram_open(const char *file, int rdonly)
 				h->length = nvram_part_size;
 				h->offset = offset;
 
+				h->nvram_hash_size = NVRAM_HASH_SIZE;
+				h->nvram_hash = calloc(h->nvram_hash_size,
+					sizeof(*h->nvram_hash));
+
 				header = nvram_header(h);
 
-				if (header->magic == NVRAM_MAGIC &&
+				if (h->nvram_hash && header->magic == NVRAM_MAGIC &&
 				    (rdonly || header->len < h->length - h->offset)) {
 					_nvram_rehash(h);
 					free(mtd);
@@ -409,6 +455,7 @@ nvram_handle_t * nvram_open(const char *file, int rdonly)
 				else
 				{
 					munmap(h->mmap, h->length);
+					free(h->nvram_hash);
 					free(h);
 				}
 			}
@@ -426,6 +473,7 @@ int nvram_close(nvram_handle_t *h)
 	_nvram_free(h);
 	munmap(h->mmap, h->length);
 	close(h->fd);
+	free(h->nvram_hash);
 	free(h);
 
 	return 0;
@@ -516,20 +564,28 @@ int staging_to_nvram(void)
 {
 	int fdmtd, fdstg, stat;
 	char *mtd = nvram_find_mtd();
-	char buf[nvram_part_size];
+	char *buf = malloc(nvram_part_size);
+	char *cur = malloc(nvram_part_size);
 
 	stat = -1;
 
-	if( (mtd != NULL) && (nvram_part_size > 0) )
+	if( (mtd != NULL) && (nvram_part_size > 0) && buf && cur )
 	{
 		if( (fdstg = open(NVRAM_STAGING, O_RDONLY)) > -1 )
 		{
-			if( read(fdstg, buf, sizeof(buf)) == sizeof(buf) )
+			if( read(fdstg, buf, nvram_part_size) == nvram_part_size )
 			{
-				if( (fdmtd = open(mtd, O_WRONLY | O_SYNC)) > -1 )
+				if( (fdmtd = open(mtd, O_RDWR | O_SYNC)) > -1 )
 				{
-					write(fdmtd, buf, sizeof(buf));
-					fsync(fdmtd);
+					/* Skip the flash write if nothing changed */
+					if( read(fdmtd, cur, nvram_part_size) != nvram_part_size ||
+					    memcmp(buf, cur, nvram_part_size) )
+					{
+						lseek(fdmtd, 0, SEEK_SET);
+						write(fdmtd, buf, nvram_part_size);
+						fsync(fdmtd);
+					}
+
 					close(fdmtd);
 					stat = 0;
 				}
@@ -542,6 +598,8 @@ int staging_to_nvram(void)
 		}
 	}
 
+	free(cur);
+	free(buf);
 	free(mtd);
 	return stat;
 }
@@ -48,14 +48,20 @@ struct nvram_handle {
 	char *mmap;
 	unsigned int length;
 	unsigned int offset;
-	struct nvram_tuple *nvram_hash[257];
+	struct nvram_tuple **nvram_hash;
+	unsigned int nvram_hash_size;
+	unsigned int nvram_count;
 	struct nvram_tuple *nvram_dead;
+	int dirty;
 };
 
 typedef struct nvram_handle nvram_handle_t;
 typedef struct nvram_header nvram_header_t;
 typedef struct nvram_tuple  nvram_tuple_t;
 
+/* Size of "nvram" MTD partition */
+extern size_t nvram_part_size;
+
 
 /* Get nvram header. */
 nvram_header_t * nvram_header(nvram_handle_t *h);
@@ -102,9 +108,32 @@ int staging_to_nvram(void);
 /* Check NVRAM staging file. */
 char * nvram_find_staging(void);
 
+/* Serve NVRAM requests on a UNIX socket until terminated. */
+int nvram_server_run(const char *path);
+
+/* Connect to a running NVRAM server, returns a socket or -1. */
+int nvram_client_open(const char *path);
+
+/* Send one request to the NVRAM server, reply is malloc()ed if non-NULL. */
+int nvram_client_request(int fd, char cmd, const char *arg, char **reply);
+
+/* Disconnect from the NVRAM server. */
+void nvram_client_close(int fd);
+
 
 /* Staging file for NVRAM */
 #define NVRAM_STAGING		"/tmp/.nvram"
+
+/* Control socket of the NVRAM server */
+#define NVRAM_SOCKET		"/var/run/nvram.sock"
+
+/* NVRAM server requests */
+#define NVRAM_REQ_GET		'g'
+#define NVRAM_REQ_SET		's'
+#define NVRAM_REQ_UNSET		'u'
+#define NVRAM_REQ_SHOW		'a'
+#define NVRAM_REQ_COMMIT	'c'
+
 #define NVRAM_RO			1
 #define NVRAM_RW			0
 
@@ -114,6 +143,7 @@ char * nvram_find_staging(void);
 
 /* NVRAM constants */
 #define NVRAM_MIN_SPACE			0x8000
+#define NVRAM_HASH_SIZE			257
 #define NVRAM_MAGIC			0x48534C46	/* 'FLSH' */
 #define NVRAM_VERSION		1
 
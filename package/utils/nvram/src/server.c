@@ -0,0 +1,267 @@
+/*
+ * Resident NVRAM server
+ *
+ * Copyright OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ * The server keeps one parsed NVRAM handle in memory, so clients no
+ * longer pay for nvram_open() on every request. Changes are written to
+ * the staging file before they are acknowledged, so a server that gets
+ * killed and respawned does not lose them. A commit request copies the
+ * staging file to flash, which is only written if the image differs.
+ *
+ * Connections are served one at a time, a client that stalls in the
+ * middle of a message is dropped after NVRAM_SERVER_TIMEOUT seconds.
+ *
+ * Every message on the socket is a 32 bit length followed by the
+ * payload. Requests carry a command byte and its argument, replies a
+ * 32 bit status followed by the result text.
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "nvram.h"
+
+#define NVRAM_SERVER_TIMEOUT	2
+
+
+static volatile sig_atomic_t server_quit = 0;
+
+static void server_signal(int sig __attribute__((unused)))
+{
+	server_quit = 1;
+}
+
+static nvram_handle_t * server_open(void)
+{
+	if( nvram_find_staging() != NULL || nvram_to_staging() == 0 )
+		return nvram_open(NVRAM_STAGING, NVRAM_RW);
+
+	return NULL;
+}
+
+static int server_recv(int fd, char **buf, uint32_t *len)
+{
+	uint32_t n;
+
+	if( recv(fd, &n, sizeof(n), MSG_WAITALL) != sizeof(n) )
+		return -1;
+
+	/* Nothing sensible can be bigger than the partition itself */
+	if( n > nvram_part_size + 1 || !(*buf = malloc(n + 1)) )
+		return -1;
+
+	if( n > 0 && recv(fd, *buf, n, MSG_WAITALL) != n )
+	{
+		free(*buf);
+		return -1;
+	}
+
+	(*buf)[n] = '\0';
+	*len = n;
+
+	return 0;
+}
+
+static int server_reply(int fd, int32_t stat, const char *data, uint32_t len)
+{
+	uint32_t n = sizeof(stat) + len;
+
+	if( send(fd, &n, sizeof(n), MSG_NOSIGNAL) != sizeof(n) ||
+	    send(fd, &stat, sizeof(stat), MSG_NOSIGNAL) != sizeof(stat) ||
+	    (len > 0 && send(fd, data, len, MSG_NOSIGNAL) != len) )
+		return -1;
+
+	return 0;
+}
+
+static int server_show(int fd, nvram_handle_t *h)
+{
+	nvram_tuple_t *t, *next;
+	char *buf = NULL, *tmp;
+	size_t len = 0, size = 0, n;
+	int stat = 0;
+
+	for( t = nvram_getall(h); t; t = next )
+	{
+		next = t->next;
+		n = strlen(t->name) + strlen(t->value) + 2;
+
+		if( !stat && len + n + 1 > size )
+		{
+			size = (len + n + 1) * 2;
+
+			if( (tmp = realloc(buf, size)) != NULL )
+				buf = tmp;
+			else
+				stat = 1;
+		}
+
+		if( !stat )
+			len += sprintf(buf + len, "%s=%s\n", t->name, t->value);
+
+		free(t);
+	}
+
+	stat = server_reply(fd, stat, buf, len);
+	free(buf);
+
+	return stat;
+}
+
+/* Serialize a change to the staging file before it is acknowledged */
+static int32_t server_stage(nvram_handle_t *h, int32_t stat)
+{
+	if( !stat && h->dirty && nvram_commit(h) )
+		return 1;
+
+	return stat;
+}
+
+static nvram_handle_t * server_commit(nvram_handle_t *h, int32_t *stat)
+{
+	/* Serialize only if a value changed since it was last staged */
+	if( h->dirty && nvram_commit(h) )
+	{
+		*stat = 1;
+		return h;
+	}
+
+	nvram_close(h);
+	*stat = staging_to_nvram();
+
+	return server_open();
+}
+
+static int server_handle(int fd, nvram_handle_t **h)
+{
+	char *req, *arg, *val;
+	uint32_t len;
+	int32_t stat;
+	int ret;
+
+	if( server_recv(fd, &req, &len) || len < 1 )
+		return -1;
+
+	arg = req + 1;
+
+	switch( req[0] )
+	{
+		case NVRAM_REQ_GET:
+			val = nvram_get(*h, arg);
+			ret = server_reply(fd, !val, val, val ? strlen(val) : 0);
+			break;
+
+		case NVRAM_REQ_SET:
+			stat = 1;
+
+			if( (val = strchr(arg, '=')) != NULL )
+			{
+				*val++ = '\0';
+				stat = nvram_set(*h, arg, val);
+			}
+
+			stat = server_stage(*h, stat);
+			ret = server_reply(fd, stat, NULL, 0);
+			break;
+
+		case NVRAM_REQ_UNSET:
+			stat = server_stage(*h, nvram_unset(*h, arg));
+			ret = server_reply(fd, stat, NULL, 0);
+			break;
+
+		case NVRAM_REQ_SHOW:
+			ret = server_show(fd, *h);
+			break;
+
+		case NVRAM_REQ_COMMIT:
+			*h = server_commit(*h, &stat);
+			ret = server_reply(fd, stat, NULL, 0);
+			break;
+
+		default:
+			ret = server_reply(fd, 1, NULL, 0);
+			break;
+	}
+
+	free(req);
+
+	return ret;
+}
+
+int nvram_server_run(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = server_signal };
+	struct timeval tv = { .tv_sec = NVRAM_SERVER_TIMEOUT };
+	nvram_handle_t *h;
+	int sock, fd;
+
+	if( strlen(path) >= sizeof(addr.sun_path) )
+		return 1;
+
+	strcpy(addr.sun_path, path);
+
+	if( (h = server_open()) == NULL )
+		return 1;
+
+	if( (sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+	{
+		nvram_close(h);
+		return 1;
+	}
+
+	unlink(path);
+
+	if( bind(sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(sock, 16) )
+	{
+		close(sock);
+		nvram_close(h);
+		return 1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while( !server_quit && h != NULL )
+	{
+		if( (fd = accept(sock, NULL, NULL)) < 0 )
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		/* Clients may pipeline several requests per connection */
+		while( !server_quit && h != NULL && !server_handle(fd, &h) );
+
+		close(fd);
+	}
+
+	close(sock);
+	unlink(path);
+
+	if( h == NULL )
+		return 1;
+
+	/* Everything was staged already, this only catches failed writes */
+	if( h->dirty )
+		nvram_commit(h);
+
+	nvram_close(h);
+
+	return 0;
+}
@@ -352,6 +352,8 @@ endif
 
 export BISON_PKGDATADIR:=$(STAGING_DIR_HOST)/share/bison
 export M4:=$(STAGING_DIR_HOST)/bin/m4
+export MKHASH_CACHE?=$(STAGING_DIR_HOST)/.mkhash-cache
+export TREESTAMP_CACHE?=$(TMP_DIR)/.treestamp
 
 define shvar
 V_$(subst .,_,$(subst -,_,$(subst /,_,$(1))))
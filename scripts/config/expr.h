@@ -85,6 +85,10 @@ struct symbol {
 	struct property *prop;
 	struct expr_value dir_dep;
 	struct expr_value rev_dep;
+	/* symbols whose value is calculated from this one */
+	struct symbol **rdeps;
+	int rdep_count, rdep_size;
+	unsigned int rdep_visit;
 };
 
 #define for_all_symbols(i, sym) for (i = 0; i < SYMBOL_HASHSIZE; i++) for (sym = symbol_hash[i]; sym; sym = sym->next) if (sym->type != S_OTHER)
@@ -476,6 +476,130 @@ void sym_clear_all_valid(void)
 	sym_calc_value(modules_sym);
 }
 
+static bool sym_rdeps_built;
+
+static void sym_add_rdep(struct symbol *sym, struct symbol *dep)
+{
+	if (!sym || sym == dep || (sym->flags & SYMBOL_CONST))
+		return;
+
+	/* expressions tend to repeat the same symbol back to back */
+	if (sym->rdep_count && sym->rdeps[sym->rdep_count - 1] == dep)
+		return;
+
+	if (sym->rdep_count == sym->rdep_size) {
+		sym->rdep_size = sym->rdep_size ? sym->rdep_size * 2 : 4;
+		sym->rdeps = xrealloc(sym->rdeps,
+				      sym->rdep_size * sizeof(*sym->rdeps));
+	}
+	sym->rdeps[sym->rdep_count++] = dep;
+}
+
+static void expr_add_rdeps(struct expr *e, struct symbol *dep)
+{
+	if (!e)
+		return;
+
+	switch (e->type) {
+	case E_SYMBOL:
+		sym_add_rdep(e->left.sym, dep);
+		break;
+	case E_NOT:
+		expr_add_rdeps(e->left.expr, dep);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_LTH:
+	case E_LEQ:
+	case E_GTH:
+	case E_GEQ:
+	case E_RANGE:
+		sym_add_rdep(e->left.sym, dep);
+		sym_add_rdep(e->right.sym, dep);
+		break;
+	case E_LIST:
+		sym_add_rdep(e->right.sym, dep);
+		expr_add_rdeps(e->left.expr, dep);
+		break;
+	case E_AND:
+	case E_OR:
+		expr_add_rdeps(e->left.expr, dep);
+		expr_add_rdeps(e->right.expr, dep);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Record for every symbol which other symbols use its value, following
+ * all expressions sym_calc_value() evaluates. Choice values reference
+ * their choice and vice versa, so a whole choice group is invalidated
+ * together.
+ */
+static void sym_build_rdeps(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym) {
+		expr_add_rdeps(sym->dir_dep.expr, sym);
+		expr_add_rdeps(sym->rev_dep.expr, sym);
+		for (prop = sym->prop; prop; prop = prop->next) {
+			expr_add_rdeps(prop->expr, sym);
+			expr_add_rdeps(prop->visible.expr, sym);
+		}
+	}
+	sym_rdeps_built = true;
+}
+
+/*
+ * Invalidate the value of sym and of everything depending on it, unlike
+ * sym_clear_all_valid() which recalculates the whole tree.
+ */
+void sym_clear_valid(struct symbol *sym)
+{
+	static unsigned int visit;
+	struct symbol **stack, *s;
+	int i, n, size;
+
+	/* the modules setting changes the type of every tristate */
+	if (sym == modules_sym) {
+		sym_clear_all_valid();
+		return;
+	}
+
+	if (!sym_rdeps_built)
+		sym_build_rdeps();
+
+	visit++;
+	size = 64;
+	stack = xmalloc(size * sizeof(*stack));
+	stack[0] = sym;
+	sym->rdep_visit = visit;
+	n = 1;
+
+	while (n) {
+		s = stack[--n];
+		s->flags &= ~SYMBOL_VALID;
+		for (i = 0; i < s->rdep_count; i++) {
+			if (s->rdeps[i]->rdep_visit == visit)
+				continue;
+			s->rdeps[i]->rdep_visit = visit;
+			if (n == size) {
+				size *= 2;
+				stack = xrealloc(stack, size * sizeof(*stack));
+			}
+			stack[n++] = s->rdeps[i];
+		}
+	}
+	free(stack);
+
+	sym_add_change_count(1);
+	sym_calc_value(modules_sym);
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -525,8 +649,11 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 	}
 
 	sym->def[S_DEF_USER].tri = val;
-	if (oldval != val)
-		sym_clear_all_valid();
+	if (oldval != val) {
+		sym_clear_valid(sym);
+		if (sym_is_choice_value(sym))
+			sym_clear_valid(prop_get_symbol(sym_get_choice_prop(sym)));
+	}
 
 	return true;
 }
@@ -683,7 +810,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_valid(sym);
 
 	return true;
 }
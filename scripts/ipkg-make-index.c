@@ -0,0 +1,1025 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Native replacement for the package loop of ipkg-make-index.sh. Every
+ * package is mapped once: the SHA256 sum is taken from the mapping (or
+ * from the mkhash cache) and the outer archive is inflated only until
+ * the control.tar.gz member is complete. Everything in front of it is
+ * dropped as soon as it left the deflate window, so memory use does not
+ * depend on the package size, and ipkg-build stores control.tar.gz in
+ * front of data.tar.gz. That member is then inflated again to extract
+ * the control file.
+ *
+ * The inflate code follows puff.c from the zlib distribution, with a
+ * lookup table in front of the canonical Huffman decoder.
+ */
+
+#define MKHASH_NO_MAIN
+#include "mkhash.c"
+
+#include <dirent.h>
+
+#define MAXBITS		15	/* maximum bits in a code */
+#define MAXLCODES	288	/* maximum number of literal/length codes */
+#define MAXDCODES	30	/* maximum number of distance codes */
+#define MAXDIST		32768	/* maximum distance of a back reference */
+#define FASTBITS	9	/* bits resolved by the lookup table */
+
+#define GZIP_FHCRC	0x02
+#define GZIP_FEXTRA	0x04
+#define GZIP_FNAME	0x08
+#define GZIP_FCOMMENT	0x10
+
+/* deflate cannot expand more than this, larger trailer sizes are bogus */
+#define MAXRATIO	1032
+
+#define TAR_BLOCK	512
+
+struct huffman {
+	uint16_t fast[1 << FASTBITS];	/* (length << 9) | symbol, 0 if longer */
+	uint16_t count[MAXBITS + 1];	/* number of codes of each length */
+	uint16_t symbol[MAXLCODES];	/* symbols in canonical order */
+};
+
+struct inflate_state {
+	const unsigned char *in;
+	const unsigned char *inend;
+	size_t overrun;
+	uint32_t bitbuf;
+	int bitcnt;
+
+	unsigned char *out;
+	size_t outpos;
+	size_t outsize;
+	size_t outmax;
+
+	/*
+	 * Once outpos reaches check, enough() decides whether to stop. It
+	 * may allow output before the absolute offset discard to be dropped,
+	 * base is the absolute offset of out[0].
+	 */
+	int (*enough)(struct inflate_state *s);
+	void *priv;
+	size_t check;
+	size_t discard;
+	size_t base;
+
+	struct huffman lencode;
+	struct huffman distcode;
+};
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*
+ * Keep at least 25 bits in the bit buffer. Reading past the end of the
+ * input yields zeroes and is counted, up to four of those bytes may just
+ * sit unused in the bit buffer. Anything beyond means a truncated stream.
+ */
+static inline void refill(struct inflate_state *s)
+{
+	while (s->bitcnt <= 24) {
+		uint32_t c = 0;
+
+		if (s->in < s->inend)
+			c = *s->in++;
+		else
+			s->overrun++;
+		s->bitbuf |= c << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static inline bool truncated(const struct inflate_state *s)
+{
+	return s->overrun > sizeof(s->bitbuf);
+}
+
+/*
+ * Drop output the caller does not need any more, keeping the last
+ * MAXDIST bytes for back references. This only happens if it frees at
+ * least half of the buffer, so the data is not moved around too often.
+ */
+static void slide(struct inflate_state *s)
+{
+	size_t shift = s->discard - s->base;
+
+	if (!s->enough || s->discard <= s->base || s->outpos <= MAXDIST)
+		return;
+
+	if (shift > s->outpos - MAXDIST)
+		shift = s->outpos - MAXDIST;
+	if (shift < s->outsize / 2)
+		return;
+
+	memmove(s->out, s->out + shift, s->outpos - shift);
+	s->base += shift;
+	s->outpos -= shift;
+	s->outmax -= shift;
+	s->check -= shift;
+}
+
+/*
+ * Make room for n more bytes of output. The buffer grows with the data
+ * actually inflated, up to the size announced in the trailer.
+ */
+static int reserve(struct inflate_state *s, size_t n)
+{
+	size_t size = s->outsize;
+	unsigned char *out;
+
+	if (n <= s->outsize - s->outpos)
+		return 0;
+
+	slide(s);
+	if (n <= s->outsize - s->outpos)
+		return 0;
+
+	if (n > s->outmax - s->outpos)
+		return -1;
+
+	while (size - s->outpos < n)
+		size *= 2;
+	if (size > s->outmax)
+		size = s->outmax;
+
+	out = realloc(s->out, size);
+	if (!out)
+		return -1;
+
+	s->out = out;
+	s->outsize = size;
+
+	return 0;
+}
+
+static inline void dropbits(struct inflate_state *s, int n)
+{
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+}
+
+static inline uint32_t getbits(struct inflate_state *s, int n)
+{
+	uint32_t val;
+
+	refill(s);
+	val = s->bitbuf & ((1U << n) - 1);
+	dropbits(s, n);
+
+	return val;
+}
+
+/*
+ * Build the decoding tables for the given code lengths. Returns zero for
+ * a complete code, a positive value for an incomplete one and a negative
+ * value if the lengths are over-subscribed.
+ */
+static int build(struct huffman *h, const unsigned char *length, int n)
+{
+	uint16_t offs[MAXBITS + 1];
+	unsigned int code, rev, fill;
+	int left, len, sym, index, i;
+
+	for (len = 0; len <= MAXBITS; len++)
+		h->count[len] = 0;
+	for (sym = 0; sym < n; sym++)
+		h->count[length[sym]]++;
+
+	left = 1;
+	for (len = 1; len <= MAXBITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return left;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < MAXBITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+
+	for (sym = 0; sym < n; sym++)
+		if (length[sym] != 0)
+			h->symbol[offs[length[sym]]++] = sym;
+
+	memset(h->fast, 0, sizeof(h->fast));
+
+	/* deflate sends the codes starting with their most significant bit */
+	code = 0;
+	index = 0;
+	for (len = 1; len <= FASTBITS; len++) {
+		for (i = 0; i < h->count[len]; i++, index++, code++) {
+			rev = 0;
+			for (fill = 0; fill < len; fill++)
+				rev |= ((code >> fill) & 1) << (len - 1 - fill);
+
+			for (fill = rev; fill < (1 << FASTBITS); fill += 1 << len)
+				h->fast[fill] = (len << 9) | h->symbol[index];
+		}
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int decode(struct inflate_state *s, const struct huffman *h)
+{
+	int code, first, count, index, len;
+	unsigned int entry;
+
+	refill(s);
+
+	entry = h->fast[s->bitbuf & ((1 << FASTBITS) - 1)];
+	if (entry != 0) {
+		dropbits(s, entry >> 9);
+		return entry & 0x1ff;
+	}
+
+	/* code is longer than FASTBITS, walk the canonical code */
+	code = first = index = 0;
+	for (len = 1; len <= MAXBITS; len++) {
+		code |= s->bitbuf & 1;
+		dropbits(s, 1);
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static int stored(struct inflate_state *s)
+{
+	size_t len, nlen;
+
+	/* go back to the byte boundary and hand unused bytes back */
+	dropbits(s, s->bitcnt & 7);
+	if (s->overrun > (size_t) (s->bitcnt >> 3))
+		return -1;
+	s->in -= (s->bitcnt >> 3) - s->overrun;
+	s->overrun = 0;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+
+	if (s->in + 4 > s->inend)
+		return -1;
+
+	len = s->in[0] | (s->in[1] << 8);
+	nlen = s->in[2] | (s->in[3] << 8);
+	s->in += 4;
+
+	if (len != (~nlen & 0xffff) ||
+	    len > (size_t) (s->inend - s->in) ||
+	    reserve(s, len))
+		return -1;
+
+	memcpy(s->out + s->outpos, s->in, len);
+	s->outpos += len;
+	s->in += len;
+
+	if (s->outpos >= s->check && s->enough(s))
+		return 1;
+
+	return 0;
+}
+
+static int codes(struct inflate_state *s)
+{
+	unsigned char *out = s->out;
+	size_t pos = s->outpos;
+	size_t dist;
+	unsigned int len;
+	int sym;
+
+	for (;;) {
+		if (pos >= s->check) {
+			s->outpos = pos;
+			if (s->enough(s))
+				return 1;
+		}
+
+		sym = decode(s, &s->lencode);
+		if (sym < 0 || truncated(s))
+			return -1;
+
+		if (sym < 256) {
+			if (pos >= s->outsize) {
+				s->outpos = pos;
+				if (reserve(s, 1))
+					return -1;
+				out = s->out;
+				pos = s->outpos;
+			}
+			out[pos++] = sym;
+			continue;
+		}
+
+		if (sym == 256)
+			break;
+
+		sym -= 257;
+		if (sym >= 29)
+			return -1;
+		len = len_base[sym] + getbits(s, len_extra[sym]);
+
+		sym = decode(s, &s->distcode);
+		if (sym < 0 || sym >= 30)
+			return -1;
+		dist = dist_base[sym] + getbits(s, dist_extra[sym]);
+
+		if (dist > pos)
+			return -1;
+
+		if (len > s->outsize - pos) {
+			s->outpos = pos;
+			if (reserve(s, len))
+				return -1;
+			out = s->out;
+			pos = s->outpos;
+		}
+
+		/* the areas may overlap, so this has to go byte by byte */
+		while (len--) {
+			out[pos] = out[pos - dist];
+			pos++;
+		}
+	}
+
+	s->outpos = pos;
+	return 0;
+}
+
+static int fixed(struct inflate_state *s)
+{
+	unsigned char lengths[MAXLCODES];
+	int sym;
+
+	for (sym = 0; sym < 144; sym++)
+		lengths[sym] = 8;
+	for (; sym < 256; sym++)
+		lengths[sym] = 9;
+	for (; sym < 280; sym++)
+		lengths[sym] = 7;
+	for (; sym < MAXLCODES; sym++)
+		lengths[sym] = 8;
+	build(&s->lencode, lengths, MAXLCODES);
+
+	for (sym = 0; sym < MAXDCODES; sym++)
+		lengths[sym] = 5;
+	build(&s->distcode, lengths, MAXDCODES);
+
+	return codes(s);
+}
+
+static int dynamic(struct inflate_state *s)
+{
+	unsigned char lengths[MAXLCODES + MAXDCODES];
+	int nlen, ndist, ncode;
+	int index, sym, len, err;
+
+	nlen = getbits(s, 5) + 257;
+	ndist = getbits(s, 5) + 1;
+	ncode = getbits(s, 4) + 4;
+	if (nlen > MAXLCODES || ndist > MAXDCODES)
+		return -1;
+
+	for (index = 0; index < ncode; index++)
+		lengths[clen_order[index]] = getbits(s, 3);
+	for (; index < 19; index++)
+		lengths[clen_order[index]] = 0;
+
+	if (build(&s->lencode, lengths, 19) != 0)
+		return -1;
+
+	index = 0;
+	while (index < nlen + ndist) {
+		sym = decode(s, &s->lencode);
+		if (sym < 0)
+			return -1;
+
+		if (sym < 16) {
+			lengths[index++] = sym;
+			continue;
+		}
+
+		len = 0;
+		if (sym == 16) {
+			if (index == 0)
+				return -1;
+			len = lengths[index - 1];
+			sym = 3 + getbits(s, 2);
+		} else if (sym == 17) {
+			sym = 3 + getbits(s, 3);
+		} else {
+			sym = 11 + getbits(s, 7);
+		}
+
+		if (index + sym > nlen + ndist)
+			return -1;
+		while (sym--)
+			lengths[index++] = len;
+	}
+
+	if (lengths[256] == 0)
+		return -1;
+
+	/* only a single code may be left incomplete */
+	err = build(&s->lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - s->lencode.count[0] != 1))
+		return -1;
+
+	err = build(&s->distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - s->distcode.count[0] != 1))
+		return -1;
+
+	return codes(s);
+}
+
+/*
+ * Decompress a gzip member, the caller has to free the result. The ISIZE
+ * field of the trailer only limits the output, the buffer grows with the
+ * data so a damaged trailer cannot make it allocate gigabytes.
+ *
+ * If enough() is given, inflating ends as soon as it returns nonzero. The
+ * result then only holds the output enough() asked to keep, enough() is
+ * expected to point into it.
+ */
+static unsigned char *gunzip(const unsigned char *in, size_t inlen,
+			     size_t *outlen,
+			     int (*enough)(struct inflate_state *s),
+			     void *priv)
+{
+	struct inflate_state s;
+	const unsigned char *p, *end;
+	int last, type, flags, ret;
+	uint32_t isize;
+
+	/* 10 bytes of header, 8 bytes of trailer */
+	if (inlen < 18 || in[0] != 0x1f || in[1] != 0x8b || in[2] != 8)
+		return NULL;
+
+	flags = in[3];
+	p = in + 10;
+	end = in + inlen - 8;
+
+	if (flags & GZIP_FEXTRA)
+		p += 2 + (p[0] | (p[1] << 8));
+	if (flags & GZIP_FNAME)
+		while (p < end && *p++);
+	if (flags & GZIP_FCOMMENT)
+		while (p < end && *p++);
+	if (flags & GZIP_FHCRC)
+		p += 2;
+
+	if (p >= end)
+		return NULL;
+
+	isize = end[4] | (end[5] << 8) | (end[6] << 16) |
+		((uint32_t) end[7] << 24);
+	if (isize / MAXRATIO > (size_t) (end - p))
+		return NULL;
+
+	s.in = p;
+	s.inend = end;
+	s.overrun = 0;
+	s.bitbuf = 0;
+	s.bitcnt = 0;
+	s.outpos = 0;
+	s.outmax = isize;
+	s.enough = enough;
+	s.priv = priv;
+	s.check = enough ? 0 : SIZE_MAX;
+	s.discard = 0;
+	s.base = 0;
+
+	/* a prefix is usually small, a whole member about 4 times the input */
+	s.outsize = enough ? 16384 : 4 * (size_t) (end - p);
+	if (s.outsize < 4096)
+		s.outsize = 4096;
+	if (s.outsize > s.outmax)
+		s.outsize = s.outmax;
+	s.out = malloc(s.outsize + 1);
+
+	if (!s.out)
+		return NULL;
+
+	do {
+		last = getbits(&s, 1);
+		type = getbits(&s, 2);
+
+		switch (type) {
+		case 0:
+			ret = stored(&s);
+			break;
+		case 1:
+			ret = fixed(&s);
+			break;
+		case 2:
+			ret = dynamic(&s);
+			break;
+		default:
+			ret = -1;
+		}
+	} while (!ret && !last && !truncated(&s));
+
+	if (ret > 0) {
+		*outlen = s.outpos;
+		return s.out;
+	}
+
+	/* the zero bytes fed in past the end must not have been used */
+	if (ret || !last || s.outpos != s.outmax ||
+	    s.overrun > (size_t) (s.bitcnt >> 3)) {
+		free(s.out);
+		return NULL;
+	}
+
+	/* the last bytes may have completed what enough() waits for */
+	if (enough)
+		enough(&s);
+
+	*outlen = s.outpos;
+	return s.out;
+}
+
+
+static uint64_t tar_size(const unsigned char *hdr)
+{
+	uint64_t size = 0;
+	int i;
+
+	/* GNU tar stores large sizes in base-256 */
+	if (hdr[124] & 0x80) {
+		for (i = 128; i < 136; i++)
+			size = (size << 8) | hdr[i];
+		return size;
+	}
+
+	for (i = 124; i < 136 && hdr[i] >= '0' && hdr[i] <= '7'; i++)
+		size = (size << 3) | (hdr[i] - '0');
+
+	return size;
+}
+
+static bool tar_name_match(const unsigned char *hdr, const char *name)
+{
+	const char *n = (const char *) hdr;
+
+	if (!strncmp(n, "./", 2))
+		n += 2;
+
+	return !strncmp(n, name, 100) && strlen(name) < 100;
+}
+
+/*
+ * Find a regular file member in a tar archive, ignoring a leading "./"
+ * in the stored name.
+ */
+static const unsigned char *tar_find(const unsigned char *tar, size_t len,
+				     const char *name, size_t *size)
+{
+	const unsigned char *hdr;
+	size_t pos = 0;
+	uint64_t n;
+
+	while (pos + TAR_BLOCK <= len) {
+		hdr = tar + pos;
+		if (!hdr[0])
+			break;
+
+		n = tar_size(hdr);
+		pos += TAR_BLOCK;
+
+		if (n > len - pos)
+			break;
+
+		if ((hdr[156] == '0' || hdr[156] == 0) &&
+		    tar_name_match(hdr, name)) {
+			*size = n;
+			return tar + pos;
+		}
+
+		pos += (n + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1);
+	}
+
+	return NULL;
+}
+
+struct tar_scan {
+	const char *name;
+	size_t pos;
+	size_t size;
+	bool found;
+	const unsigned char *data;
+};
+
+/*
+ * gunzip() callback that walks the tar headers as they are inflated and
+ * stops once the member it looks for is complete, or cannot show up.
+ * Offsets are absolute, only the member itself has to be kept.
+ */
+static int tar_scan(struct inflate_state *s)
+{
+	struct tar_scan *t = s->priv;
+	size_t end = s->base + s->outpos;
+	size_t max = s->base + s->outmax;
+	const unsigned char *hdr;
+	uint64_t n;
+
+	while (!t->found) {
+		if (t->pos + TAR_BLOCK > end)
+			goto more;
+
+		hdr = s->out + (t->pos - s->base);
+		if (!hdr[0])
+			return 1;
+
+		n = tar_size(hdr);
+		t->pos += TAR_BLOCK;
+
+		if (n > max - t->pos)
+			return 1;
+
+		if ((hdr[156] == '0' || hdr[156] == 0) &&
+		    tar_name_match(hdr, t->name)) {
+			t->size = n;
+			t->found = true;
+			break;
+		}
+
+		t->pos += (n + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1);
+		if (t->pos > max)
+			return 1;
+	}
+
+	if (t->size > end - t->pos)
+		goto more;
+
+	t->data = s->out + (t->pos - s->base);
+	return 1;
+
+more:
+	s->check = t->pos + (t->found ? t->size : TAR_BLOCK) - s->base;
+	s->discard = t->pos;
+	return 0;
+}
+
+
+struct package {
+	char *path;
+	char *entry;
+	size_t entry_len;
+	struct cache_entry cached;
+	int ret;
+};
+
+static struct {
+	struct package *pkgs;
+	unsigned int n_pkgs;
+	unsigned int next;
+} index_queue;
+
+/*
+ * Build the index entry, which is the control file with Filename, Size
+ * and SHA256sum inserted in front of the Description field.
+ */
+static int package_entry(struct package *pkg, const char *control,
+			 size_t len, uint64_t size, const char *sha256)
+{
+	const char *filename = pkg->path;
+	const char *p, *end = control + len;
+	char *out;
+	size_t extra;
+
+	if (!strncmp(filename, "./", 2))
+		filename += 2;
+
+	extra = strlen(filename) + strlen(sha256) + 64;
+	out = malloc(len + extra + 2);
+	if (!out)
+		return -1;
+
+	pkg->entry = out;
+
+	for (p = control; p < end; ) {
+		const char *eol = memchr(p, '\n', end - p);
+		size_t n = eol ? eol + 1 - p : end - p;
+
+		if (n >= 12 && !memcmp(p, "Description:", 12) && extra) {
+			out += sprintf(out, "Filename: %s\nSize: %llu\n"
+				       "SHA256sum: %s\n", filename,
+				       (unsigned long long) size, sha256);
+			extra = 0;
+		}
+
+		memcpy(out, p, n);
+		out += n;
+		p += n;
+	}
+
+	*out++ = '\n';
+	pkg->entry_len = out - pkg->entry;
+
+	return 0;
+}
+
+static int package_index(struct package *pkg)
+{
+	struct hash_type *t = get_hash_type("sha256");
+	unsigned char *outer = NULL, *inner = NULL;
+	const unsigned char *member;
+	char sha256[HASH_STR_LEN];
+	const struct cache_entry *e;
+	struct tar_scan scan = { .name = "control.tar.gz" };
+	size_t outer_len, inner_len, member_len;
+	struct stat st;
+	void *map;
+	int fd, ret = -1;
+
+	fd = open(pkg->path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		fprintf(stderr, "Failed to open '%s'\n", pkg->path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map '%s'\n", pkg->path);
+		return -1;
+	}
+
+	if ((e = cache_lookup(t, &st)) != NULL) {
+		strcpy(sha256, e->str);
+		cache_entry_set(&pkg->cached, t, &st, sha256, e);
+	} else {
+		union hash_ctx ctx;
+		unsigned char val[SHA256_DIGEST_LENGTH];
+
+		t->init(&ctx);
+		t->update(&ctx, map, st.st_size);
+		t->final(val, &ctx);
+		hash_string(val, t->len, sha256);
+
+		cache_entry_set(&pkg->cached, t, &st, sha256, NULL);
+	}
+
+	outer = gunzip(map, st.st_size, &outer_len, tar_scan, &scan);
+	if (!outer || !scan.data)
+		goto out;
+
+	inner = gunzip(scan.data, scan.size, &inner_len, NULL, NULL);
+	if (!inner)
+		goto out;
+
+	member = tar_find(inner, inner_len, "control", &member_len);
+	if (!member)
+		goto out;
+
+	ret = package_entry(pkg, (const char *) member, member_len,
+			    st.st_size, sha256);
+
+out:
+	if (ret)
+		fprintf(stderr, "Failed to read control file of '%s'\n",
+			pkg->path);
+
+	free(inner);
+	free(outer);
+	munmap(map, st.st_size);
+
+	return ret;
+}
+
+static void *index_worker(void *arg)
+{
+	unsigned int i;
+
+	while ((i = __sync_fetch_and_add(&index_queue.next, 1)) <
+	       index_queue.n_pkgs) {
+		struct package *pkg = &index_queue.pkgs[i];
+
+		pkg->ret = package_index(pkg);
+	}
+
+	return NULL;
+}
+
+
+static bool package_skip(const char *name)
+{
+	size_t len = strcspn(name, "_");
+
+	return (len == 6 && !strncmp(name, "kernel", 6)) ||
+	       (len == 4 && !strncmp(name, "libc", 4));
+}
+
+static int add_package(const char *path)
+{
+	static unsigned int size;
+	struct package *pkgs;
+
+	if (index_queue.n_pkgs == size) {
+		size = size ? size * 2 : 256;
+		pkgs = realloc(index_queue.pkgs, size * sizeof(*pkgs));
+		if (!pkgs)
+			return -1;
+		index_queue.pkgs = pkgs;
+	}
+
+	pkgs = &index_queue.pkgs[index_queue.n_pkgs++];
+	memset(pkgs, 0, sizeof(*pkgs));
+	pkgs->path = strdup(path);
+
+	return pkgs->path ? 0 : -1;
+}
+
+/* Collect *.ipk like find(1) would, without following directory links */
+static int scan_dir(const char *dir)
+{
+	struct dirent *de;
+	struct stat st;
+	size_t len = strlen(dir);
+	char *path;
+	int ret = 0;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return -1;
+
+	while (!ret && (de = readdir(d)) != NULL) {
+		size_t n = strlen(de->d_name);
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		path = malloc(len + n + 2);
+		if (!path) {
+			ret = -1;
+			break;
+		}
+
+		sprintf(path, "%s%s%s", dir,
+			(len && dir[len - 1] == '/') ? "" : "/", de->d_name);
+
+		if (lstat(path, &st)) {
+			free(path);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode))
+			ret = scan_dir(path);
+		else if (n > 4 && !strcmp(de->d_name + n - 4, ".ipk") &&
+			 !package_skip(de->d_name))
+			ret = add_package(path);
+
+		free(path);
+	}
+
+	closedir(d);
+
+	return ret;
+}
+
+static int package_cmp(const void *a, const void *b)
+{
+	const struct package *pa = a, *pb = b;
+
+	return strcmp(pa->path, pb->path);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *cache_path = getenv("MKHASH_CACHE");
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct cache_entry *added;
+	unsigned int i, n_added = 0;
+	pthread_t *threads;
+	struct stat st;
+	int ch, ret = 0;
+
+	while ((ch = getopt(argc, argv, "j:")) != -1) {
+		switch (ch) {
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind + 1 != argc || stat(argv[optind], &st) ||
+	    !S_ISDIR(st.st_mode))
+		goto usage;
+
+	if (scan_dir(argv[optind])) {
+		fprintf(stderr, "Failed to scan '%s'\n", argv[optind]);
+		return 1;
+	}
+
+	if (!index_queue.n_pkgs) {
+		printf("\n");
+		return 0;
+	}
+
+	qsort(index_queue.pkgs, index_queue.n_pkgs, sizeof(struct package),
+	      package_cmp);
+
+	if (cache_path && *cache_path)
+		cache_load(cache_path);
+
+	if (n_threads < 1)
+		n_threads = 1;
+	if (n_threads > index_queue.n_pkgs)
+		n_threads = index_queue.n_pkgs;
+
+	threads = calloc(n_threads, sizeof(*threads));
+	for (i = 1; threads && i < n_threads; i++)
+		if (pthread_create(&threads[i], NULL, index_worker, NULL))
+			break;
+
+	n_threads = i;
+	index_worker(NULL);
+
+	for (i = 1; threads && i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+
+	added = calloc(index_queue.n_pkgs, sizeof(*added));
+
+	for (i = 0; i < index_queue.n_pkgs; i++) {
+		struct package *pkg = &index_queue.pkgs[i];
+
+		if (pkg->ret) {
+			ret = 1;
+		} else {
+			fprintf(stderr, "Generating index for package %s\n",
+				pkg->path);
+			fwrite(pkg->entry, 1, pkg->entry_len, stdout);
+		}
+
+		if (pkg->cached.type && added) {
+			cache_add(&pkg->cached);
+			added[n_added++] = pkg->cached;
+		}
+
+		free(pkg->entry);
+		free(pkg->path);
+	}
+
+	if (cache.path)
+		cache_save(added, n_added);
+
+	free(added);
+	free(index_queue.pkgs);
+
+	return ret;
+
+usage:
+	fprintf(stderr, "Usage: %s [-j <jobs>] <package_directory>\n", argv[0]);
+	return 1;
+}
@@ -8,6 +8,11 @@ if [ -z $pkg_dir ] || [ ! -d $pkg_dir ]; then
 	exit 1
 fi
 
+# Use the native indexer built during prereq if available
+if [ -x "$STAGING_DIR_HOST/bin/ipkg-make-index" ]; then
+	exec "$STAGING_DIR_HOST/bin/ipkg-make-index" "$pkg_dir"
+fi
+
 empty=1
 
 for pkg in `find $pkg_dir -name '*.ipk' | sort`; do
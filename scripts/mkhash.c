@@ -79,13 +79,25 @@
 
 
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_ctim st_ctimespec
+#endif
+
 #define ARRAY_SIZE(_n) (sizeof(_n) / sizeof((_n)[0]))
 
 static void
@@ -666,139 +678,592 @@ SHA256_Final(unsigned char digest[static SHA256_DIGEST_LENGTH], SHA256_CTX *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
-static void *hash_buf(FILE *f, int *len)
-{
-	static char buf[1024];
+#define HASH_BUF_SIZE	(64 * 1024)
+#define HASH_STR_LEN	(SHA256_DIGEST_LENGTH * 2 + 1)
 
-	*len = fread(buf, 1, sizeof(buf), f);
+union hash_ctx {
+	MD5_CTX md5;
+	SHA256_CTX sha256;
+};
 
-	return *len > 0 ? buf : NULL;
+static void md5_init(union hash_ctx *ctx)
+{
+	MD5_begin(&ctx->md5);
 }
 
-static char *hash_string(unsigned char *buf, int len)
+static void md5_update(union hash_ctx *ctx, const void *data, size_t len)
 {
-	static char str[SHA256_DIGEST_LENGTH * 2 + 1];
-	int i;
+	MD5_hash(data, len, &ctx->md5);
+}
 
-	if (len * 2 + 1 > sizeof(str))
-		return NULL;
+static void md5_final(unsigned char *val, union hash_ctx *ctx)
+{
+	MD5_end(val, &ctx->md5);
+}
 
-	for (i = 0; i < len; i++)
-		sprintf(&str[i * 2], "%02x", buf[i]);
+static void sha256_init(union hash_ctx *ctx)
+{
+	SHA256_Init(&ctx->sha256);
+}
 
-	return str;
+static void sha256_update(union hash_ctx *ctx, const void *data, size_t len)
+{
+	SHA256_Update(&ctx->sha256, data, len);
 }
 
-static const char *md5_hash(FILE *f)
+static void sha256_final(unsigned char *val, union hash_ctx *ctx)
 {
-	MD5_CTX ctx;
-	unsigned char val[MD5_DIGEST_LENGTH];
-	void *buf;
+	SHA256_Final(val, &ctx->sha256);
+}
+
+
+struct hash_type {
+	const char *name;
+	void (*init)(union hash_ctx *ctx);
+	void (*update)(union hash_ctx *ctx, const void *data, size_t len);
+	void (*final)(unsigned char *val, union hash_ctx *ctx);
 	int len;
+};
+
+struct hash_type types[] = {
+	{ "md5", md5_init, md5_update, md5_final, MD5_DIGEST_LENGTH },
+	{ "sha256", sha256_init, sha256_update, sha256_final, SHA256_DIGEST_LENGTH },
+};
+
+
+/* hash types are looked up by name for the command line and the cache */
+#ifndef MKHASH_NO_CACHE
+static struct hash_type *get_hash_type(const char *name)
+{
+	int i;
 
-	MD5_begin(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
-		MD5_hash(buf, len, &ctx);
-	MD5_end(val, &ctx);
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		struct hash_type *t = &types[i];
 
-	return hash_string(val, MD5_DIGEST_LENGTH);
+		if (!strcmp(t->name, name))
+			return t;
+	}
+	return NULL;
 }
+#endif
+
 
-static const char *sha256_hash(FILE *f)
+static void hash_string(unsigned char *buf, int len, char *str)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		sprintf(&str[i * 2], "%02x", buf[i]);
+}
+
+#ifndef MKHASH_NO_MAIN
+
+/*
+ * Regular files are mapped and hashed in one go, everything else (pipes,
+ * short reads from a file that is being written) goes through a large
+ * read buffer.
+ */
+static int hash_fd(struct hash_type *t, int fd, const struct stat *st,
+		   char *str)
 {
-	SHA256_CTX ctx;
 	unsigned char val[SHA256_DIGEST_LENGTH];
+	union hash_ctx ctx;
+	ssize_t len;
 	void *buf;
-	int len;
 
-	SHA256_Init(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
-		SHA256_Update(&ctx, buf, len);
-	SHA256_Final(val, &ctx);
+	t->init(&ctx);
+
+	if (st && S_ISREG(st->st_mode) && st->st_size > 0 &&
+	    (uint64_t) st->st_size < SIZE_MAX) {
+		buf = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf != MAP_FAILED) {
+			madvise(buf, st->st_size, MADV_SEQUENTIAL);
+			t->update(&ctx, buf, st->st_size);
+			munmap(buf, st->st_size);
+			goto out;
+		}
+	}
+
+	buf = malloc(HASH_BUF_SIZE);
+	if (!buf)
+		return -1;
+
+	while ((len = read(fd, buf, HASH_BUF_SIZE)) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -1;
+		}
+		t->update(&ctx, buf, len);
+	}
 
-	return hash_string(val, SHA256_DIGEST_LENGTH);
+	free(buf);
+
+out:
+	t->final(val, &ctx);
+	hash_string(val, t->len, str);
+	return 0;
 }
 
+#endif /* MKHASH_NO_MAIN */
 
-struct hash_type {
-	const char *name;
-	const char *(*func)(FILE *f);
-	int len;
-};
+static uint64_t stat_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
 
-struct hash_type types[] = {
-	{ "md5", md5_hash, MD5_DIGEST_LENGTH },
-	{ "sha256", sha256_hash, SHA256_DIGEST_LENGTH },
+#ifndef MKHASH_NO_CACHE
+
+/*
+ * Persistent cache of file hashes, enabled with -c <file> or through the
+ * MKHASH_CACHE environment variable. Entries are keyed by hash type,
+ * device and inode and are only valid while size, mtime and ctime match.
+ * Each line reads:
+ *   <type> <dev> <ino> <size> <mtime ns> <ctime ns> <hash> <last used>
+ *
+ * New entries are appended with a single write, so concurrent mkhash
+ * invocations sharing a cache do not corrupt it. An entry that is hit
+ * more than a day after it was last written is appended again with the
+ * new time, entries of files that are gone stop being hit and expire
+ * after CACHE_MAX_AGE. Once more than half of the lines are superseded
+ * or expired the file is rewritten.
+ */
+#define CACHE_DAY	(24 * 60 * 60)
+#define CACHE_MAX_AGE	(30 * CACHE_DAY)
+
+struct cache_entry {
+	uint64_t dev, ino, size, mtime, ctime;
+	uint64_t used;
+	struct hash_type *type;
+	char str[HASH_STR_LEN];
 };
 
+static struct {
+	const char *path;
+	struct cache_entry *entries;
+	unsigned int size, used, stale;
+	time_t start;
+} cache;
 
-static int usage(const char *progname)
+static struct cache_entry *cache_slot(struct hash_type *t, uint64_t dev,
+				      uint64_t ino)
 {
-	int i;
+	struct cache_entry *e;
+	unsigned int i;
+
+	i = (ino * 0x9e3779b97f4a7c15ULL ^ dev) >> 32;
+	for (;; i++) {
+		e = &cache.entries[i & (cache.size - 1)];
+		if (!e->type ||
+		    (e->type == t && e->dev == dev && e->ino == ino))
+			return e;
+	}
+}
 
-	fprintf(stderr, "Usage: %s <hash type> [<file>...]\n"
-		"Supported hash types:", progname);
+static void cache_add(struct cache_entry *n);
 
-	for (i = 0; i < ARRAY_SIZE(types); i++)
-		fprintf(stderr, "%s %s", i ? "," : "", types[i].name);
+static void cache_grow(void)
+{
+	struct cache_entry *old = cache.entries;
+	unsigned int i, size = cache.size;
 
-	fprintf(stderr, "\n");
-	return 1;
+	cache.size = size ? size * 2 : 1024;
+	cache.entries = calloc(cache.size, sizeof(*cache.entries));
+	cache.used = 0;
+
+	if (!cache.entries) {
+		cache.entries = old;
+		cache.size = size;
+		return;
+	}
+
+	for (i = 0; i < size; i++)
+		if (old[i].type)
+			cache_add(&old[i]);
+
+	free(old);
 }
 
-static struct hash_type *get_hash_type(const char *name)
+static void cache_add(struct cache_entry *n)
 {
-	int i;
+	struct cache_entry *e;
 
-	for (i = 0; i < ARRAY_SIZE(types); i++) {
-		struct hash_type *t = &types[i];
+	if ((cache.used + 1) * 2 > cache.size)
+		cache_grow();
 
-		if (!strcmp(t->name, name))
-			return t;
+	if ((cache.used + 1) * 2 > cache.size)
+		return;
+
+	e = cache_slot(n->type, n->dev, n->ino);
+	if (e->type)
+		cache.stale++;
+	else
+		cache.used++;
+
+	*e = *n;
+}
+
+static const struct cache_entry *cache_lookup(struct hash_type *t,
+					      const struct stat *st)
+{
+	struct cache_entry *e;
+
+	if (!cache.size)
+		return NULL;
+
+	e = cache_slot(t, st->st_dev, st->st_ino);
+	if (!e->type || e->size != st->st_size ||
+	    e->mtime != stat_ns(&st->st_mtim) ||
+	    e->ctime != stat_ns(&st->st_ctim))
+		return NULL;
+
+	return e;
+}
+
+/*
+ * Fill in a new entry for a file hashed in this run, or for a hit that
+ * has to be written out again to keep it from expiring. Returns false if
+ * there is nothing to save. A file modified within the timestamp
+ * granularity after it was hashed would go unnoticed, so recently
+ * changed files are not cached.
+ */
+static bool cache_entry_set(struct cache_entry *e, struct hash_type *t,
+			    const struct stat *st, const char *str,
+			    const struct cache_entry *hit)
+{
+	if (!cache.path || !S_ISREG(st->st_mode))
+		return false;
+
+	if (hit) {
+		if (hit->used + CACHE_DAY >= (uint64_t) cache.start)
+			return false;
+	} else if (st->st_ctim.tv_sec >= cache.start - 1) {
+		return false;
 	}
-	return NULL;
+
+	e->type = t;
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = stat_ns(&st->st_mtim);
+	e->ctime = stat_ns(&st->st_ctim);
+	e->used = cache.start;
+	strcpy(e->str, str);
+
+	return true;
 }
 
+static void cache_load(const char *path)
+{
+	unsigned long long dev, ino, size, mtime, ctime, used;
+	struct cache_entry e;
+	char type[16], str[HASH_STR_LEN];
+	char line[256];
+	unsigned int i;
+	int n;
+	FILE *f;
+
+	cache.path = path;
+	cache.start = time(NULL);
+
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		n = sscanf(line, "%15s %llu %llu %llu %llu %llu %64s %llu", type,
+			   &dev, &ino, &size, &mtime, &ctime, str, &used);
+		if (n < 7)
+			continue;
+
+		/* lines without a time predate expiry, give them a full term */
+		if (n < 8)
+			used = cache.start;
+
+		if (used + CACHE_MAX_AGE < (unsigned long long) cache.start) {
+			cache.stale++;
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(types); i++)
+			if (!strcmp(types[i].name, type))
+				break;
+
+		if (i == ARRAY_SIZE(types) ||
+		    strlen(str) != types[i].len * 2)
+			continue;
+
+		e.type = &types[i];
+		e.dev = dev;
+		e.ino = ino;
+		e.size = size;
+		e.mtime = mtime;
+		e.ctime = ctime;
+		e.used = used;
+		strcpy(e.str, str);
+		cache_add(&e);
+	}
 
-static int hash_file(struct hash_type *t, const char *filename, bool add_filename)
+	fclose(f);
+}
+
+static int cache_format(char *buf, const struct cache_entry *e)
 {
-	const char *str;
+	return sprintf(buf, "%s %llu %llu %llu %llu %llu %s %llu\n",
+		       e->type->name,
+		       (unsigned long long) e->dev, (unsigned long long) e->ino,
+		       (unsigned long long) e->size,
+		       (unsigned long long) e->mtime,
+		       (unsigned long long) e->ctime, e->str,
+		       (unsigned long long) e->used);
+}
 
-	if (!filename || !strcmp(filename, "-")) {
-		str = t->func(stdin);
-	} else {
-		FILE *f = fopen(filename, "r");
+static void cache_write(const char *path, struct cache_entry *entries,
+			unsigned int n, bool append)
+{
+	char *buf, *p;
+	unsigned int i;
+	int fd;
+
+	buf = malloc((size_t) n * 216 + 1);
+	if (!buf)
+		return;
+
+	for (p = buf, i = 0; i < n; i++)
+		if (entries[i].type)
+			p += cache_format(p, &entries[i]);
+
+	if (append)
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	else
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd >= 0) {
+		if (write(fd, buf, p - buf) != p - buf)
+			fprintf(stderr, "Failed to write hash cache '%s'\n", path);
+		close(fd);
+	}
+
+	free(buf);
+}
+
+static void cache_save(struct cache_entry *added, unsigned int n)
+{
+	char *tmp;
+
+	if (!n)
+		return;
+
+	if (cache.stale * 2 <= cache.used) {
+		cache_write(cache.path, added, n, true);
+		return;
+	}
+
+	tmp = malloc(strlen(cache.path) + 16);
+	if (!tmp)
+		return;
+
+	sprintf(tmp, "%s.%d", cache.path, (int) getpid());
 
-		if (!f) {
-			fprintf(stderr, "Failed to open '%s'\n", filename);
-			return 1;
+	cache_write(tmp, cache.entries, cache.size, false);
+	if (rename(tmp, cache.path))
+		unlink(tmp);
+
+	free(tmp);
+}
+
+#endif /* MKHASH_NO_CACHE */
+
+
+#ifndef MKHASH_NO_MAIN
+
+struct job {
+	const char *filename;
+	struct cache_entry entry;
+	char str[HASH_STR_LEN];
+	int ret;
+};
+
+static struct {
+	struct hash_type *type;
+	struct job *jobs;
+	unsigned int n_jobs;
+	unsigned int next;
+} queue;
+
+static int hash_file(struct hash_type *t, struct job *j)
+{
+	const struct cache_entry *e;
+	struct stat st;
+	int fd;
+
+	if (!j->filename || !strcmp(j->filename, "-")) {
+		if (hash_fd(t, 0, NULL, j->str)) {
+			fprintf(stderr, "Failed to generate hash\n");
+			return -1;
 		}
-		str = t->func(f);
-		fclose(f);
+		return 0;
 	}
 
-	if (!str) {
-		fprintf(stderr, "Failed to generate hash\n");
-		return 1;
+	fd = open(j->filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open '%s'\n", j->filename);
+		return -1;
 	}
 
-	if (add_filename)
-		printf("%s %s\n", str, filename ? filename : "-");
-	else
-		printf("%s\n", str);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (e = cache_lookup(t, &st)) != NULL) {
+		strcpy(j->str, e->str);
+		cache_entry_set(&j->entry, t, &st, e->str, e);
+		close(fd);
+		return 0;
+	}
+
+	if (hash_fd(t, fd, &st, j->str)) {
+		fprintf(stderr, "Failed to generate hash for '%s'\n",
+			j->filename);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	cache_entry_set(&j->entry, t, &st, j->str, NULL);
+
 	return 0;
 }
 
+static void *hash_worker(void *arg)
+{
+	unsigned int i;
+
+	while ((i = __sync_fetch_and_add(&queue.next, 1)) < queue.n_jobs) {
+		struct job *j = &queue.jobs[i];
+
+		j->ret = hash_file(queue.type, j);
+	}
+
+	return NULL;
+}
+
+static int hash_files(struct hash_type *t, char **files, unsigned int n,
+		      unsigned int n_threads, bool add_filename)
+{
+	struct cache_entry *added;
+	pthread_t *threads;
+	unsigned int i, n_added = 0;
+	int ret = 0;
+
+	queue.type = t;
+	queue.jobs = calloc(n ? n : 1, sizeof(*queue.jobs));
+	queue.n_jobs = n ? n : 1;
+	queue.next = 0;
+
+	if (!queue.jobs)
+		return 1;
+
+	for (i = 0; i < n; i++)
+		queue.jobs[i].filename = files[i];
+
+	if (n_threads > queue.n_jobs)
+		n_threads = queue.n_jobs;
+
+	threads = calloc(n_threads, sizeof(*threads));
+	for (i = 1; threads && i < n_threads; i++)
+		if (pthread_create(&threads[i], NULL, hash_worker, NULL))
+			break;
+
+	n_threads = i;
+	hash_worker(NULL);
+
+	for (i = 1; threads && i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+
+	added = calloc(queue.n_jobs, sizeof(*added));
+	for (i = 0; i < queue.n_jobs; i++) {
+		struct job *j = &queue.jobs[i];
+		const char *filename = j->filename ? j->filename : "-";
+
+		/* like before, only a failure on stdin changes the exit code */
+		if (j->ret) {
+			if (!n)
+				ret = 1;
+			continue;
+		}
+
+		if (add_filename)
+			printf("%s %s\n", j->str, filename);
+		else
+			printf("%s\n", j->str);
+
+		if (j->entry.type && added) {
+			cache_add(&j->entry);
+			added[n_added++] = j->entry;
+		}
+	}
+
+	if (cache.path)
+		cache_save(added, n_added);
+
+	free(added);
+	free(queue.jobs);
+
+	return ret;
+}
+
+
+/*
+ * Only regular files are ever cached, loading the cache for hashing stdin
+ * would just slow down the many "... | mkhash" calls of a build.
+ */
+static bool want_cache(char **files, unsigned int n)
+{
+	struct stat st;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (strcmp(files[i], "-") && !stat(files[i], &st) &&
+		    S_ISREG(st.st_mode))
+			return true;
+
+	return false;
+}
+
+static int usage(const char *progname)
+{
+	int i;
+
+	fprintf(stderr, "Usage: %s [-n] [-j <jobs>] [-c <cache>] <hash type> [<file>...]\n"
+		"Supported hash types:", progname);
+
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+		fprintf(stderr, "%s %s", i ? "," : "", types[i].name);
+
+	fprintf(stderr, "\n");
+	return 1;
+}
+
 
 int main(int argc, char **argv)
 {
 	struct hash_type *t;
 	const char *progname = argv[0];
-	int i, ch;
+	const char *cache_path = getenv("MKHASH_CACHE");
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int ch;
 	bool add_filename = false;
 
-	while ((ch = getopt(argc, argv, "n")) != -1) {
+	while ((ch = getopt(argc, argv, "c:j:n")) != -1) {
 		switch (ch) {
+		case 'c':
+			cache_path = optarg;
+			break;
+		case 'j':
+			n_threads = atoi(optarg);
+			break;
 		case 'n':
 			add_filename = true;
 			break;
@@ -817,11 +1282,13 @@ int main(int argc, char **argv)
 	if (!t)
 		return usage(progname);
 
-	if (argc < 2)
-		return hash_file(t, NULL, add_filename);
+	if (n_threads < 1)
+		n_threads = 1;
 
-	for (i = 0; i < argc - 1; i++)
-		hash_file(t, argv[1 + i], add_filename);
+	if (cache_path && *cache_path && want_cache(argv + 1, argc - 1))
+		cache_load(cache_path);
 
-	return 0;
+	return hash_files(t, argv + 1, argc - 1, n_threads, add_filename);
 }
+
+#endif /* MKHASH_NO_MAIN */
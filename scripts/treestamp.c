@@ -0,0 +1,650 @@
+/*
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Native replacement for scripts/timestamp.pl and for the find | mkhash md5
+ * pipeline used by include/depends.mk.
+ *
+ *   treestamp [-x <pattern>] [-f] [-n <name>|-p|-t|-F] <path>...
+ *	behaves like timestamp.pl, options apply to the paths following them
+ *
+ *   treestamp -m [-x <pattern>]... <path>...
+ *	prints the same digest as find <path>... -type f -and -not -path
+ *	<pattern>... | mkhash md5
+ *
+ * Directory listings are kept in a cache when -c <dir> or TREESTAMP_CACHE
+ * is given, one file per set of start directories. A listing is reused
+ * as long as the directory's inode, mtime and ctime are unchanged, so
+ * unchanged subtrees are walked without reading any directory. Files are
+ * still looked at individually for their mtime, since modifying a file in
+ * place does not touch its directory. Cache files not used for a month
+ * are removed, at most once a day.
+ */
+
+#define MKHASH_NO_MAIN
+#define MKHASH_NO_CACHE
+#include "mkhash.c"
+
+#include <sys/time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+
+#define MAX_PATTERNS	64
+
+#define CACHE_DAY	(24 * 60 * 60)
+#define CACHE_MAX_AGE	(30 * CACHE_DAY)
+
+struct listing {
+	char *path;
+	uint64_t dev, ino, mtime, ctime;
+	char *names;	/* type character followed by the name, NUL separated */
+	size_t len;
+	bool used;
+	struct listing *next;
+};
+
+static struct {
+	char *file;
+	struct listing *hash[4096];
+	time_t start;
+	time_t mtime;
+	bool dirty;
+} dcache;
+
+struct walk {
+	const char *patterns[MAX_PATTERNS];
+	int n_patterns;
+	bool follow;
+
+	/* -m: digest of the file list */
+	MD5_CTX md5;
+
+	/* timestamp mode: newest file */
+	time_t ts;
+	char *name;
+};
+
+static unsigned int path_hash(const char *path)
+{
+	unsigned int h = 5381;
+
+	while (*path)
+		h = h * 33 + (unsigned char) *path++;
+
+	return h % ARRAY_SIZE(dcache.hash);
+}
+
+static struct listing *listing_find(const char *path)
+{
+	struct listing *l;
+
+	for (l = dcache.hash[path_hash(path)]; l; l = l->next)
+		if (!strcmp(l->path, path))
+			return l;
+
+	return NULL;
+}
+
+static struct listing *listing_add(const char *path)
+{
+	struct listing *l = calloc(1, sizeof(*l));
+	unsigned int h = path_hash(path);
+
+	if (!l || !(l->path = strdup(path))) {
+		free(l);
+		return NULL;
+	}
+
+	l->next = dcache.hash[h];
+	dcache.hash[h] = l;
+
+	return l;
+}
+
+static char stat_type(const struct stat *st)
+{
+	if (S_ISDIR(st->st_mode))
+		return 'd';
+	if (S_ISREG(st->st_mode))
+		return 'f';
+	if (S_ISLNK(st->st_mode))
+		return 'l';
+	return 'o';
+}
+
+static char dirent_type(const struct dirent *de)
+{
+	switch (de->d_type) {
+	case DT_DIR:
+		return 'd';
+	case DT_REG:
+		return 'f';
+	case DT_LNK:
+		return 'l';
+	case DT_UNKNOWN:
+		return '?';
+	default:
+		return 'o';
+	}
+}
+
+static bool listing_valid(const struct listing *l, const struct stat *st)
+{
+	return l->dev == st->st_dev && l->ino == st->st_ino &&
+	       l->mtime == stat_ns(&st->st_mtim) &&
+	       l->ctime == stat_ns(&st->st_ctim);
+}
+
+/* Read a directory in readdir order, which is also the order find uses */
+static int listing_read(struct listing *l, const char *path,
+			const struct stat *st)
+{
+	struct dirent *de;
+	size_t size = 0, n;
+	char *names;
+	DIR *d;
+
+	free(l->names);
+	l->names = NULL;
+	l->len = 0;
+
+	d = opendir(path);
+	if (!d)
+		return -1;
+
+	while ((de = readdir(d)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		n = strlen(de->d_name) + 2;
+		if (l->len + n > size) {
+			size = (l->len + n) * 2;
+			names = realloc(l->names, size);
+			if (!names) {
+				closedir(d);
+				return -1;
+			}
+			l->names = names;
+		}
+
+		l->names[l->len] = dirent_type(de);
+		memcpy(l->names + l->len + 1, de->d_name, n - 1);
+		l->len += n;
+	}
+
+	closedir(d);
+
+	l->dev = st->st_dev;
+	l->ino = st->st_ino;
+	l->mtime = stat_ns(&st->st_mtim);
+	l->ctime = stat_ns(&st->st_ctim);
+
+	/*
+	 * A directory changed within the timestamp granularity after it was
+	 * read could go unnoticed, so such listings are not written out.
+	 */
+	if (dcache.file && st->st_ctim.tv_sec < dcache.start - 1 &&
+	    !strchr(path, '\n'))
+		dcache.dirty = true;
+	else
+		l->mtime = l->ctime = 0;
+
+	return 0;
+}
+
+static struct listing *listing_get(const char *path, const struct stat *st)
+{
+	struct listing *l = listing_find(path);
+
+	if (!l && !(l = listing_add(path)))
+		return NULL;
+
+	if (!l->names || !listing_valid(l, st)) {
+		if (listing_read(l, path, st))
+			return NULL;
+	}
+
+	l->used = true;
+
+	return l;
+}
+
+/*
+ * Remove the cache files of start directories that have not been walked
+ * for CACHE_MAX_AGE, along with temporary files left behind. The mtime of
+ * the .pruned stamp limits this to once a day.
+ */
+static void cache_prune(const char *dir, const char *key)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	struct stat st;
+	DIR *dp;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/.pruned", dir);
+	if (!stat(path, &st) && st.st_mtime > dcache.start - CACHE_DAY)
+		return;
+
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+
+	close(fd);
+	utimes(path, NULL);
+
+	dp = opendir(dir);
+	if (!dp)
+		return;
+
+	while ((d = readdir(dp)) != NULL) {
+		if (d->d_name[0] == '.' || !strcmp(d->d_name, key))
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", dir,
+			     d->d_name) >= (int) sizeof(path))
+			continue;
+
+		if (!lstat(path, &st) && S_ISREG(st.st_mode) &&
+		    st.st_mtime < dcache.start - CACHE_MAX_AGE)
+			unlink(path);
+	}
+
+	closedir(dp);
+}
+
+static void cache_open(const char *dir, int argc, char **argv)
+{
+	struct listing *l;
+	unsigned char val[MD5_DIGEST_LENGTH];
+	char key[MD5_DIGEST_LENGTH * 2 + 1], cwd[PATH_MAX];
+	unsigned long long dev, ino, mtime, ctime;
+	unsigned long len;
+	char line[PATH_MAX + 128];
+	struct stat st;
+	MD5_CTX ctx;
+	FILE *f;
+	int i, n;
+
+	dcache.start = time(NULL);
+
+	/* start directories, relative to the working directory */
+	MD5_begin(&ctx);
+	if (getcwd(cwd, sizeof(cwd)))
+		MD5_hash(cwd, strlen(cwd) + 1, &ctx);
+	for (i = 0; i < argc; i++)
+		if (argv[i][0] != '-' && !stat(argv[i], &st) &&
+		    S_ISDIR(st.st_mode))
+			MD5_hash(argv[i], strlen(argv[i]) + 1, &ctx);
+	MD5_end(val, &ctx);
+	hash_string(val, MD5_DIGEST_LENGTH, key);
+
+	mkdir(dir, 0755);
+	cache_prune(dir, key);
+
+	dcache.file = malloc(strlen(dir) + sizeof(key) + 2);
+	if (!dcache.file)
+		return;
+
+	sprintf(dcache.file, "%s/%s", dir, key);
+
+	f = fopen(dcache.file, "r");
+	if (!f)
+		return;
+
+	if (!fstat(fileno(f), &st))
+		dcache.mtime = st.st_mtime;
+
+	/* D <dev> <ino> <mtime> <ctime> <length> <path>, then the names */
+	while (fgets(line, sizeof(line), f)) {
+		n = 0;
+		if (sscanf(line, "D %llu %llu %llu %llu %lu %n", &dev, &ino,
+			   &mtime, &ctime, &len, &n) != 5 || !n)
+			break;
+
+		line[strcspn(line, "\n")] = 0;
+		l = listing_add(line + n);
+		if (!l || !(l->names = malloc(len + 1)) ||
+		    fread(l->names, 1, len, f) != len) {
+			if (l) {
+				free(l->names);
+				l->names = NULL;
+			}
+			break;
+		}
+
+		l->dev = dev;
+		l->ino = ino;
+		l->mtime = mtime;
+		l->ctime = ctime;
+		l->len = len;
+
+		if (fgetc(f) != '\n')
+			break;
+	}
+
+	fclose(f);
+}
+
+/*
+ * Only listings used in this run are written, which drops directories
+ * that have been removed in the meantime. An unchanged cache file is
+ * still touched once a day so that it is not pruned while in use.
+ */
+static void cache_close(void)
+{
+	struct listing *l;
+	char *tmp;
+	FILE *f;
+	int i;
+
+	if (!dcache.file)
+		return;
+
+	if (!dcache.dirty) {
+		if (dcache.mtime && dcache.mtime < dcache.start - CACHE_DAY)
+			utimes(dcache.file, NULL);
+		return;
+	}
+
+	tmp = malloc(strlen(dcache.file) + 16);
+	if (!tmp)
+		return;
+
+	sprintf(tmp, "%s.%d", dcache.file, (int) getpid());
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		free(tmp);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(dcache.hash); i++) {
+		for (l = dcache.hash[i]; l; l = l->next) {
+			if (!l->used || !l->mtime)
+				continue;
+
+			fprintf(f, "D %llu %llu %llu %llu %lu %s\n",
+				(unsigned long long) l->dev,
+				(unsigned long long) l->ino,
+				(unsigned long long) l->mtime,
+				(unsigned long long) l->ctime,
+				(unsigned long) l->len, l->path);
+			fwrite(l->names, 1, l->len, f);
+			fputc('\n', f);
+		}
+	}
+
+	if (fclose(f) || rename(tmp, dcache.file))
+		unlink(tmp);
+
+	free(tmp);
+}
+
+
+static bool excluded(const struct walk *w, const char *path)
+{
+	int i;
+
+	for (i = 0; i < w->n_patterns; i++)
+		if (!fnmatch(w->patterns[i], path, 0))
+			return true;
+
+	return false;
+}
+
+static void walk_file(struct walk *w, const char *path, bool md5)
+{
+	struct stat st;
+
+	if (excluded(w, path))
+		return;
+
+	if (md5) {
+		MD5_hash(path, strlen(path), &w->md5);
+		MD5_hash("\n", 1, &w->md5);
+		return;
+	}
+
+	if (lstat(path, &st) || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_mtime > w->ts) {
+		w->ts = st.st_mtime;
+		free(w->name);
+		w->name = strdup(path);
+	}
+}
+
+static void walk_dir(struct walk *w, char *path, size_t len,
+		     const struct stat *st, bool md5)
+{
+	struct listing *l;
+	struct stat cst;
+	size_t pos, n;
+	char type;
+
+	l = listing_get(path, st);
+	if (!l)
+		return;
+
+	if (len && path[len - 1] != '/')
+		path[len++] = '/';
+
+	for (pos = 0; pos < l->len; pos += n + 2) {
+		type = l->names[pos];
+		n = strlen(l->names + pos + 1);
+
+		if (len + n >= PATH_MAX)
+			continue;
+
+		memcpy(path + len, l->names + pos + 1, n + 1);
+
+		if (type == '?' || (type == 'l' && w->follow)) {
+			if ((w->follow ? stat : lstat)(path, &cst))
+				continue;
+
+			/* timestamp.pl skips links to files even with -f */
+			if (type == 'l' && !S_ISDIR(cst.st_mode))
+				continue;
+
+			type = stat_type(&cst);
+		} else if (type == 'd' && lstat(path, &cst)) {
+			continue;
+		}
+
+		if (type == 'd')
+			walk_dir(w, path, len + n, &cst, md5);
+		else if (type == 'f')
+			walk_file(w, path, md5);
+	}
+
+	path[len] = 0;
+}
+
+static void walk(struct walk *w, const char *start, bool md5)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	size_t len = strlen(start);
+
+	if (len >= PATH_MAX)
+		return;
+
+	memcpy(path, start, len + 1);
+
+	/* timestamp.pl walks "<path>/", which follows a link to a directory */
+	if ((md5 ? lstat : stat)(path, &st)) {
+		if (md5)
+			fprintf(stderr, "find: '%s': No such file or directory\n",
+				start);
+		return;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		if (!md5 && len + 1 < PATH_MAX) {
+			path[len++] = '/';
+			path[len] = 0;
+		}
+		walk_dir(w, path, len, &st, md5);
+	} else if (md5 ? S_ISREG(st.st_mode) : !lstat(path, &st))
+		walk_file(w, path, md5);
+}
+
+
+static int usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-c <cache dir>] [-x <pattern>] [-f] "
+		"[-n <name>|-p|-t|-F] <path>...\n"
+		"       %s [-c <cache dir>] -m [-x <pattern>]... <path>...\n",
+		progname, progname);
+	return 1;
+}
+
+static int find_md5(struct walk *w, int argc, char **argv)
+{
+	unsigned char val[MD5_DIGEST_LENGTH];
+	char str[MD5_DIGEST_LENGTH * 2 + 1];
+	int i, n_paths = 0;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+			if (w->n_patterns < MAX_PATTERNS)
+				w->patterns[w->n_patterns++] = argv[++i];
+		} else if (argv[i][0] == '-') {
+			return usage("treestamp");
+		}
+	}
+
+	MD5_begin(&w->md5);
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-x")) {
+			i++;
+			continue;
+		}
+
+		walk(w, argv[i], true);
+		n_paths++;
+	}
+
+	/* find defaults to the current directory */
+	if (!n_paths)
+		walk(w, ".", true);
+
+	MD5_end(val, &w->md5);
+	hash_string(val, MD5_DIGEST_LENGTH, str);
+	printf("%s\n", str);
+
+	return 0;
+}
+
+/* Same option handling as timestamp.pl */
+static int timestamp(struct walk *w, int argc, char **argv)
+{
+	const char *name = NULL, *n = ".";
+	bool print_path = false, print_ts = false, print_file = false;
+	time_t ts = 0;
+	int i;
+
+	w->patterns[w->n_patterns++] = "*/.svn*";
+	w->patterns[w->n_patterns++] = "*CVS*";
+
+	if (!argc) {
+		static char *dot[] = { "." };
+
+		argc = 1;
+		argv = dot;
+	}
+
+	for (i = 0; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strncmp(arg, "-x", 2)) {
+			if (++i < argc && w->n_patterns < MAX_PATTERNS)
+				w->patterns[w->n_patterns++] = argv[i];
+		} else if (!strncmp(arg, "-f", 2)) {
+			w->follow = true;
+		} else if (!strncmp(arg, "-n", 2)) {
+			/* the name is checked as a path as well */
+			name = i + 1 < argc ? argv[i + 1] : "";
+		} else if (!strcmp(arg, "-p")) {
+			print_path = true;
+		} else if (!strcmp(arg, "-t")) {
+			print_ts = true;
+		} else if (!strcmp(arg, "-F")) {
+			print_file = true;
+		} else if (arg[0] == '-') {
+			continue;
+		} else {
+			w->ts = 0;
+			free(w->name);
+			w->name = NULL;
+
+			walk(w, arg, false);
+
+			if (w->ts > ts) {
+				n = print_file ? strdup(w->name) : arg;
+				ts = w->ts;
+			}
+		}
+	}
+
+	if (name)
+		return strcmp(n, name) != 0;
+
+	if (print_path)
+		printf("%s\n", n);
+	else if (print_ts)
+		printf("%lld\n", (long long) ts);
+	else
+		printf("%s\t%lld\n", n, (long long) ts);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *cache_dir = getenv("TREESTAMP_CACHE");
+	struct walk w = { };
+	bool md5 = false;
+	int ret;
+
+	argc--;
+	argv++;
+
+	while (argc > 0) {
+		if (!strcmp(argv[0], "-c") && argc > 1) {
+			cache_dir = argv[1];
+			argc -= 2;
+			argv += 2;
+		} else if (!strcmp(argv[0], "-m")) {
+			md5 = true;
+			argc--;
+			argv++;
+		} else {
+			break;
+		}
+	}
+
+	if (cache_dir && *cache_dir)
+		cache_open(cache_dir, argc, argv);
+
+	ret = md5 ? find_md5(&w, argc, argv) : timestamp(&w, argc, argv);
+
+	cache_close();
+
+	return ret;
+}
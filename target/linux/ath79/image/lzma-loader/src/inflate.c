@@ -0,0 +1,418 @@
+/*
+ * Deflate decompressor for the kernel loader
+ *
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * The decoding loop follows the structure of puff.c from the zlib
+ * distribution, with a lookup table in front of the canonical Huffman
+ * decoder so that the common short codes are resolved in one step.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inflate.h"
+
+#define MAXBITS		15	/* maximum bits in a code */
+#define MAXLCODES	288	/* maximum number of literal/length codes */
+#define MAXDCODES	30	/* maximum number of distance codes */
+#define FASTBITS	9	/* bits resolved by the lookup table */
+
+#define GZIP_FHCRC	0x02
+#define GZIP_FEXTRA	0x04
+#define GZIP_FNAME	0x08
+#define GZIP_FCOMMENT	0x10
+
+struct huffman {
+	uint16_t fast[1 << FASTBITS];	/* (length << 9) | symbol, 0 if longer */
+	uint16_t count[MAXBITS + 1];	/* number of codes of each length */
+	uint16_t symbol[MAXLCODES];	/* symbols in canonical order */
+};
+
+struct inflate_state {
+	const unsigned char *in;
+	const unsigned char *inend;
+	uint32_t bitbuf;
+	int bitcnt;
+
+	unsigned char *out;
+	unsigned long outpos;
+	unsigned long outlen;
+
+	struct huffman lencode;
+	struct huffman distcode;
+};
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*
+ * Keep at least 25 bits in the bit buffer. Reading past the end of the
+ * input yields zeroes, overruns are caught once the stream is finished.
+ */
+static __inline__ void refill(struct inflate_state *s)
+{
+	while (s->bitcnt <= 24) {
+		uint32_t c = 0;
+
+		if (s->in < s->inend)
+			c = *s->in;
+		s->in++;
+		s->bitbuf |= c << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static __inline__ void dropbits(struct inflate_state *s, int n)
+{
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+}
+
+static __inline__ uint32_t getbits(struct inflate_state *s, int n)
+{
+	uint32_t val;
+
+	refill(s);
+	val = s->bitbuf & ((1U << n) - 1);
+	dropbits(s, n);
+
+	return val;
+}
+
+/*
+ * Build the decoding tables for the given code lengths. Returns zero for
+ * a complete code, a positive value for an incomplete one and a negative
+ * value if the lengths are over-subscribed.
+ */
+static int build(struct huffman *h, const unsigned char *length, int n)
+{
+	uint16_t offs[MAXBITS + 1];
+	unsigned int code, rev, fill;
+	int left, len, sym, index, i;
+
+	for (len = 0; len <= MAXBITS; len++)
+		h->count[len] = 0;
+	for (sym = 0; sym < n; sym++)
+		h->count[length[sym]]++;
+
+	left = 1;
+	for (len = 1; len <= MAXBITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return left;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < MAXBITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+
+	for (sym = 0; sym < n; sym++)
+		if (length[sym] != 0)
+			h->symbol[offs[length[sym]]++] = sym;
+
+	for (i = 0; i < (1 << FASTBITS); i++)
+		h->fast[i] = 0;
+
+	/* deflate sends the codes starting with their most significant bit */
+	code = 0;
+	index = 0;
+	for (len = 1; len <= FASTBITS; len++) {
+		for (i = 0; i < h->count[len]; i++, index++, code++) {
+			rev = 0;
+			for (fill = 0; fill < len; fill++)
+				rev |= ((code >> fill) & 1) << (len - 1 - fill);
+
+			for (fill = rev; fill < (1 << FASTBITS); fill += 1 << len)
+				h->fast[fill] = (len << 9) | h->symbol[index];
+		}
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int decode(struct inflate_state *s, const struct huffman *h)
+{
+	int code, first, count, index, len;
+	unsigned int entry;
+
+	refill(s);
+
+	entry = h->fast[s->bitbuf & ((1 << FASTBITS) - 1)];
+	if (entry != 0) {
+		dropbits(s, entry >> 9);
+		return entry & 0x1ff;
+	}
+
+	/* code is longer than FASTBITS, walk the canonical code */
+	code = first = index = 0;
+	for (len = 1; len <= MAXBITS; len++) {
+		code |= s->bitbuf & 1;
+		dropbits(s, 1);
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static int stored(struct inflate_state *s)
+{
+	unsigned long len, nlen;
+
+	/* go back to the byte boundary and hand unused bytes back */
+	dropbits(s, s->bitcnt & 7);
+	s->in -= s->bitcnt >> 3;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+
+	if (s->in + 4 > s->inend)
+		return INFLATE_DATA_ERROR;
+
+	len = s->in[0] | (s->in[1] << 8);
+	nlen = s->in[2] | (s->in[3] << 8);
+	s->in += 4;
+
+	if (len != (~nlen & 0xffff) ||
+	    len > (unsigned long) (s->inend - s->in) ||
+	    len > s->outlen - s->outpos)
+		return INFLATE_DATA_ERROR;
+
+	while (len--)
+		s->out[s->outpos++] = *s->in++;
+
+	return INFLATE_OK;
+}
+
+static int codes(struct inflate_state *s)
+{
+	unsigned char *out = s->out;
+	unsigned long pos = s->outpos;
+	unsigned long dist;
+	unsigned int len;
+	int sym;
+
+	for (;;) {
+		sym = decode(s, &s->lencode);
+		if (sym < 0)
+			return INFLATE_DATA_ERROR;
+
+		if (sym < 256) {
+			if (pos >= s->outlen)
+				return INFLATE_DATA_ERROR;
+			out[pos++] = sym;
+			continue;
+		}
+
+		if (sym == 256)
+			break;
+
+		sym -= 257;
+		if (sym >= 29)
+			return INFLATE_DATA_ERROR;
+		len = len_base[sym] + getbits(s, len_extra[sym]);
+
+		sym = decode(s, &s->distcode);
+		if (sym < 0 || sym >= 30)
+			return INFLATE_DATA_ERROR;
+		dist = dist_base[sym] + getbits(s, dist_extra[sym]);
+
+		if (dist > pos || len > s->outlen - pos)
+			return INFLATE_DATA_ERROR;
+
+		/* the areas may overlap, so this has to go byte by byte */
+		while (len--) {
+			out[pos] = out[pos - dist];
+			pos++;
+		}
+	}
+
+	s->outpos = pos;
+	return INFLATE_OK;
+}
+
+static int fixed(struct inflate_state *s)
+{
+	unsigned char lengths[MAXLCODES];
+	int sym;
+
+	for (sym = 0; sym < 144; sym++)
+		lengths[sym] = 8;
+	for (; sym < 256; sym++)
+		lengths[sym] = 9;
+	for (; sym < 280; sym++)
+		lengths[sym] = 7;
+	for (; sym < MAXLCODES; sym++)
+		lengths[sym] = 8;
+	build(&s->lencode, lengths, MAXLCODES);
+
+	for (sym = 0; sym < MAXDCODES; sym++)
+		lengths[sym] = 5;
+	build(&s->distcode, lengths, MAXDCODES);
+
+	return codes(s);
+}
+
+static int dynamic(struct inflate_state *s)
+{
+	unsigned char lengths[MAXLCODES + MAXDCODES];
+	int nlen, ndist, ncode;
+	int index, sym, len, err;
+
+	nlen = getbits(s, 5) + 257;
+	ndist = getbits(s, 5) + 1;
+	ncode = getbits(s, 4) + 4;
+	if (nlen > MAXLCODES || ndist > MAXDCODES)
+		return INFLATE_DATA_ERROR;
+
+	for (index = 0; index < ncode; index++)
+		lengths[clen_order[index]] = getbits(s, 3);
+	for (; index < 19; index++)
+		lengths[clen_order[index]] = 0;
+
+	if (build(&s->lencode, lengths, 19) != 0)
+		return INFLATE_DATA_ERROR;
+
+	index = 0;
+	while (index < nlen + ndist) {
+		sym = decode(s, &s->lencode);
+		if (sym < 0)
+			return INFLATE_DATA_ERROR;
+
+		if (sym < 16) {
+			lengths[index++] = sym;
+			continue;
+		}
+
+		len = 0;
+		if (sym == 16) {
+			if (index == 0)
+				return INFLATE_DATA_ERROR;
+			len = lengths[index - 1];
+			sym = 3 + getbits(s, 2);
+		} else if (sym == 17) {
+			sym = 3 + getbits(s, 3);
+		} else {
+			sym = 11 + getbits(s, 7);
+		}
+
+		if (index + sym > nlen + ndist)
+			return INFLATE_DATA_ERROR;
+		while (sym--)
+			lengths[index++] = len;
+	}
+
+	if (lengths[256] == 0)
+		return INFLATE_DATA_ERROR;
+
+	/* only a single code may be left incomplete */
+	err = build(&s->lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - s->lencode.count[0] != 1))
+		return INFLATE_DATA_ERROR;
+
+	err = build(&s->distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - s->distcode.count[0] != 1))
+		return INFLATE_DATA_ERROR;
+
+	return codes(s);
+}
+
+int gunzip(unsigned char *out, unsigned long *outlen,
+	   const unsigned char *in, unsigned long inlen, void *workspace)
+{
+	struct inflate_state *s = workspace;
+	const unsigned char *p, *end;
+	int last, type, flags;
+	int ret;
+
+	/* 10 bytes of header, 8 bytes of trailer */
+	if (inlen < 18 || in[0] != 0x1f || in[1] != 0x8b || in[2] != 8)
+		return INFLATE_HEADER_ERROR;
+
+	flags = in[3];
+	p = in + 10;
+	end = in + inlen - 8;
+
+	if (flags & GZIP_FEXTRA)
+		p += 2 + (p[0] | (p[1] << 8));
+	if (flags & GZIP_FNAME)
+		while (p < end && *p++);
+	if (flags & GZIP_FCOMMENT)
+		while (p < end && *p++);
+	if (flags & GZIP_FHCRC)
+		p += 2;
+
+	if (p >= end)
+		return INFLATE_HEADER_ERROR;
+
+	s->in = p;
+	s->inend = end;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+	s->out = out;
+	s->outpos = 0;
+	s->outlen = *outlen;
+
+	do {
+		last = getbits(s, 1);
+		type = getbits(s, 2);
+
+		switch (type) {
+		case 0:
+			ret = stored(s);
+			break;
+		case 1:
+			ret = fixed(s);
+			break;
+		case 2:
+			ret = dynamic(s);
+			break;
+		default:
+			ret = INFLATE_DATA_ERROR;
+		}
+
+		if (ret != INFLATE_OK)
+			return ret;
+	} while (!last);
+
+	/* the zero bytes fed in past the end must not have been used */
+	if (s->in - (s->bitcnt >> 3) > s->inend)
+		return INFLATE_DATA_ERROR;
+
+	*outlen = s->outpos;
+	return INFLATE_OK;
+}
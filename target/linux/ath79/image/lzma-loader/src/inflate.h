@@ -0,0 +1,22 @@
+/*
+ * Deflate decompressor for the kernel loader
+ *
+ * Copyright (C) 2020 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+
+#define INFLATE_OK		0
+#define INFLATE_HEADER_ERROR	1
+#define INFLATE_DATA_ERROR	2
+
+int gunzip(unsigned char *out, unsigned long *outlen,
+	   const unsigned char *in, unsigned long inlen, void *workspace);
+
+#endif /* _INFLATE_H_ */
@@ -16,6 +16,11 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/magic.h>
+#include <linux/bitmap.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/byteorder/generic.h>
@@ -23,6 +28,32 @@
 #include "mtdsplit.h"
 
 #define UBI_EC_MAGIC			0x55424923	/* UBI# */
+#define JFFS2_MAGIC			0x19852003
+#define UIMAGE_MAGIC			0x27051956
+#define TRX_MAGIC			0x30524448	/* "HDR0" */
+
+/*
+ * Bigger devices are not worth caching, parsers only look at the first
+ * few blocks of them anyway.
+ */
+#define MTDSPLIT_SCAN_MAX_BLOCKS	4096
+
+/*
+ * Header cache of a single MTD device. The first MTDSPLIT_SCAN_HDR_LEN
+ * bytes of every eraseblock are read at most once and shared between all
+ * parsers probing that device.
+ */
+struct mtdsplit_scan {
+	struct list_head list;
+	struct mtd_info *mtd;
+	unsigned int nr_blocks;
+	unsigned long *cached;
+	u8 *magic;
+	u8 *hdr;
+};
+
+static LIST_HEAD(mtdsplit_scan_list);
+static DEFINE_MUTEX(mtdsplit_scan_lock);
 
 struct squashfs_super_block {
 	__le32 s_magic;
@@ -38,8 +69,8 @@ int mtd_get_squashfs_len(struct mtd_info *master,
 	size_t retlen;
 	int err;
 
-	err = mtd_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
-	if (err || (retlen != sizeof(sb))) {
+	err = mtd_scan_read_header(master, offset, &sb, sizeof(sb));
+	if (err) {
 		pr_alert("error occured while reading from \"%s\"\n",
 			 master->name);
 		return -EIO;
@@ -72,36 +103,225 @@ static ssize_t mtd_next_eb(struct mtd_info *mtd, size_t offset)
 	return mtd_rounddown_to_eb(offset, mtd) + mtd->erasesize;
 }
 
-int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset,
-			   enum mtdsplit_part_type *type)
+static int mtdsplit_read(struct mtd_info *mtd, size_t offset,
+			 void *buf, size_t len)
 {
-	u32 magic;
 	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, sizeof(magic), &retlen,
-		       (unsigned char *) &magic);
+	ret = mtd_read(mtd, offset, len, &retlen, buf);
 	if (ret)
 		return ret;
 
-	if (retlen != sizeof(magic))
+	if (retlen != len)
 		return -EIO;
 
-	if (le32_to_cpu(magic) == SQUASHFS_MAGIC) {
-		if (type)
-			*type = MTDSPLIT_PART_TYPE_SQUASHFS;
-		return 0;
-	} else if (magic == 0x19852003) {
-		if (type)
-			*type = MTDSPLIT_PART_TYPE_JFFS2;
-		return 0;
-	} else if (be32_to_cpu(magic) == UBI_EC_MAGIC) {
-		if (type)
-			*type = MTDSPLIT_PART_TYPE_UBI;
+	return 0;
+}
+
+static unsigned int mtdsplit_classify(const u8 *buf)
+{
+	u32 magic;
+
+	memcpy(&magic, buf, sizeof(magic));
+
+	if (le32_to_cpu(magic) == SQUASHFS_MAGIC)
+		return MTDSPLIT_MAGIC_SQUASHFS;
+	if (magic == JFFS2_MAGIC)
+		return MTDSPLIT_MAGIC_JFFS2;
+	if (be32_to_cpu(magic) == UBI_EC_MAGIC)
+		return MTDSPLIT_MAGIC_UBI;
+	if (be32_to_cpu(magic) == UIMAGE_MAGIC)
+		return MTDSPLIT_MAGIC_UIMAGE;
+	if (le32_to_cpu(magic) == TRX_MAGIC)
+		return MTDSPLIT_MAGIC_TRX;
+
+	return 0;
+}
+
+static void mtdsplit_scan_free(struct mtdsplit_scan *scan)
+{
+	list_del(&scan->list);
+	vfree(scan->hdr);
+	kfree(scan->magic);
+	kfree(scan->cached);
+	kfree(scan);
+}
+
+/* must be called with mtdsplit_scan_lock held */
+static struct mtdsplit_scan *mtdsplit_scan_get(struct mtd_info *mtd)
+{
+	struct mtdsplit_scan *scan;
+	u64 nr_blocks;
+
+	list_for_each_entry(scan, &mtdsplit_scan_list, list)
+		if (scan->mtd == mtd)
+			return scan;
+
+	if (!mtd->erasesize || mtd->erasesize < MTDSPLIT_SCAN_HDR_LEN)
+		return NULL;
+
+	nr_blocks = mtd_div_by_eb(mtd->size, mtd);
+	if (!nr_blocks || nr_blocks > MTDSPLIT_SCAN_MAX_BLOCKS)
+		return NULL;
+
+	scan = kzalloc(sizeof(*scan), GFP_KERNEL);
+	if (!scan)
+		return NULL;
+
+	scan->mtd = mtd;
+	scan->nr_blocks = nr_blocks;
+	scan->cached = kcalloc(BITS_TO_LONGS(nr_blocks), sizeof(long),
+			       GFP_KERNEL);
+	scan->magic = kzalloc(nr_blocks, GFP_KERNEL);
+	scan->hdr = vmalloc(nr_blocks * MTDSPLIT_SCAN_HDR_LEN);
+	INIT_LIST_HEAD(&scan->list);
+
+	if (!scan->cached || !scan->magic || !scan->hdr) {
+		mtdsplit_scan_free(scan);
+		return NULL;
+	}
+
+	list_add(&scan->list, &mtdsplit_scan_list);
+
+	return scan;
+}
+
+/* must be called with mtdsplit_scan_lock held */
+static int mtdsplit_scan_block(struct mtdsplit_scan *scan, unsigned int block)
+{
+	struct mtd_info *mtd = scan->mtd;
+	u8 *hdr = scan->hdr + block * MTDSPLIT_SCAN_HDR_LEN;
+	int ret;
+
+	if (test_bit(block, scan->cached))
 		return 0;
+
+	ret = mtdsplit_read(mtd, (size_t) block * mtd->erasesize, hdr,
+			    MTDSPLIT_SCAN_HDR_LEN);
+	if (ret) {
+		pr_debug("read error in \"%s\" at offset %llx\n", mtd->name,
+			 (unsigned long long) block * mtd->erasesize);
+		return ret;
+	}
+
+	scan->magic[block] = mtdsplit_classify(hdr);
+	set_bit(block, scan->cached);
+
+	return 0;
+}
+
+int mtd_scan_read_header(struct mtd_info *mtd, size_t offset,
+			 void *buf, size_t len)
+{
+	struct mtdsplit_scan *scan;
+	unsigned int block;
+	int ret;
+
+	if (len > MTDSPLIT_SCAN_HDR_LEN || offset >= mtd->size ||
+	    mtd_mod_by_eb(offset, mtd))
+		return mtdsplit_read(mtd, offset, buf, len);
+
+	mutex_lock(&mtdsplit_scan_lock);
+
+	scan = mtdsplit_scan_get(mtd);
+	if (scan) {
+		block = mtd_div_by_eb(offset, mtd);
+		ret = mtdsplit_scan_block(scan, block);
+		if (!ret)
+			memcpy(buf, scan->hdr + block * MTDSPLIT_SCAN_HDR_LEN,
+			       len);
+	} else {
+		ret = mtdsplit_read(mtd, offset, buf, len);
+	}
+
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mtd_scan_read_header);
+
+int mtd_scan_find_magic(struct mtd_info *mtd, size_t from, size_t limit,
+			unsigned int mask, size_t *ret_offset,
+			unsigned int *ret_magic)
+{
+	struct mtdsplit_scan *scan;
+	unsigned int block, magic = 0;
+	u8 buf[sizeof(u32)];
+	size_t offset = from;
+
+	limit = min_t(u64, limit, mtd->size);
+
+	/* an unaligned start is not covered by the cache */
+	if (offset < limit && mtd_mod_by_eb(offset, mtd)) {
+		if (!mtdsplit_read(mtd, offset, buf, sizeof(buf)))
+			magic = mtdsplit_classify(buf) & mask;
+
+		if (!magic)
+			offset = mtd_next_eb(mtd, offset);
+	}
+
+	mutex_lock(&mtdsplit_scan_lock);
+
+	scan = mtdsplit_scan_get(mtd);
+	for (; !magic && offset < limit; offset += mtd->erasesize) {
+		if (scan) {
+			block = mtd_div_by_eb(offset, mtd);
+			if (!mtdsplit_scan_block(scan, block))
+				magic = scan->magic[block] & mask;
+		} else if (!mtdsplit_read(mtd, offset, buf, sizeof(buf))) {
+			magic = mtdsplit_classify(buf) & mask;
+		}
+
+		if (magic)
+			break;
 	}
 
-	return -EINVAL;
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	if (!magic)
+		return -ENODEV;
+
+	*ret_offset = offset;
+	if (ret_magic)
+		*ret_magic = magic;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mtd_scan_find_magic);
+
+static int mtdsplit_rootfs_type(unsigned int magic,
+				enum mtdsplit_part_type *type)
+{
+	if (!type)
+		return 0;
+
+	if (magic & MTDSPLIT_MAGIC_SQUASHFS)
+		*type = MTDSPLIT_PART_TYPE_SQUASHFS;
+	else if (magic & MTDSPLIT_MAGIC_JFFS2)
+		*type = MTDSPLIT_PART_TYPE_JFFS2;
+	else if (magic & MTDSPLIT_MAGIC_UBI)
+		*type = MTDSPLIT_PART_TYPE_UBI;
+
+	return 0;
+}
+
+int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset,
+			   enum mtdsplit_part_type *type)
+{
+	u8 buf[sizeof(u32)];
+	unsigned int magic;
+	int ret;
+
+	ret = mtd_scan_read_header(mtd, offset, buf, sizeof(buf));
+	if (ret)
+		return ret;
+
+	magic = mtdsplit_classify(buf) & MTDSPLIT_MAGIC_ROOTFS;
+	if (!magic)
+		return -EINVAL;
+
+	return mtdsplit_rootfs_type(magic, type);
 }
 EXPORT_SYMBOL_GPL(mtd_check_rootfs_magic);
 
@@ -111,20 +331,80 @@ int mtd_find_rootfs_from(struct mtd_info *mtd,
 			 size_t *ret_offset,
 			 enum mtdsplit_part_type *type)
 {
-	size_t offset;
+	unsigned int magic;
 	int err;
 
-	for (offset = from; offset < limit;
-	     offset = mtd_next_eb(mtd, offset)) {
-		err = mtd_check_rootfs_magic(mtd, offset, type);
-		if (err)
+	err = mtd_scan_find_magic(mtd, from, limit, MTDSPLIT_MAGIC_ROOTFS,
+				  ret_offset, &magic);
+	if (err)
+		return err;
+
+	return mtdsplit_rootfs_type(magic, type);
+}
+EXPORT_SYMBOL_GPL(mtd_find_rootfs_from);
+
+/*
+ * Partitions are registered once the parsers are done with the device
+ * they were carved out of, so its headers are not needed anymore. This
+ * also covers devices probed after mtdsplit_scan_flush().
+ */
+static void mtdsplit_notify_add(struct mtd_info *mtd)
+{
+	struct mtd_info *master = mtdpart_get_master(mtd);
+	uint64_t offset = mtdpart_get_offset(mtd);
+	struct mtdsplit_scan *scan, *tmp;
+	uint64_t start;
+
+	mutex_lock(&mtdsplit_scan_lock);
+	list_for_each_entry_safe(scan, tmp, &mtdsplit_scan_list, list) {
+		if (scan->mtd == mtd || mtdpart_get_master(scan->mtd) != master)
 			continue;
 
-		*ret_offset = offset;
-		return 0;
+		start = mtdpart_get_offset(scan->mtd);
+		if (offset >= start &&
+		    offset + mtd->size <= start + scan->mtd->size)
+			mtdsplit_scan_free(scan);
 	}
+	mutex_unlock(&mtdsplit_scan_lock);
+}
 
-	return -ENODEV;
+static void mtdsplit_notify_remove(struct mtd_info *mtd)
+{
+	struct mtdsplit_scan *scan, *tmp;
+
+	mutex_lock(&mtdsplit_scan_lock);
+	list_for_each_entry_safe(scan, tmp, &mtdsplit_scan_list, list)
+		if (scan->mtd == mtd)
+			mtdsplit_scan_free(scan);
+	mutex_unlock(&mtdsplit_scan_lock);
 }
-EXPORT_SYMBOL_GPL(mtd_find_rootfs_from);
+
+static struct mtd_notifier mtdsplit_notifier = {
+	.add = mtdsplit_notify_add,
+	.remove = mtdsplit_notify_remove,
+};
+
+static int __init mtdsplit_init(void)
+{
+	register_mtd_user(&mtdsplit_notifier);
+
+	return 0;
+}
+
+subsys_initcall(mtdsplit_init);
+
+/* headers cached while probing the boot flash are not needed anymore */
+static int __init mtdsplit_scan_flush(void)
+{
+	struct mtdsplit_scan *scan, *tmp;
+
+	mutex_lock(&mtdsplit_scan_lock);
+	list_for_each_entry_safe(scan, tmp, &mtdsplit_scan_list, list)
+		mtdsplit_scan_free(scan);
+	mutex_unlock(&mtdsplit_scan_lock);
+
+	return 0;
+}
+
+late_initcall_sync(mtdsplit_scan_flush);
 
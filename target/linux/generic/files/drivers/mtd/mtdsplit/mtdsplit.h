@@ -26,7 +26,30 @@ enum mtdsplit_part_type {
 	MTDSPLIT_PART_TYPE_UBI,
 };
 
+/*
+ * Number of bytes cached from the start of every eraseblock, enough for
+ * the largest (prefixed) uImage header checked by the parsers.
+ */
+#define MTDSPLIT_SCAN_HDR_LEN	128
+
+#define MTDSPLIT_MAGIC_SQUASHFS	BIT(0)
+#define MTDSPLIT_MAGIC_JFFS2	BIT(1)
+#define MTDSPLIT_MAGIC_UBI	BIT(2)
+#define MTDSPLIT_MAGIC_UIMAGE	BIT(3)
+#define MTDSPLIT_MAGIC_TRX	BIT(4)
+
+#define MTDSPLIT_MAGIC_ROOTFS	(MTDSPLIT_MAGIC_SQUASHFS | \
+				 MTDSPLIT_MAGIC_JFFS2 | \
+				 MTDSPLIT_MAGIC_UBI)
+
 #ifdef CONFIG_MTD_SPLIT
+int mtd_scan_read_header(struct mtd_info *mtd, size_t offset,
+			 void *buf, size_t len);
+
+int mtd_scan_find_magic(struct mtd_info *mtd, size_t from, size_t limit,
+			unsigned int mask, size_t *ret_offset,
+			unsigned int *ret_magic);
+
 int mtd_get_squashfs_len(struct mtd_info *master,
 			 size_t offset,
 			 size_t *squashfs_len);
@@ -41,6 +64,20 @@ int mtd_find_rootfs_from(struct mtd_info *mtd,
 			 enum mtdsplit_part_type *type);
 
 #else
+static inline int mtd_scan_read_header(struct mtd_info *mtd, size_t offset,
+				       void *buf, size_t len)
+{
+	return -EIO;
+}
+
+static inline int mtd_scan_find_magic(struct mtd_info *mtd, size_t from,
+				      size_t limit, unsigned int mask,
+				      size_t *ret_offset,
+				      unsigned int *ret_magic)
+{
+	return -ENODEV;
+}
+
 static inline int mtd_get_squashfs_len(struct mtd_info *master,
 				       size_t offset,
 				       size_t *squashfs_len)
@@ -21,8 +21,6 @@
 
 #include "mtdsplit.h"
 
-#define TRX_MAGIC   0x30524448  /* "HDR0" */
-
 struct trx_header {
 	__le32 magic;
 	__le32 len;
@@ -31,30 +29,6 @@ struct trx_header {
 	__le32 offset[4];
 };
 
-static int
-read_trx_header(struct mtd_info *mtd, size_t offset,
-		   struct trx_header *header)
-{
-	size_t header_len;
-	size_t retlen;
-	int ret;
-
-	header_len = sizeof(*header);
-	ret = mtd_read(mtd, offset, header_len, &retlen,
-		       (unsigned char *) header);
-	if (ret) {
-		pr_debug("read error in \"%s\"\n", mtd->name);
-		return ret;
-	}
-
-	if (retlen != header_len) {
-		pr_debug("short read in \"%s\"\n", mtd->name);
-		return -EIO;
-	}
-
-	return 0;
-}
-
 static int
 mtdsplit_parse_trx(struct mtd_info *master,
 		   const struct mtd_partition **pparts,
@@ -79,15 +53,14 @@ mtdsplit_parse_trx(struct mtd_info *master,
 	for (offset = 0; offset < master->size; offset += master->erasesize) {
 		trx_size = 0;
 
-		ret = read_trx_header(master, offset, &hdr);
+		ret = mtd_scan_find_magic(master, offset, master->size,
+					  MTDSPLIT_MAGIC_TRX, &offset, NULL);
 		if (ret)
-			continue;
+			break;
 
-		if (hdr.magic != cpu_to_le32(TRX_MAGIC)) {
-			pr_debug("no valid trx header found in \"%s\" at offset %llx\n",
-				 master->name, (unsigned long long) offset);
+		ret = mtd_scan_read_header(master, offset, &hdr, sizeof(hdr));
+		if (ret)
 			continue;
-		}
 
 		trx_size = le32_to_cpu(hdr.len);
 		if ((offset + trx_size) > master->size) {
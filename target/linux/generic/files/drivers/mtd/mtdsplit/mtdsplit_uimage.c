@@ -55,27 +55,6 @@ struct uimage_header {
 	uint8_t		ih_name[IH_NMLEN];	/* Image Name		*/
 };
 
-static int
-read_uimage_header(struct mtd_info *mtd, size_t offset, u_char *buf,
-		   size_t header_len)
-{
-	size_t retlen;
-	int ret;
-
-	ret = mtd_read(mtd, offset, header_len, &retlen, buf);
-	if (ret) {
-		pr_debug("read error in \"%s\"\n", mtd->name);
-		return ret;
-	}
-
-	if (retlen != header_len) {
-		pr_debug("short read in \"%s\"\n", mtd->name);
-		return -EIO;
-	}
-
-	return 0;
-}
-
 /**
  * __mtdsplit_parse_uimage - scan partition and create kernel + rootfs parts
  *
@@ -117,7 +96,7 @@ static int __mtdsplit_parse_uimage(struct mtd_info *master,
 
 		uimage_size = 0;
 
-		ret = read_uimage_header(master, offset, buf, MAX_HEADER_LEN);
+		ret = mtd_scan_read_header(master, offset, buf, MAX_HEADER_LEN);
 		if (ret)
 			continue;
 
@@ -423,11 +423,26 @@ static void b53_enable_mib(struct b53_device *dev)
 	b53_write8(dev, B53_MGMT_PAGE, B53_GLOBAL_CONFIG, gc);
 }
 
-static int b53_apply(struct b53_device *dev)
+#define B53_HW_PVID_UNKNOWN	0xffff
+
+/*
+ * Forget what was programmed into the VLAN table and port PVIDs, the
+ * next b53_apply() clears and rewrites them completely.
+ */
+static void b53_invalidate_vlans(struct b53_device *dev)
+{
+	int i;
+
+	dev->hw_vlans_valid = 0;
+
+	for (i = 0; i < B53_N_PORTS; i++)
+		dev->hw_pvid[i] = B53_HW_PVID_UNKNOWN;
+}
+
+static void b53_clear_vlans(struct b53_device *dev)
 {
 	int i;
 
-	/* clear all vlan entries */
 	if (is5325(dev) || is5365(dev)) {
 		for (i = 1; i < dev->sw_dev.vlans; i++)
 			b53_set_vlan_entry(dev, i, 0, 0);
@@ -435,28 +450,46 @@ static int b53_apply(struct b53_device *dev)
 		b53_do_vlan_op(dev, VTA_CMD_CLEAR);
 	}
 
+	memset(dev->hw_vlans, 0, sizeof(*dev->hw_vlans) * dev->sw_dev.vlans);
+	dev->hw_vlans_valid = 1;
+}
+
+static int b53_apply(struct b53_device *dev)
+{
+	int i;
+
+	/*
+	 * The table is only cleared as a whole after a reset, later applies
+	 * write just the entries that differ from what the switch holds.
+	 */
+	if (!dev->hw_vlans_valid)
+		b53_clear_vlans(dev);
+
 	b53_enable_vlan(dev, dev->enable_vlan);
 
-	/* fill VLAN table */
-	if (dev->enable_vlan) {
-		for (i = 0; i < dev->sw_dev.vlans; i++) {
-			struct b53_vlan *vlan = &dev->vlans[i];
+	for (i = 0; i < dev->sw_dev.vlans; i++) {
+		struct b53_vlan *hw = &dev->hw_vlans[i];
+		struct b53_vlan vlan = { 0 };
 
-			if (!vlan->members)
-				continue;
+		/* with VLANs disabled the table is kept empty */
+		if (dev->enable_vlan && dev->vlans[i].members)
+			vlan = dev->vlans[i];
 
-			b53_set_vlan_entry(dev, i, vlan->members, vlan->untag);
-		}
+		if (hw->members == vlan.members && hw->untag == vlan.untag)
+			continue;
 
-		b53_for_each_port(dev, i)
-			b53_write16(dev, B53_VLAN_PAGE,
-				    B53_VLAN_PORT_DEF_TAG(i),
-				    dev->ports[i].pvid);
-	} else {
-		b53_for_each_port(dev, i)
-			b53_write16(dev, B53_VLAN_PAGE,
-				    B53_VLAN_PORT_DEF_TAG(i), 1);
+		b53_set_vlan_entry(dev, i, vlan.members, vlan.untag);
+		*hw = vlan;
+	}
+
+	b53_for_each_port(dev, i) {
+		u16 pvid = dev->enable_vlan ? dev->ports[i].pvid : 1;
 
+		if (dev->hw_pvid[i] == pvid)
+			continue;
+
+		b53_write16(dev, B53_VLAN_PAGE, B53_VLAN_PORT_DEF_TAG(i), pvid);
+		dev->hw_pvid[i] = pvid;
 	}
 
 	b53_enable_ports(dev);
@@ -646,6 +679,7 @@ static int b53_switch_reset(struct b53_device *dev)
 	u8 mgmt;
 
 	b53_switch_reset_gpio(dev);
+	b53_invalidate_vlans(dev);
 
 	if (is539x(dev)) {
 		b53_write8(dev, B53_CTRL_PAGE, B53_SOFTRESET, 0x83);
@@ -1594,6 +1628,12 @@ static int b53_switch_init(struct b53_device *dev)
 	if (!dev->vlans)
 		return -ENOMEM;
 
+	dev->hw_vlans = devm_kzalloc(dev->dev,
+				     sizeof(struct b53_vlan) * sw_dev->vlans,
+				     GFP_KERNEL);
+	if (!dev->hw_vlans)
+		return -ENOMEM;
+
 	dev->buf = devm_kzalloc(dev->dev, B53_BUF_SIZE, GFP_KERNEL);
 	if (!dev->buf)
 		return -ENOMEM;
@@ -101,6 +101,11 @@ struct b53_device {
 	struct b53_port *ports;
 	struct b53_vlan *vlans;
 
+	/* last state written to the hardware, see b53_apply() */
+	struct b53_vlan *hw_vlans;
+	u16 hw_pvid[B53_N_PORTS];
+	unsigned hw_vlans_valid:1;
+
 	char *buf;
 };
 
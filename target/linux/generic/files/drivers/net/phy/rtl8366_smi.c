@@ -13,6 +13,8 @@
 #include <linux/device.h>
 #include <linux/delay.h>
 #include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
 #include <linux/skbuff.h>
 #include <linux/of.h>
@@ -35,91 +37,99 @@
 
 static inline void rtl8366_smi_clk_delay(struct rtl8366_smi *smi)
 {
-	ndelay(smi->clk_delay);
+	if (smi->clk_delay)
+		ndelay(smi->clk_delay);
 }
 
+/*
+ * GPIO bit-banging transport
+ *
+ * The lines are driven through descriptors looked up once at init time
+ * with the raw accessors, which is what gpio_set_value() ends up calling
+ * after translating the GPIO number on every edge.
+ */
 static void rtl8366_smi_start(struct rtl8366_smi *smi)
 {
-	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
+	struct gpio_desc *sda = smi->sda;
+	struct gpio_desc *sck = smi->sck;
 
 	/*
 	 * Set GPIO pins to output mode, with initial state:
 	 * SCK = 0, SDA = 1
 	 */
-	gpio_direction_output(sck, 0);
-	gpio_direction_output(sda, 1);
+	gpiod_direction_output_raw(sck, 0);
+	gpiod_direction_output_raw(sda, 1);
 	rtl8366_smi_clk_delay(smi);
 
 	/* CLK 1: 0 -> 1, 1 -> 0 */
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sck, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	gpiod_set_raw_value(sck, 0);
 	rtl8366_smi_clk_delay(smi);
 
 	/* CLK 2: */
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sck, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 0);
+	gpiod_set_raw_value(sda, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	gpiod_set_raw_value(sck, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 1);
+	gpiod_set_raw_value(sda, 1);
 }
 
 static void rtl8366_smi_stop(struct rtl8366_smi *smi)
 {
-	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
+	struct gpio_desc *sda = smi->sda;
+	struct gpio_desc *sck = smi->sck;
 
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 0);
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sda, 0);
+	gpiod_set_raw_value(sck, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sda, 1);
+	gpiod_set_raw_value(sda, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sck, 1);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	gpiod_set_raw_value(sck, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sck, 1);
 
 	/* add a click */
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 0);
+	gpiod_set_raw_value(sck, 0);
 	rtl8366_smi_clk_delay(smi);
-	gpio_set_value(sck, 1);
+	gpiod_set_raw_value(sck, 1);
 
 	/* set GPIO pins to input mode */
-	gpio_direction_input(sda);
-	gpio_direction_input(sck);
+	gpiod_direction_input(sda);
+	gpiod_direction_input(sck);
 }
 
 static void rtl8366_smi_write_bits(struct rtl8366_smi *smi, u32 data, u32 len)
 {
-	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
+	struct gpio_desc *sda = smi->sda;
+	struct gpio_desc *sck = smi->sck;
 
 	for (; len > 0; len--) {
 		rtl8366_smi_clk_delay(smi);
 
 		/* prepare data */
-		gpio_set_value(sda, !!(data & ( 1 << (len - 1))));
+		gpiod_set_raw_value(sda, !!(data & ( 1 << (len - 1))));
 		rtl8366_smi_clk_delay(smi);
 
 		/* clocking */
-		gpio_set_value(sck, 1);
+		gpiod_set_raw_value(sck, 1);
 		rtl8366_smi_clk_delay(smi);
-		gpio_set_value(sck, 0);
+		gpiod_set_raw_value(sck, 0);
 	}
 }
 
 static void rtl8366_smi_read_bits(struct rtl8366_smi *smi, u32 len, u32 *data)
 {
-	unsigned int sda = smi->gpio_sda;
-	unsigned int sck = smi->gpio_sck;
+	struct gpio_desc *sda = smi->sda;
+	struct gpio_desc *sck = smi->sck;
 
-	gpio_direction_input(sda);
+	gpiod_direction_input(sda);
 
 	for (*data = 0; len > 0; len--) {
 		u32 u;
@@ -127,15 +137,15 @@ static void rtl8366_smi_read_bits(struct rtl8366_smi *smi, u32 len, u32 *data)
 		rtl8366_smi_clk_delay(smi);
 
 		/* clocking */
-		gpio_set_value(sck, 1);
+		gpiod_set_raw_value(sck, 1);
 		rtl8366_smi_clk_delay(smi);
-		u = !!gpio_get_value(sda);
-		gpio_set_value(sck, 0);
+		u = !!gpiod_get_raw_value(sda);
+		gpiod_set_raw_value(sck, 0);
 
 		*data |= (u << (len - 1));
 	}
 
-	gpio_direction_output(sda, 0);
+	gpiod_direction_output_raw(sda, 0);
 }
 
 static int rtl8366_smi_wait_for_ack(struct rtl8366_smi *smi)
@@ -201,13 +211,10 @@ static int rtl8366_smi_read_byte1(struct rtl8366_smi *smi, u8 *data)
 
 static int __rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 {
-	unsigned long flags;
 	u8 lo = 0;
 	u8 hi = 0;
 	int ret;
 
-	spin_lock_irqsave(&smi->lock, flags);
-
 	rtl8366_smi_start(smi);
 
 	/* send READ command */
@@ -236,10 +243,119 @@ static int __rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 
  out:
 	rtl8366_smi_stop(smi);
-	spin_unlock_irqrestore(&smi->lock, flags);
 
 	return ret;
 }
+
+static int __rtl8366_smi_write_reg(struct rtl8366_smi *smi,
+				   u32 addr, u32 data, bool ack)
+{
+	int ret;
+
+	rtl8366_smi_start(smi);
+
+	/* send WRITE command */
+	ret = rtl8366_smi_write_byte(smi, smi->cmd_write);
+	if (ret)
+		goto out;
+
+	/* set ADDR[7:0] */
+	ret = rtl8366_smi_write_byte(smi, addr & 0xff);
+	if (ret)
+		goto out;
+
+	/* set ADDR[15:8] */
+	ret = rtl8366_smi_write_byte(smi, addr >> 8);
+	if (ret)
+		goto out;
+
+	/* write DATA[7:0] */
+	ret = rtl8366_smi_write_byte(smi, data & 0xff);
+	if (ret)
+		goto out;
+
+	/* write DATA[15:8] */
+	if (ack)
+		ret = rtl8366_smi_write_byte(smi, data >> 8);
+	else
+		ret = rtl8366_smi_write_byte_noack(smi, data >> 8);
+	if (ret)
+		goto out;
+
+	ret = 0;
+
+ out:
+	rtl8366_smi_stop(smi);
+
+	return ret;
+}
+
+static int rtl8366_smi_gpio_init(struct rtl8366_smi *smi, const char *name)
+{
+	int err;
+
+	err = gpio_request(smi->gpio_sda, name);
+	if (err) {
+		printk(KERN_ERR "rtl8366_smi: gpio_request failed for %u, err=%d\n",
+			smi->gpio_sda, err);
+		return err;
+	}
+
+	err = gpio_request(smi->gpio_sck, name);
+	if (err) {
+		printk(KERN_ERR "rtl8366_smi: gpio_request failed for %u, err=%d\n",
+			smi->gpio_sck, err);
+		gpio_free(smi->gpio_sda);
+		return err;
+	}
+
+	smi->sda = gpio_to_desc(smi->gpio_sda);
+	smi->sck = gpio_to_desc(smi->gpio_sck);
+	spin_lock_init(&smi->lock);
+
+	return 0;
+}
+
+static void rtl8366_smi_gpio_cleanup(struct rtl8366_smi *smi)
+{
+	gpio_free(smi->gpio_sck);
+	gpio_free(smi->gpio_sda);
+}
+
+/*
+ * Interrupts are only kept off for one register access at a time, a
+ * long batch must not hold them off for milliseconds.
+ */
+static int rtl8366_smi_gpio_xfer(struct rtl8366_smi *smi,
+				 struct rtl8366_smi_xfer *xfer,
+				 unsigned int count)
+{
+	unsigned long flags;
+	int err = 0;
+
+	for (; count > 0 && !err; count--, xfer++) {
+		spin_lock_irqsave(&smi->lock, flags);
+
+		if (xfer->write)
+			err = __rtl8366_smi_write_reg(smi, xfer->addr,
+						      xfer->data, !xfer->noack);
+		else
+			err = __rtl8366_smi_read_reg(smi, xfer->addr,
+						     &xfer->data);
+
+		spin_unlock_irqrestore(&smi->lock, flags);
+	}
+
+	return err;
+}
+
+static const struct rtl8366_smi_transport rtl8366_smi_gpio_transport = {
+	.name		= "gpio",
+	.init		= rtl8366_smi_gpio_init,
+	.cleanup	= rtl8366_smi_gpio_cleanup,
+	.xfer		= rtl8366_smi_gpio_xfer,
+};
+
 /* Read/write via mdiobus */
 #define MDC_MDIO_CTRL0_REG		31
 #define MDC_MDIO_START_REG		29
@@ -254,14 +370,12 @@ static int __rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 #define MDC_MDIO_WRITE_OP		0x0003
 #define MDC_REALTEK_PHY_ADDR		0x0
 
-int __rtl8366_mdio_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
+static int __rtl8366_mdio_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 {
 	u32 phy_id = MDC_REALTEK_PHY_ADDR;
 	struct mii_bus *mbus = smi->ext_mbus;
+	int ret;
 
-	BUG_ON(in_interrupt());
-
-	mutex_lock(&mbus->mdio_lock);
 	/* Write Start command to register 29 */
 	mbus->write(mbus, phy_id, MDC_MDIO_START_REG, MDC_MDIO_START_OP);
 
@@ -281,12 +395,14 @@ int __rtl8366_mdio_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
 	mbus->write(mbus, phy_id, MDC_MDIO_CTRL1_REG, MDC_MDIO_READ_OP);
 
 	/* Write Start command to register 29 */
-	mbus->write(smi->ext_mbus, phy_id, MDC_MDIO_START_REG, MDC_MDIO_START_OP);
+	mbus->write(mbus, phy_id, MDC_MDIO_START_REG, MDC_MDIO_START_OP);
 
 	/* Read data from register 25 */
-	*data = mbus->read(mbus, phy_id, MDC_MDIO_DATA_READ_REG);
+	ret = mbus->read(mbus, phy_id, MDC_MDIO_DATA_READ_REG);
+	if (ret < 0)
+		return ret;
 
-	mutex_unlock(&mbus->mdio_lock);
+	*data = ret;
 
 	return 0;
 }
@@ -296,10 +412,6 @@ static int __rtl8366_mdio_write_reg(struct rtl8366_smi *smi, u32 addr, u32 data)
 	u32 phy_id = MDC_REALTEK_PHY_ADDR;
 	struct mii_bus *mbus = smi->ext_mbus;
 
-	BUG_ON(in_interrupt());
-
-	mutex_lock(&mbus->mdio_lock);
-
 	/* Write Start command to register 29 */
 	mbus->write(mbus, phy_id, MDC_MDIO_START_REG, MDC_MDIO_START_OP);
 
@@ -322,80 +434,110 @@ static int __rtl8366_mdio_write_reg(struct rtl8366_smi *smi, u32 addr, u32 data)
 	mbus->write(mbus, phy_id, MDC_MDIO_START_REG, MDC_MDIO_START_OP);
 
 	/* Write data control code to register 21 */
-	mbus->write(mbus, phy_id, MDC_MDIO_CTRL1_REG, MDC_MDIO_WRITE_OP);
+	return mbus->write(mbus, phy_id, MDC_MDIO_CTRL1_REG, MDC_MDIO_WRITE_OP);
+}
+
+/* The whole batch is done with the MDIO bus lock taken once */
+static int rtl8366_smi_mdio_xfer(struct rtl8366_smi *smi,
+				 struct rtl8366_smi_xfer *xfer,
+				 unsigned int count)
+{
+	struct mii_bus *mbus = smi->ext_mbus;
+	int err = 0;
+
+	BUG_ON(in_interrupt());
+
+	mutex_lock(&mbus->mdio_lock);
+
+	for (; count > 0 && !err; count--, xfer++) {
+		if (xfer->write)
+			err = __rtl8366_mdio_write_reg(smi, xfer->addr,
+						       xfer->data);
+		else
+			err = __rtl8366_mdio_read_reg(smi, xfer->addr,
+						      &xfer->data);
+	}
 
 	mutex_unlock(&mbus->mdio_lock);
-	return 0;
+
+	return err < 0 ? err : 0;
 }
 
-int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
+static const struct rtl8366_smi_transport rtl8366_smi_mdio_transport = {
+	.name		= "mdio",
+	.xfer		= rtl8366_smi_mdio_xfer,
+};
+
+#ifdef CONFIG_RTL8366_SMI_DEBUG_FS
+static void rtl8366_smi_account(struct rtl8366_smi *smi, unsigned int count,
+				u64 start, int err)
 {
-	if (smi->ext_mbus)
-		return __rtl8366_mdio_read_reg(smi, addr, data);
-	else
-		return __rtl8366_smi_read_reg(smi, addr, data);
+	struct rtl8366_smi_stats *st = &smi->stats;
+	u64 ns = ktime_get_ns() - start;
+
+	st->batches++;
+	st->xfers += count;
+	st->time_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	if (err)
+		st->errors++;
 }
-EXPORT_SYMBOL_GPL(rtl8366_smi_read_reg);
+#else
+static inline void rtl8366_smi_account(struct rtl8366_smi *smi,
+				       unsigned int count, u64 start, int err) {}
+#endif
 
-static int __rtl8366_smi_write_reg(struct rtl8366_smi *smi,
-				   u32 addr, u32 data, bool ack)
+/*
+ * Run a list of register accesses back to back on the transport. Read
+ * results are stored in the data field of each entry. Processing stops
+ * at the first failing access.
+ */
+int rtl8366_smi_xfer(struct rtl8366_smi *smi, struct rtl8366_smi_xfer *xfer,
+		     unsigned int count)
 {
-	unsigned long flags;
-	int ret;
-
-	spin_lock_irqsave(&smi->lock, flags);
-
-	rtl8366_smi_start(smi);
-
-	/* send WRITE command */
-	ret = rtl8366_smi_write_byte(smi, smi->cmd_write);
-	if (ret)
-		goto out;
+	u64 start = 0;
+	int err;
 
-	/* set ADDR[7:0] */
-	ret = rtl8366_smi_write_byte(smi, addr & 0xff);
-	if (ret)
-		goto out;
+	if (IS_ENABLED(CONFIG_RTL8366_SMI_DEBUG_FS))
+		start = ktime_get_ns();
 
-	/* set ADDR[15:8] */
-	ret = rtl8366_smi_write_byte(smi, addr >> 8);
-	if (ret)
-		goto out;
+	err = smi->transport->xfer(smi, xfer, count);
 
-	/* write DATA[7:0] */
-	ret = rtl8366_smi_write_byte(smi, data & 0xff);
-	if (ret)
-		goto out;
+	rtl8366_smi_account(smi, count, start, err);
 
-	/* write DATA[15:8] */
-	if (ack)
-		ret = rtl8366_smi_write_byte(smi, data >> 8);
-	else
-		ret = rtl8366_smi_write_byte_noack(smi, data >> 8);
-	if (ret)
-		goto out;
+	return err;
+}
+EXPORT_SYMBOL_GPL(rtl8366_smi_xfer);
 
-	ret = 0;
+int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data)
+{
+	struct rtl8366_smi_xfer xfer = RTL8366_SMI_XFER_RD(addr);
+	int err;
 
- out:
-	rtl8366_smi_stop(smi);
-	spin_unlock_irqrestore(&smi->lock, flags);
+	err = rtl8366_smi_xfer(smi, &xfer, 1);
+	if (!err)
+		*data = xfer.data;
 
-	return ret;
+	return err;
 }
+EXPORT_SYMBOL_GPL(rtl8366_smi_read_reg);
 
 int rtl8366_smi_write_reg(struct rtl8366_smi *smi, u32 addr, u32 data)
 {
-	if (smi->ext_mbus)
-		return __rtl8366_mdio_write_reg(smi, addr, data);
-	else
-		return __rtl8366_smi_write_reg(smi, addr, data, true);
+	struct rtl8366_smi_xfer xfer = RTL8366_SMI_XFER_WR(addr, data);
+
+	return rtl8366_smi_xfer(smi, &xfer, 1);
 }
 EXPORT_SYMBOL_GPL(rtl8366_smi_write_reg);
 
 int rtl8366_smi_write_reg_noack(struct rtl8366_smi *smi, u32 addr, u32 data)
 {
-	return __rtl8366_smi_write_reg(smi, addr, data, false);
+	struct rtl8366_smi_xfer xfer = RTL8366_SMI_XFER_WR(addr, data);
+
+	xfer.noack = 1;
+
+	return rtl8366_smi_xfer(smi, &xfer, 1);
 }
 EXPORT_SYMBOL_GPL(rtl8366_smi_write_reg_noack);
 
@@ -898,6 +1040,45 @@ static ssize_t rtl8366_read_debugfs_mibs(struct file *file,
 	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
 }
 
+static ssize_t rtl8366_read_debugfs_stats(struct file *file,
+					  char __user *user_buf,
+					  size_t count, loff_t *ppos)
+{
+	struct rtl8366_smi *smi = file->private_data;
+	struct rtl8366_smi_stats *st = &smi->stats;
+	char *buf = smi->buf;
+	int len = 0;
+
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"transport: %s\n", smi->transport->name);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"accesses:  %llu\n", st->xfers);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"batches:   %llu\n", st->batches);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"errors:    %llu\n", st->errors);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"time:      %llu ns\n", st->time_ns);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"avg:       %llu ns/access\n",
+			st->xfers ? div64_u64(st->time_ns, st->xfers) : 0);
+	len += snprintf(buf + len, sizeof(smi->buf) - len,
+			"max:       %llu ns/batch\n", st->max_ns);
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t rtl8366_write_debugfs_stats(struct file *file,
+					   const char __user *user_buf,
+					   size_t count, loff_t *ppos)
+{
+	struct rtl8366_smi *smi = file->private_data;
+
+	memset(&smi->stats, 0, sizeof(smi->stats));
+
+	return count;
+}
+
 static const struct file_operations fops_rtl8366_regs = {
 	.read	= rtl8366_read_debugfs_reg,
 	.write	= rtl8366_write_debugfs_reg,
@@ -929,6 +1110,13 @@ static const struct file_operations fops_rtl8366_mibs = {
 	.owner = THIS_MODULE
 };
 
+static const struct file_operations fops_rtl8366_stats = {
+	.read	= rtl8366_read_debugfs_stats,
+	.write	= rtl8366_write_debugfs_stats,
+	.open	= rtl8366_debugfs_open,
+	.owner	= THIS_MODULE
+};
+
 static void rtl8366_debugfs_init(struct rtl8366_smi *smi)
 {
 	struct dentry *node;
@@ -994,9 +1182,17 @@ static void rtl8366_debugfs_init(struct rtl8366_smi *smi)
 
 	node = debugfs_create_file("mibs", S_IRUSR, smi->debugfs_root, smi,
 				   &fops_rtl8366_mibs);
-	if (!node)
+	if (!node) {
 		dev_err(smi->parent, "Creating debugfs file '%s' failed\n",
 			"mibs");
+		return;
+	}
+
+	node = debugfs_create_file("smi_stats", S_IRUSR | S_IWUSR, root, smi,
+				   &fops_rtl8366_stats);
+	if (!node)
+		dev_err(smi->parent, "Creating debugfs file '%s' failed\n",
+			"smi_stats");
 }
 
 static void rtl8366_debugfs_remove(struct rtl8366_smi *smi)
@@ -1380,24 +1576,17 @@ static int __rtl8366_smi_init(struct rtl8366_smi *smi, const char *name)
 {
 	int err;
 
-	if (!smi->ext_mbus) {
-		err = gpio_request(smi->gpio_sda, name);
-		if (err) {
-			printk(KERN_ERR "rtl8366_smi: gpio_request failed for %u, err=%d\n",
-				smi->gpio_sda, err);
-			goto err_out;
-		}
+	if (smi->ext_mbus)
+		smi->transport = &rtl8366_smi_mdio_transport;
+	else
+		smi->transport = &rtl8366_smi_gpio_transport;
 
-		err = gpio_request(smi->gpio_sck, name);
-		if (err) {
-			printk(KERN_ERR "rtl8366_smi: gpio_request failed for %u, err=%d\n",
-				smi->gpio_sck, err);
-			goto err_free_sda;
-		}
+	if (smi->transport->init) {
+		err = smi->transport->init(smi, name);
+		if (err)
+			return err;
 	}
 
-	spin_lock_init(&smi->lock);
-
 	/* start the switch */
 	if (smi->hw_reset) {
 		smi->hw_reset(smi, false);
@@ -1405,11 +1594,6 @@ static int __rtl8366_smi_init(struct rtl8366_smi *smi, const char *name)
 	}
 
 	return 0;
-
- err_free_sda:
-	gpio_free(smi->gpio_sda);
- err_out:
-	return err;
 }
 
 static void __rtl8366_smi_cleanup(struct rtl8366_smi *smi)
@@ -1417,10 +1601,8 @@ static void __rtl8366_smi_cleanup(struct rtl8366_smi *smi)
 	if (smi->hw_reset)
 		smi->hw_reset(smi, true);
 
-	if (!smi->ext_mbus) {
-		gpio_free(smi->gpio_sck);
-		gpio_free(smi->gpio_sda);
-	}
+	if (smi->transport->cleanup)
+		smi->transport->cleanup(smi);
 }
 
 enum rtl8366_type rtl8366_smi_detect(struct rtl8366_platform_data *pdata)
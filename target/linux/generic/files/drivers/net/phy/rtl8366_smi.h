@@ -17,7 +17,9 @@
 #include <linux/reset.h>
 
 struct rtl8366_smi_ops;
+struct rtl8366_smi_transport;
 struct rtl8366_vlan_ops;
+struct gpio_desc;
 struct mii_bus;
 struct dentry;
 struct inode;
@@ -30,10 +32,44 @@ struct rtl8366_mib_counter {
 	const char	*name;
 };
 
+/*
+ * One register access of a batch, see rtl8366_smi_xfer(). Reads return
+ * their result in @data.
+ */
+struct rtl8366_smi_xfer {
+	u32	addr;
+	u32	data;
+	u8	write;
+	u8	noack;
+};
+
+#define RTL8366_SMI_XFER_RD(_addr)		{ .addr = (_addr) }
+#define RTL8366_SMI_XFER_WR(_addr, _data)	\
+	{ .addr = (_addr), .data = (_data), .write = 1 }
+
+struct rtl8366_smi_transport {
+	const char	*name;
+	int	(*init)(struct rtl8366_smi *smi, const char *name);
+	void	(*cleanup)(struct rtl8366_smi *smi);
+	int	(*xfer)(struct rtl8366_smi *smi, struct rtl8366_smi_xfer *xfer,
+			unsigned int count);
+};
+
+struct rtl8366_smi_stats {
+	u64	batches;
+	u64	xfers;
+	u64	errors;
+	u64	time_ns;
+	u64	max_ns;
+};
+
 struct rtl8366_smi {
 	struct device		*parent;
 	unsigned int		gpio_sda;
 	unsigned int		gpio_sck;
+	struct gpio_desc	*sda;
+	struct gpio_desc	*sck;
+	const struct rtl8366_smi_transport *transport;
 	void			(*hw_reset)(struct rtl8366_smi *smi, bool active);
 	unsigned int		clk_delay;	/* ns */
 	u8			cmd_read;
@@ -62,6 +98,7 @@ struct rtl8366_smi {
 	struct dentry           *debugfs_root;
 	u16			dbg_reg;
 	u8			dbg_vlan_4k_page;
+	struct rtl8366_smi_stats stats;
 #endif
 	struct mii_bus		*ext_mbus;
 };
@@ -110,6 +147,8 @@ struct rtl8366_smi_ops {
 struct rtl8366_smi *rtl8366_smi_alloc(struct device *parent);
 int rtl8366_smi_init(struct rtl8366_smi *smi);
 void rtl8366_smi_cleanup(struct rtl8366_smi *smi);
+int rtl8366_smi_xfer(struct rtl8366_smi *smi, struct rtl8366_smi_xfer *xfer,
+		     unsigned int count);
 int rtl8366_smi_write_reg(struct rtl8366_smi *smi, u32 addr, u32 data);
 int rtl8366_smi_write_reg_noack(struct rtl8366_smi *smi, u32 addr, u32 data);
 int rtl8366_smi_read_reg(struct rtl8366_smi *smi, u32 addr, u32 *data);
@@ -1030,6 +1030,7 @@ static int rtl8367b_setup(struct rtl8366_smi *smi)
 static int rtl8367b_get_mib_counter(struct rtl8366_smi *smi, int counter,
 				    int port, unsigned long long *val)
 {
+	struct rtl8366_smi_xfer xfer[2 + 4];
 	struct rtl8366_mib_counter *mib;
 	int offset;
 	int i;
@@ -1044,14 +1045,31 @@ static int rtl8367b_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	mib = &rtl8367b_mib_counters[counter];
 	addr = RTL8367B_MIB_COUNTER_PORT_OFFSET * port + mib->offset;
 
+	if (mib->length == 4)
+		offset = 3;
+	else
+		offset = (mib->offset + 1) % 4;
+
 	/*
 	 * Writing access counter address first
-	 * then ASIC will prepare 64bits counter wait for being retrived
+	 * then ASIC will prepare 64bits counter wait for being retrived.
+	 * The counter words are read in the same batch, they are only
+	 * used if the control register says the counter was ready.
 	 */
-	REG_WR(smi, RTL8367B_MIB_ADDRESS_REG, addr >> 2);
+	xfer[0] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_WR(RTL8367B_MIB_ADDRESS_REG, addr >> 2);
+	xfer[1] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_RD(RTL8367B_MIB_CTRL0_REG(0));
+	for (i = 0; i < mib->length; i++)
+		xfer[2 + i] = (struct rtl8366_smi_xfer)
+			RTL8366_SMI_XFER_RD(RTL8367B_MIB_COUNTER_REG(offset - i));
+
+	err = rtl8366_smi_xfer(smi, xfer, 2 + mib->length);
+	if (err)
+		return err;
 
 	/* read MIB control register */
-	REG_RD(smi, RTL8367B_MIB_CTRL0_REG(0), &data);
+	data = xfer[1].data;
 
 	if (data & RTL8367B_MIB_CTRL0_BUSY_MASK)
 		return -EBUSY;
@@ -1059,16 +1077,9 @@ static int rtl8367b_get_mib_counter(struct rtl8366_smi *smi, int counter,
 	if (data & RTL8367B_MIB_CTRL0_RESET_MASK)
 		return -EIO;
 
-	if (mib->length == 4)
-		offset = 3;
-	else
-		offset = (mib->offset + 1) % 4;
-
 	mibvalue = 0;
-	for (i = 0; i < mib->length; i++) {
-		REG_RD(smi, RTL8367B_MIB_COUNTER_REG(offset - i), &data);
-		mibvalue = (mibvalue << 16) | (data & 0xFFFF);
-	}
+	for (i = 0; i < mib->length; i++)
+		mibvalue = (mibvalue << 16) | (xfer[2 + i].data & 0xFFFF);
 
 	*val = mibvalue;
 	return 0;
@@ -1077,7 +1088,8 @@ static int rtl8367b_get_mib_counter(struct rtl8366_smi *smi, int counter,
 static int rtl8367b_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 				struct rtl8366_vlan_4k *vlan4k)
 {
-	u32 data[RTL8367B_TA_VLAN_NUM_WORDS];
+	struct rtl8366_smi_xfer xfer[2 + RTL8367B_TA_VLAN_NUM_WORDS];
+	u32 data0, data1;
 	int err;
 	int i;
 
@@ -1087,20 +1099,31 @@ static int rtl8367b_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 		return -EINVAL;
 
 	/* write VID */
-	REG_WR(smi, RTL8367B_TA_ADDR_REG, vid);
+	xfer[0] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_WR(RTL8367B_TA_ADDR_REG, vid);
 
 	/* write table access control word */
-	REG_WR(smi, RTL8367B_TA_CTRL_REG, RTL8367B_TA_CTRL_CVLAN_READ);
+	xfer[1] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_WR(RTL8367B_TA_CTRL_REG,
+				    RTL8367B_TA_CTRL_CVLAN_READ);
 
-	for (i = 0; i < ARRAY_SIZE(data); i++)
-		REG_RD(smi, RTL8367B_TA_RDDATA_REG(i), &data[i]);
+	for (i = 0; i < RTL8367B_TA_VLAN_NUM_WORDS; i++)
+		xfer[2 + i] = (struct rtl8366_smi_xfer)
+			RTL8366_SMI_XFER_RD(RTL8367B_TA_RDDATA_REG(i));
+
+	err = rtl8366_smi_xfer(smi, xfer, ARRAY_SIZE(xfer));
+	if (err)
+		return err;
+
+	data0 = xfer[2].data;
+	data1 = xfer[3].data;
 
 	vlan4k->vid = vid;
-	vlan4k->member = (data[0] >> RTL8367B_TA_VLAN0_MEMBER_SHIFT) &
+	vlan4k->member = (data0 >> RTL8367B_TA_VLAN0_MEMBER_SHIFT) &
 			 RTL8367B_TA_VLAN0_MEMBER_MASK;
-	vlan4k->untag = (data[0] >> RTL8367B_TA_VLAN0_UNTAG_SHIFT) &
+	vlan4k->untag = (data0 >> RTL8367B_TA_VLAN0_UNTAG_SHIFT) &
 			RTL8367B_TA_VLAN0_UNTAG_MASK;
-	vlan4k->fid = (data[1] >> RTL8367B_TA_VLAN1_FID_SHIFT) &
+	vlan4k->fid = (data1 >> RTL8367B_TA_VLAN1_FID_SHIFT) &
 		      RTL8367B_TA_VLAN1_FID_MASK;
 
 	return 0;
@@ -1109,8 +1132,8 @@ static int rtl8367b_get_vlan_4k(struct rtl8366_smi *smi, u32 vid,
 static int rtl8367b_set_vlan_4k(struct rtl8366_smi *smi,
 				const struct rtl8366_vlan_4k *vlan4k)
 {
+	struct rtl8366_smi_xfer xfer[RTL8367B_TA_VLAN_NUM_WORDS + 2];
 	u32 data[RTL8367B_TA_VLAN_NUM_WORDS];
-	int err;
 	int i;
 
 	if (vlan4k->vid >= RTL8367B_NUM_VIDS ||
@@ -1129,16 +1152,20 @@ static int rtl8367b_set_vlan_4k(struct rtl8366_smi *smi,
 		  RTL8367B_TA_VLAN1_FID_SHIFT;
 
 	for (i = 0; i < ARRAY_SIZE(data); i++)
-		REG_WR(smi, RTL8367B_TA_WRDATA_REG(i), data[i]);
+		xfer[i] = (struct rtl8366_smi_xfer)
+			RTL8366_SMI_XFER_WR(RTL8367B_TA_WRDATA_REG(i), data[i]);
 
 	/* write VID */
-	REG_WR(smi, RTL8367B_TA_ADDR_REG,
-	       vlan4k->vid & RTL8367B_TA_VLAN_VID_MASK);
+	xfer[i++] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_WR(RTL8367B_TA_ADDR_REG,
+				    vlan4k->vid & RTL8367B_TA_VLAN_VID_MASK);
 
 	/* write table access control word */
-	REG_WR(smi, RTL8367B_TA_CTRL_REG, RTL8367B_TA_CTRL_CVLAN_WRITE);
+	xfer[i++] = (struct rtl8366_smi_xfer)
+		RTL8366_SMI_XFER_WR(RTL8367B_TA_CTRL_REG,
+				    RTL8367B_TA_CTRL_CVLAN_WRITE);
 
-	return 0;
+	return rtl8366_smi_xfer(smi, xfer, i);
 }
 
 static int rtl8367b_get_vlan_mc(struct rtl8366_smi *smi, u32 index,
@@ -29,6 +29,16 @@
 
 #define SWCONFIG_DEVNAME	"switch%d"
 
+/* Maximum age of cached port state before the driver is asked again */
+#define SWCONFIG_LINK_POLL_INTERVAL	(HZ / 2)
+#define SWCONFIG_LINK_IRQ_INTERVAL	(30 * HZ)
+#define SWCONFIG_STATS_INTERVAL		(HZ / 10)
+
+enum {
+	SWITCH_PORT_LINK_VALID,
+	SWITCH_PORT_STATS_VALID,
+};
+
 #include "swconfig_leds.c"
 
 MODULE_AUTHOR("Felix Fietkau <nbd@nbd.name>");
@@ -55,6 +65,127 @@ struct swconfig_callback {
 	int args[4];
 };
 
+/* port status cache */
+
+/*
+ * Link state and counters are read through a per-port cache, so LED
+ * triggers and userspace polling do not each hit the switch bus. Link
+ * state of ports in link_irq_mask is kept until the driver reports a
+ * change, other ports are refreshed at most every
+ * SWCONFIG_LINK_POLL_INTERVAL.
+ */
+int
+switch_get_port_link(struct switch_dev *dev, int port,
+		     struct switch_port_link *link)
+{
+	struct switch_port_status *st;
+	unsigned long interval;
+	int ret = 0;
+
+	if (!dev->ops->get_port_link)
+		return -EOPNOTSUPP;
+
+	if (port < 0 || port >= dev->ports)
+		return -EINVAL;
+
+	st = &dev->port_status[port];
+
+	if (port < 32 && (dev->link_irq_mask & BIT(port)))
+		interval = SWCONFIG_LINK_IRQ_INTERVAL;
+	else
+		interval = SWCONFIG_LINK_POLL_INTERVAL;
+
+	mutex_lock(&dev->status_lock);
+
+	/*
+	 * The valid bit is set before asking the driver, a link change
+	 * reported meanwhile clears it again and forces another read.
+	 */
+	if (test_and_set_bit(SWITCH_PORT_LINK_VALID, &st->flags) &&
+	    time_before(jiffies, st->link_time + interval))
+		goto out;
+
+	memset(&st->link, 0, sizeof(st->link));
+	ret = dev->ops->get_port_link(dev, port, &st->link);
+	if (ret)
+		clear_bit(SWITCH_PORT_LINK_VALID, &st->flags);
+
+	st->link_time = jiffies;
+
+out:
+	if (!ret)
+		*link = st->link;
+
+	mutex_unlock(&dev->status_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(switch_get_port_link);
+
+int
+switch_get_port_stats(struct switch_dev *dev, int port,
+		      struct switch_port_stats *stats)
+{
+	struct switch_port_status *st;
+	int ret = 0;
+
+	if (!dev->ops->get_port_stats)
+		return -EOPNOTSUPP;
+
+	if (port < 0 || port >= dev->ports)
+		return -EINVAL;
+
+	st = &dev->port_status[port];
+
+	mutex_lock(&dev->status_lock);
+
+	if (test_and_set_bit(SWITCH_PORT_STATS_VALID, &st->flags) &&
+	    time_before(jiffies, st->stats_time + SWCONFIG_STATS_INTERVAL))
+		goto out;
+
+	memset(&st->stats, 0, sizeof(st->stats));
+	ret = dev->ops->get_port_stats(dev, port, &st->stats);
+	if (ret)
+		clear_bit(SWITCH_PORT_STATS_VALID, &st->flags);
+
+	st->stats_time = jiffies;
+
+out:
+	if (!ret)
+		*stats = st->stats;
+
+	mutex_unlock(&dev->status_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(switch_get_port_stats);
+
+/*
+ * Called by switch drivers when the link of a port may have changed,
+ * typically from their link interrupt handling. Safe in atomic context.
+ */
+void
+switch_port_link_changed(struct switch_dev *dev, int port)
+{
+	if (!dev->port_status || port < 0 || port >= dev->ports)
+		return;
+
+	clear_bit(SWITCH_PORT_LINK_VALID, &dev->port_status[port].flags);
+	swconfig_trig_link_changed(dev);
+}
+EXPORT_SYMBOL_GPL(switch_port_link_changed);
+
+static void
+swconfig_flush_port_status(struct switch_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->ports; i++) {
+		clear_bit(SWITCH_PORT_LINK_VALID, &dev->port_status[i].flags);
+		clear_bit(SWITCH_PORT_STATS_VALID, &dev->port_status[i].flags);
+	}
+}
+
 /* defaults */
 
 static int
@@ -132,10 +263,15 @@ static int
 swconfig_set_link(struct switch_dev *dev, const struct switch_attr *attr,
 			struct switch_val *val)
 {
+	int ret;
+
 	if (!dev->ops->set_port_link)
 		return -EOPNOTSUPP;
 
-	return dev->ops->set_port_link(dev, val->port_vlan, val->value.link);
+	ret = dev->ops->set_port_link(dev, val->port_vlan, val->value.link);
+	switch_port_link_changed(dev, val->port_vlan);
+
+	return ret;
 }
 
 static int
@@ -151,29 +287,39 @@ swconfig_get_link(struct switch_dev *dev, const struct switch_attr *attr,
 		return -EOPNOTSUPP;
 
 	memset(link, 0, sizeof(*link));
-	return dev->ops->get_port_link(dev, val->port_vlan, link);
+	return switch_get_port_link(dev, val->port_vlan, link);
 }
 
 static int
 swconfig_apply_config(struct switch_dev *dev, const struct switch_attr *attr,
 			struct switch_val *val)
 {
+	int ret;
+
 	/* don't complain if not supported by the switch driver */
 	if (!dev->ops->apply_config)
 		return 0;
 
-	return dev->ops->apply_config(dev);
+	ret = dev->ops->apply_config(dev);
+	swconfig_flush_port_status(dev);
+
+	return ret;
 }
 
 static int
 swconfig_reset_switch(struct switch_dev *dev, const struct switch_attr *attr,
 			struct switch_val *val)
 {
+	int ret;
+
 	/* don't complain if not supported by the switch driver */
 	if (!dev->ops->reset_switch)
 		return 0;
 
-	return dev->ops->reset_switch(dev);
+	ret = dev->ops->reset_switch(dev);
+	swconfig_flush_port_status(dev);
+
+	return ret;
 }
 
 enum global_defaults {
@@ -1203,9 +1349,17 @@ register_switch(struct switch_dev *dev, struct net_device *netdev)
 			kfree(dev->portbuf);
 			return -ENOMEM;
 		}
+		dev->port_status = kcalloc(dev->ports,
+				sizeof(struct switch_port_status), GFP_KERNEL);
+		if (!dev->port_status) {
+			kfree(dev->portmap);
+			kfree(dev->portbuf);
+			return -ENOMEM;
+		}
 	}
 	swconfig_defaults_init(dev);
 	mutex_init(&dev->sw_mutex);
+	mutex_init(&dev->status_lock);
 	swconfig_lock();
 	dev->id = ++swdev_id;
 
@@ -1248,6 +1402,8 @@ unregister_switch(struct switch_dev *dev)
 {
 	swconfig_destroy_led_trigger(dev);
 	kfree(dev->portbuf);
+	kfree(dev->port_status);
+	dev->port_status = NULL;
 	mutex_lock(&dev->sw_mutex);
 	swconfig_lock();
 	list_del(&dev->dev_list);
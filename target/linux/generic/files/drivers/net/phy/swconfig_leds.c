@@ -465,7 +465,7 @@ swconfig_led_work_func(struct work_struct *work)
 			struct switch_port_link port_link;
 
 			memset(&port_link, '\0', sizeof(port_link));
-			swdev->ops->get_port_link(swdev, i, &port_link);
+			switch_get_port_link(swdev, i, &port_link);
 
 			if (port_link.link) {
 				link |= port_bit;
@@ -494,7 +494,7 @@ swconfig_led_work_func(struct work_struct *work)
 			struct switch_port_stats port_stats;
 
 			memset(&port_stats, '\0', sizeof(port_stats));
-			swdev->ops->get_port_stats(swdev, i, &port_stats);
+			switch_get_port_stats(swdev, i, &port_stats);
 			sw_trig->port_tx_traffic[i] = port_stats.tx_bytes;
 			sw_trig->port_rx_traffic[i] = port_stats.rx_bytes;
 		}
@@ -508,6 +508,16 @@ swconfig_led_work_func(struct work_struct *work)
 			      SWCONFIG_LED_TIMER_INTERVAL);
 }
 
+/* Refresh the LEDs right away instead of waiting for the next tick */
+static void
+swconfig_trig_link_changed(struct switch_dev *swdev)
+{
+	struct switch_led_trigger *sw_trig = swdev->led_trigger;
+
+	if (sw_trig && sw_trig->port_mask)
+		mod_delayed_work(system_wq, &sw_trig->sw_led_work, 0);
+}
+
 static int
 swconfig_create_led_trigger(struct switch_dev *swdev)
 {
@@ -552,13 +562,18 @@ swconfig_destroy_led_trigger(struct switch_dev *swdev)
 
 	sw_trig = swdev->led_trigger;
 	if (sw_trig) {
-		cancel_delayed_work_sync(&sw_trig->sw_led_work);
+		/* deactivating the LEDs one by one may schedule the work again */
 		led_trigger_unregister(&sw_trig->trig);
+		cancel_delayed_work_sync(&sw_trig->sw_led_work);
+		swdev->led_trigger = NULL;
 		kfree(sw_trig);
 	}
 }
 
 #else /* SWCONFIG_LEDS */
+static inline void
+swconfig_trig_link_changed(struct switch_dev *swdev) { }
+
 static inline int
 swconfig_create_led_trigger(struct switch_dev *swdev) { return 0; }
 
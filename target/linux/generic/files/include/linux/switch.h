@@ -63,6 +63,27 @@ struct switch_port_stats {
 	unsigned long long rx_bytes;
 };
 
+/**
+ * struct switch_port_status - cached port state, internal to swconfig
+ *
+ * @flags: SWITCH_PORT_*_VALID bits
+ * @link_time: jiffies of the last get_port_link call
+ * @stats_time: jiffies of the last get_port_stats call
+ */
+struct switch_port_status {
+	unsigned long flags;
+	unsigned long link_time;
+	unsigned long stats_time;
+	struct switch_port_link link;
+	struct switch_port_stats stats;
+};
+
+int switch_get_port_link(struct switch_dev *dev, int port,
+			 struct switch_port_link *link);
+int switch_get_port_stats(struct switch_dev *dev, int port,
+			  struct switch_port_stats *stats);
+void switch_port_link_changed(struct switch_dev *dev, int port);
+
 /**
  * struct switch_dev_ops - switch driver operations
  *
@@ -119,6 +140,9 @@ struct switch_dev {
 	unsigned int vlans;
 	unsigned int cpu_port;
 
+	/* ports whose link changes are reported via switch_port_link_changed */
+	u32 link_irq_mask;
+
 	/* the following fields are internal for swconfig */
 	unsigned int id;
 	struct list_head dev_list;
@@ -129,6 +153,9 @@ struct switch_dev {
 	struct switch_portmap *portmap;
 	struct switch_port_link linkbuf;
 
+	struct mutex status_lock;
+	struct switch_port_status *port_status;
+
 	char buf[128];
 
 #ifdef CONFIG_SWCONFIG_LEDS
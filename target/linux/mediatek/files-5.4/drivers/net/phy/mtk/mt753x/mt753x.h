@@ -26,6 +26,8 @@
 #define MT753X_DFL_SMI_ADDR	0x1f
 #define MT753X_SMI_ADDR_MASK	0x1f
 
+#define MT753X_PAGE_INVALID	0xffffffff
+
 struct gsw_mt753x;
 
 enum mt753x_model {
@@ -42,6 +44,15 @@ struct mt753x_port_cfg {
 	u32 duplex: 1;
 };
 
+struct mt753x_mdio_stats {
+	u64 reads;		/* 32-bit register reads */
+	u64 writes;		/* 32-bit register writes */
+	u64 frames;		/* MDIO frames put on the bus */
+	u64 page_writes;	/* Page register updates */
+	u64 page_hits;		/* Accesses served by the cached page */
+	u64 errors;		/* Failed MDIO transfers */
+};
+
 struct mt753x_phy {
 	struct gsw_mt753x *gsw;
 	struct net_device netdev;
@@ -56,6 +67,7 @@ struct gsw_mt753x {
 	struct mii_bus *gphy_bus;
 	struct mutex mii_lock;	/* MII access lock */
 	u32 smi_addr;
+	u32 smi_page;		/* Last page written, protected by mdio_lock */
 	u32 phy_base;
 	int direct_phy_access;
 
@@ -83,6 +95,9 @@ struct gsw_mt753x {
 	struct mt753x_vlan_entry vlan_entries[MT753X_NUM_VLANS];
 	struct mt753x_port_entry port_entries[MT753X_NUM_PORTS];
 
+	struct mt753x_mdio_stats mdio_stats;
+	struct dentry *debugfs_dir;
+
 	int (*mii_read)(struct gsw_mt753x *gsw, int phy, int reg);
 	void (*mii_write)(struct gsw_mt753x *gsw, int phy, int reg, u16 val);
 
@@ -114,6 +129,8 @@ void mt753x_lock_gsw(void);
 
 u32 mt753x_reg_read(struct gsw_mt753x *gsw, u32 reg);
 void mt753x_reg_write(struct gsw_mt753x *gsw, u32 reg, u32 val);
+int mt753x_reg_read_bulk(struct gsw_mt753x *gsw, u32 reg, u32 *buf,
+			 unsigned int count);
 
 int mt753x_mii_read(struct gsw_mt753x *gsw, int phy, int reg);
 void mt753x_mii_write(struct gsw_mt753x *gsw, int phy, int reg, u16 val);
@@ -203,6 +220,15 @@ void mt753x_irq_enable(struct gsw_mt753x *gsw);
  *    | 01 | 01 |   11111  |   1  | 0000 | xx |       DATA[31..16]      |
  *    -------------------------------------------------------------------
  *
+ * 3. Page caching
+ *
+ *    The page register keeps its value between accesses, so Phase 1 is
+ *    skipped whenever the page matches the one written last. Registers
+ *    within the same page (16 registers, 64 bytes) then cost two frames
+ *    each. The cached page is dropped on any bus error and on switch
+ *    register reset, and assumes nobody else writes the page register
+ *    behind the driver's back.
+ *
  */
 
 /* Internal Register Address fields */
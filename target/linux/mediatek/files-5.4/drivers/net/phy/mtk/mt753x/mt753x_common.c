@@ -81,6 +81,9 @@ void mt753x_irq_worker(struct work_struct *work)
 		if (physts ^ laststs) {
 			gsw->phy_link_sts ^= BIT(i);
 			display_port_link_status(gsw, i);
+#ifdef CONFIG_SWCONFIG
+			switch_port_link_changed(&gsw->swdev, i);
+#endif
 		}
 	}
 
@@ -9,6 +9,7 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
 #include <linux/reset.h>
 #include <linux/hrtimer.h>
 #include <linux/mii.h>
@@ -35,38 +36,131 @@ static struct mt753x_sw_id *mt753x_sw_ids[] = {
 	&mt7531_id,
 };
 
-u32 mt753x_reg_read(struct gsw_mt753x *gsw, u32 reg)
+/* Raw SMI frame helpers, called with mdio_lock held */
+static int mt753x_smi_read(struct gsw_mt753x *gsw, u32 addr)
 {
-	u32 high, low;
+	int ret;
 
-	mutex_lock(&gsw->host_bus->mdio_lock);
+	gsw->mdio_stats.frames++;
+
+	ret = gsw->host_bus->read(gsw->host_bus, gsw->smi_addr, addr);
+	if (ret < 0) {
+		gsw->mdio_stats.errors++;
+		gsw->smi_page = MT753X_PAGE_INVALID;
+	}
+
+	return ret;
+}
+
+static int mt753x_smi_write(struct gsw_mt753x *gsw, u32 addr, u16 val)
+{
+	int ret;
+
+	gsw->mdio_stats.frames++;
+
+	ret = gsw->host_bus->write(gsw->host_bus, gsw->smi_addr, addr, val);
+	if (ret < 0) {
+		gsw->mdio_stats.errors++;
+		gsw->smi_page = MT753X_PAGE_INVALID;
+	}
+
+	return ret;
+}
+
+static int mt753x_smi_set_page(struct gsw_mt753x *gsw, u32 reg)
+{
+	u32 page = (reg & MT753X_REG_PAGE_ADDR_M) >> MT753X_REG_PAGE_ADDR_S;
+	int ret;
+
+	if (gsw->smi_page == page) {
+		gsw->mdio_stats.page_hits++;
+		return 0;
+	}
+
+	gsw->mdio_stats.page_writes++;
+
+	ret = mt753x_smi_write(gsw, 0x1f, page);
+	if (ret < 0)
+		return ret;
+
+	gsw->smi_page = page;
+
+	return 0;
+}
+
+static int mt753x_smi_reg_read(struct gsw_mt753x *gsw, u32 reg, u32 *val)
+{
+	int low, high;
 
-	gsw->host_bus->write(gsw->host_bus, gsw->smi_addr, 0x1f,
-		(reg & MT753X_REG_PAGE_ADDR_M) >> MT753X_REG_PAGE_ADDR_S);
+	gsw->mdio_stats.reads++;
 
-	low = gsw->host_bus->read(gsw->host_bus, gsw->smi_addr,
-		(reg & MT753X_REG_ADDR_M) >> MT753X_REG_ADDR_S);
+	low = mt753x_smi_set_page(gsw, reg);
+	if (low < 0)
+		return low;
 
-	high = gsw->host_bus->read(gsw->host_bus, gsw->smi_addr, 0x10);
+	low = mt753x_smi_read(gsw, (reg & MT753X_REG_ADDR_M) >>
+			      MT753X_REG_ADDR_S);
+	if (low < 0)
+		return low;
 
+	high = mt753x_smi_read(gsw, 0x10);
+	if (high < 0)
+		return high;
+
+	*val = ((u32)high << 16) | (low & 0xffff);
+
+	return 0;
+}
+
+u32 mt753x_reg_read(struct gsw_mt753x *gsw, u32 reg)
+{
+	u32 val = 0;
+
+	mutex_lock(&gsw->host_bus->mdio_lock);
+	mt753x_smi_reg_read(gsw, reg, &val);
 	mutex_unlock(&gsw->host_bus->mdio_lock);
 
-	return (high << 16) | (low & 0xffff);
+	return val;
 }
 
 void mt753x_reg_write(struct gsw_mt753x *gsw, u32 reg, u32 val)
 {
 	mutex_lock(&gsw->host_bus->mdio_lock);
 
-	gsw->host_bus->write(gsw->host_bus, gsw->smi_addr, 0x1f,
-		(reg & MT753X_REG_PAGE_ADDR_M) >> MT753X_REG_PAGE_ADDR_S);
+	gsw->mdio_stats.writes++;
+
+	if (!mt753x_smi_set_page(gsw, reg) &&
+	    !mt753x_smi_write(gsw, (reg & MT753X_REG_ADDR_M) >>
+			      MT753X_REG_ADDR_S, val & 0xffff))
+		mt753x_smi_write(gsw, 0x10, val >> 16);
+
+	/* Do not trust the page register across a register reset */
+	if (reg == SYS_CTRL && (val & SW_REG_RST))
+		gsw->smi_page = MT753X_PAGE_INVALID;
+
+	mutex_unlock(&gsw->host_bus->mdio_lock);
+}
+
+/* Read @count consecutive registers starting at @reg in one bus session.
+ * The page register is only rewritten when the range crosses a page.
+ */
+int mt753x_reg_read_bulk(struct gsw_mt753x *gsw, u32 reg, u32 *buf,
+			 unsigned int count)
+{
+	unsigned int i;
+	int ret = 0;
 
-	gsw->host_bus->write(gsw->host_bus, gsw->smi_addr,
-		(reg & MT753X_REG_ADDR_M) >> MT753X_REG_ADDR_S, val & 0xffff);
+	mutex_lock(&gsw->host_bus->mdio_lock);
 
-	gsw->host_bus->write(gsw->host_bus, gsw->smi_addr, 0x10, val >> 16);
+	for (i = 0; i < count; i++) {
+		ret = mt753x_smi_reg_read(gsw, reg + i * 4, &buf[i]);
+		if (ret < 0)
+			break;
+	}
 
 	mutex_unlock(&gsw->host_bus->mdio_lock);
+
+	return ret;
 }
 
 /* Indirect MDIO clause 22/45 access */
@@ -416,6 +510,25 @@ static int mt753x_hw_reset(struct gsw_mt753x *gsw)
 	return 0;
 }
 
+static void mt753x_debugfs_init(struct gsw_mt753x *gsw)
+{
+	struct mt753x_mdio_stats *st = &gsw->mdio_stats;
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(gsw->dev), NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_u64("reads", 0444, dir, &st->reads);
+	debugfs_create_u64("writes", 0444, dir, &st->writes);
+	debugfs_create_u64("frames", 0444, dir, &st->frames);
+	debugfs_create_u64("page_writes", 0444, dir, &st->page_writes);
+	debugfs_create_u64("page_hits", 0444, dir, &st->page_hits);
+	debugfs_create_u64("errors", 0444, dir, &st->errors);
+
+	gsw->debugfs_dir = dir;
+}
+
 static irqreturn_t mt753x_irq_handler(int irq, void *dev)
 {
 	struct gsw_mt753x *gsw = dev;
@@ -453,6 +566,7 @@ static int mt753x_probe(struct platform_device *pdev)
 
 	gsw->host_bus = mdio_bus;
 	gsw->dev = &pdev->dev;
+	gsw->smi_page = MT753X_PAGE_INVALID;
 	mutex_init(&gsw->mii_lock);
 
 	/* Switch hard reset */
@@ -519,6 +633,8 @@ static int mt753x_probe(struct platform_device *pdev)
 
 	mt753x_add_gsw(gsw);
 
+	mt753x_debugfs_init(gsw);
+
 	mt753x_swconfig_init(gsw);
 
 	if (sw->post_init)
@@ -551,6 +667,8 @@ static int mt753x_remove(struct platform_device *pdev)
 
 	mt753x_remove_gsw(gsw);
 
+	debugfs_remove_recursive(gsw->debugfs_dir);
+
 	platform_set_drvdata(pdev, NULL);
 
 	return 0;
@@ -27,6 +27,9 @@
 #define MT753X_PORT_MIB_TXB_ID	18	/* TxByte */
 #define MT753X_PORT_MIB_RXB_ID	37	/* RxByte */
 
+/* 32-bit registers in a port MIB block, up to the last counter */
+#define MT753X_MIB_REGS		(STATS_RDPC_ARL / 4 + 1)
+
 #define MIB_DESC(_s, _o, _n)   \
 	{                       \
 		.size = (_s),   \
@@ -305,28 +308,70 @@ static u64 get_mib_counter(struct gsw_mt753x *gsw, int i, int port)
 	return (hi << 32) | lo;
 }
 
+/* Fetch all counters of a port, reading each run of adjacent counters
+ * with a single bulk transfer instead of one access per counter.
+ */
+static void get_mib_counters(struct gsw_mt753x *gsw, int port, u64 *counters)
+{
+	u32 regs[MT753X_MIB_REGS] = { 0 };
+	unsigned int start, end;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(mt753x_mibs); i = j) {
+		start = mt753x_mibs[i].offset;
+		end = start + mt753x_mibs[i].size * 4;
+
+		for (j = i + 1; j < ARRAY_SIZE(mt753x_mibs); j++) {
+			if (mt753x_mibs[j].offset != end)
+				break;
+
+			end += mt753x_mibs[j].size * 4;
+		}
+
+		mt753x_reg_read_bulk(gsw, MIB_COUNTER_REG(port, start),
+				     &regs[start / 4], (end - start) / 4);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mt753x_mibs); i++) {
+		unsigned int r = mt753x_mibs[i].offset / 4;
+
+		counters[i] = regs[r];
+
+		if (mt753x_mibs[i].size == 1)
+			continue;
+
+		/* The block reads the low word first, so the high word
+		 * only matches it if the low word did not wrap since.
+		 */
+		if (mt753x_reg_read(gsw, MIB_COUNTER_REG(port,
+				    mt753x_mibs[i].offset)) < regs[r])
+			counters[i] = get_mib_counter(gsw, i, port);
+		else
+			counters[i] |= (u64)regs[r + 1] << 32;
+	}
+}
+
 static int mt753x_get_port_mib(struct switch_dev *dev,
 			       const struct switch_attr *attr,
 			       struct switch_val *val)
 {
 	static char buf[4096];
 	struct gsw_mt753x *gsw = container_of(dev, struct gsw_mt753x, swdev);
+	u64 counters[ARRAY_SIZE(mt753x_mibs)];
 	int i, len = 0;
 
 	if (val->port_vlan >= MT753X_NUM_PORTS)
 		return -EINVAL;
 
+	get_mib_counters(gsw, val->port_vlan, counters);
+
 	len += snprintf(buf + len, sizeof(buf) - len,
 			"Port %d MIB counters\n", val->port_vlan);
 
 	for (i = 0; i < ARRAY_SIZE(mt753x_mibs); ++i) {
-		u64 counter;
-
 		len += snprintf(buf + len, sizeof(buf) - len,
-				"%-11s: ", mt753x_mibs[i].name);
-		counter = get_mib_counter(gsw, i, val->port_vlan);
-		len += snprintf(buf + len, sizeof(buf) - len, "%llu\n",
-				counter);
+				"%-11s: %llu\n", mt753x_mibs[i].name,
+				counters[i]);
 	}
 
 	val->value.s = buf;
@@ -492,6 +537,10 @@ int mt753x_swconfig_init(struct gsw_mt753x *gsw)
 	swdev->vlans = MT753X_NUM_VLANS;
 	swdev->ops = &mt753x_swdev_ops;
 
+	/* PHY link changes are reported by the link interrupt */
+	if (gsw->irq >= 0)
+		swdev->link_irq_mask = BIT(MT753X_NUM_PHYS) - 1;
+
 	ret = register_switch(swdev, NULL);
 	if (ret) {
 		dev_notice(gsw->dev, "Failed to register switch %s\n",
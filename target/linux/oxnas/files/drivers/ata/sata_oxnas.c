@@ -31,6 +31,8 @@
 
 #include <linux/io.h>
 #include <linux/sizes.h>
+#include <linux/workqueue.h>
+#include <scsi/scsi_device.h>
 
 static inline void oxnas_register_clear_mask(void __iomem *p, unsigned mask)
 {
@@ -78,8 +80,11 @@ enum {
 	/** The different Oxsemi SATA core version numbers */
 	SATA_OXNAS_CORE_VERSION = 0x1f3,
 	SATA_OXNAS_IRQ_FLAG	= IRQF_SHARED,
+	/* No ATA_FLAG_NCQ: each port has a single SGDMA request and the JBOD
+	 * micro-code does not track DMA setup FIS tags, so FPDMA commands
+	 * can't be kept outstanding on the device. */
 	SATA_OXNAS_HOST_FLAGS	= (ATA_FLAG_SATA | ATA_FLAG_PIO_DMA |
-			ATA_FLAG_NO_ATAPI /*| ATA_FLAG_NCQ*/),
+			ATA_FLAG_NO_ATAPI),
 	SATA_OXNAS_QUEUE_DEPTH	= 32,
 
 	SATA_OXNAS_DMA_BOUNDARY = 0xFFFFFFFF,
@@ -276,6 +281,8 @@ enum {
 	COREINT_END = 0x00000100,
 	CORERAW_HOST = COREINT_HOST << 16,
 	CORERAW_END = COREINT_END  << 16,
+	/* the RAID controller signals end of command like a port 7 */
+	COREINT_RAID_END = COREINT_END << 7,
 
 	/* Interrupts from the RAID controller only */
 	RAID_INTS_WANTED = 0x00008300,
@@ -377,6 +384,10 @@ struct sata_oxnas_host_priv {
 	int irq;
 	int n_ports;
 	int current_ucode;
+	int raid1;
+	unsigned long raid_failed;
+	struct work_struct raid_work;
+	struct ata_host *host;
 	u32 port_frozen;
 	u32 port_in_eh;
 	struct clk *clk;
@@ -388,6 +399,7 @@ struct sata_oxnas_host_priv {
 	int core_locked;
 	int reentrant_port_no;
 	int hw_lock_count;
+	int port_lock_count[SATA_OXNAS_MAX_PORTS];
 	int direct_lock_count;
 	void *locker_uid;
 	int current_locker_type;
@@ -406,6 +418,8 @@ struct sata_oxnas_port_priv {
 	void __iomem *core_base;
 	struct sgdma_request *sgdma_request;
 	dma_addr_t sgdma_request_pa;
+	/* the command in flight was issued through the RAID-1 mirror */
+	bool mirrored;
 };
 
 static u8 sata_oxnas_check_status(struct ata_port *ap);
@@ -421,6 +435,42 @@ static void sata_oxnas_release_hw(struct ata_port *ap);
 
 static const void *HW_LOCKER_UID = (void *)0xdeadbeef;
 
+static bool independent_ports;
+module_param(independent_ports, bool, 0444);
+MODULE_PARM_DESC(independent_ports,
+	"Let both ports run commands at once with the JBOD micro-code");
+
+static bool hw_raid1;
+module_param(hw_raid1, bool, 0444);
+MODULE_PARM_DESC(hw_raid1,
+	"Mirror port 1 onto port 0 with the RAID micro-code, disks must be "
+	"in sync and port 1 at least as large as port 0. When port 0 fails "
+	"the copy on port 1 shows up as a separate disk");
+
+/** @return true if commands on this port go through the RAID-1 mirror */
+static inline int sata_oxnas_mirrored(struct ata_port *ap)
+{
+	struct sata_oxnas_host_priv *hd = ap->host->private_data;
+
+	return hd->raid1 && !ap->port_no && !hd->raid_failed;
+}
+
+/**
+ * @return the core interrupt bits signalling end of command for a port.
+ * Follows the mode the last command was issued in, a member failing while
+ * a mirrored command is in flight must not lose its RAID end interrupt.
+ */
+static inline u32 sata_oxnas_end_mask(struct ata_port *ap)
+{
+	struct sata_oxnas_port_priv *pd = ap->private_data;
+	u32 mask = COREINT_END << ap->port_no;
+
+	if (pd->mirrored)
+		mask |= COREINT_RAID_END;
+
+	return mask;
+}
+
 /***************************************************************************
 * ASIC access
 ***************************************************************************/
@@ -570,7 +620,8 @@ static void sata_oxnas_irq_clear(struct ata_port *ap)
 
 	/* clear pending interrupts */
 	iowrite32(~0, port_priv->port_base + INT_CLEAR);
-	iowrite32(COREINT_END, port_priv->core_base + CORE_INT_CLEAR);
+	iowrite32(sata_oxnas_end_mask(ap),
+		  port_priv->core_base + CORE_INT_CLEAR);
 }
 
 /**
@@ -620,8 +671,9 @@ static unsigned int sata_oxnas_qc_issue(struct ata_queued_cmd *qc)
 	/* Disable all interrupts for ports and RAID controller */
 	iowrite32(~0, port_base + INT_DISABLE);
 
-	/* Disable all interrupts for core */
-	iowrite32(~0, core_base + CORE_INT_DISABLE);
+	/* Disable the core interrupt for this port, the other port may have
+	 * a command in flight */
+	iowrite32(sata_oxnas_end_mask(qc->ap), core_base + CORE_INT_DISABLE);
 	wmb();
 
 	/* Load the command settings into the orb registers */
@@ -636,7 +688,7 @@ static unsigned int sata_oxnas_qc_issue(struct ata_queued_cmd *qc)
 
 	/* enable End of command interrupt */
 	iowrite32(INT_WANT, port_base + INT_ENABLE);
-	iowrite32(COREINT_END, core_base + CORE_INT_ENABLE);
+	iowrite32(sata_oxnas_end_mask(qc->ap), core_base + CORE_INT_ENABLE);
 	wmb();
 
 	/* Start the command */
@@ -665,6 +717,27 @@ void sata_oxnas_checkforhotplug(struct ata_port *ap)
 /**************************************************************************/
 /* Locking                                                                */
 /**************************************************************************/
+/**
+ * Whether SCSI/SATA access to a port may share the core with the current
+ * holder. Called with core_lock held.
+ *
+ * Only the JBOD micro-code drives the ports independently, RAID modes and
+ * the bug 6320 workaround without micro-code need the whole core. With
+ * RAID-1 configured the micro-code is switched per command, so the ports
+ * stay serialized even while running on the JBOD micro-code. Fast
+ * waiters get the core once the ports drain.
+ */
+static int sata_oxnas_may_reenter(struct sata_oxnas_host_priv *hd, int port_no)
+{
+	if (port_no == hd->reentrant_port_no)
+		return 1;
+
+	return independent_ports && !hd->raid1 &&
+	       hd->current_locker_type == SATA_SCSI_STACK &&
+	       hd->current_ucode == OXNASSATA_NOTRAID &&
+	       list_empty(&hd->fast_wait_queue.head);
+}
+
 /**
  * The underlying function that controls access to the sata core
  *
@@ -711,9 +784,10 @@ static int __acquire_sata_core(
 			 * reentrant access is allowed and this access is to the
 			 * same port for which the lock is current held
 			 */
-			if (hw_access && (port_no == hd->reentrant_port_no)) {
+			if (hw_access && sata_oxnas_may_reenter(hd, port_no)) {
 				BUG_ON(!hd->hw_lock_count);
 				++(hd->hw_lock_count);
+				++(hd->port_lock_count[port_no]);
 
 				DPRINTK("Allow SCSI/SATA re-entrant access to "
 					"uid %p port %d\n", uid, port_no);
@@ -795,6 +869,7 @@ check_uid:
 				BUG_ON(hd->isr_arg);
 
 				++(hd->hw_lock_count);
+				++(hd->port_lock_count[port_no]);
 				hd->reentrant_port_no = port_no;
 
 				hd->current_locker_type = SATA_SCSI_STACK;
@@ -961,7 +1036,7 @@ static void sata_oxnas_release_hw(struct ata_port *ap)
 	} else {
 		/* Trap incorrect usage */
 		BUG_ON(hd->reentrant_port_no == -1);
-		BUG_ON(ap->port_no != hd->reentrant_port_no);
+		BUG_ON(!hd->port_lock_count[ap->port_no]);
 		BUG_ON(hd->direct_lock_count);
 		BUG_ON(hd->current_locker_type != SATA_SCSI_STACK);
 
@@ -972,8 +1047,12 @@ static void sata_oxnas_release_hw(struct ata_port *ap)
 			hd->direct_lock_count, hd->reentrant_port_no,
 			hd->core_locked, hd->isr_callback);
 
+		--(hd->port_lock_count[ap->port_no]);
 		if (--(hd->hw_lock_count)) {
 			DPRINTK("Still nested port_no %d\n", ap->port_no);
+			/* hand the reentrant slot to a port still holding it */
+			if (!hd->port_lock_count[hd->reentrant_port_no])
+				hd->reentrant_port_no = !ap->port_no;
 		} else {
 			DPRINTK("Release port_no %d\n", ap->port_no);
 			hd->reentrant_port_no = -1;
@@ -1122,7 +1201,7 @@ static void sata_oxnas_tf_load(struct ata_port *ap,
 	 * modify the interrupt enable registers on the ata core as required */
 	if (tf->ctl & ATA_NIEN) {
 		/* interrupts disabled */
-		u32 mask = (COREINT_END << ap->port_no);
+		u32 mask = sata_oxnas_end_mask(ap);
 
 		iowrite32(mask, port_priv->core_base + CORE_INT_DISABLE);
 		sata_oxnas_irq_clear(ap);
@@ -1395,7 +1474,11 @@ void sata_oxnas_set_mode(struct ata_host *ah, u32 mode, u32 force)
 			iowrite32(0x7fffffff, core_base + RAID_WP_TOP_HIGH);
 			iowrite32(0, core_base + RAID_SIZE_LOW);
 			iowrite32(0, core_base + RAID_SIZE_HIGH);
+			iowrite32(RAID_TWODISKS, core_base + RAID_CONTROL);
 			wmb();
+
+			/* start micro-code processor*/
+			iowrite32(1, core_base + PROC_START);
 			break;
 		case OXNASSATA_RAID0:
 			/* clear JBOD mode */
@@ -1633,7 +1716,7 @@ static void sata_oxnas_post_internal_cmd(struct ata_queued_cmd *qc)
 static void sata_oxnas_irq_on(struct ata_port *ap)
 {
 	struct sata_oxnas_port_priv *pd = ap->private_data;
-	u32 mask = (COREINT_END << ap->port_no);
+	u32 mask = sata_oxnas_end_mask(ap);
 
 	/* Clear pending interrupts */
 	iowrite32(~0, pd->port_base + INT_CLEAR);
@@ -1798,6 +1881,113 @@ static inline void sata_oxnas_reset_ucode(struct ata_host *ah, int force,
 	}
 }
 
+/**
+ * Loads the micro-code a command on this port needs and records the mode
+ * for completion. The mirror is driven through port 0, the member on
+ * port 1 is only probed and reset directly while the mirror is intact.
+ */
+static void sata_oxnas_select_ucode(struct ata_port *ap)
+{
+	struct sata_oxnas_port_priv *pd = ap->private_data;
+
+	pd->mirrored = sata_oxnas_mirrored(ap);
+
+	if (pd->mirrored)
+		sata_oxnas_set_mode(ap->host, OXNASSATA_RAID1, 0);
+	else
+		sata_oxnas_reset_ucode(ap->host, 0, 0);
+}
+
+/**
+ * Exposes the surviving copy on port 1 once the disk on port 0 failed. Its
+ * SCSI device was kept from attaching a block device so far, it shows up
+ * as a new disk now and users of the old one have to switch over.
+ */
+static void sata_oxnas_raid_failover(struct work_struct *work)
+{
+	struct sata_oxnas_host_priv *hd =
+		container_of(work, struct sata_oxnas_host_priv, raid_work);
+	struct ata_port *ap = hd->host->ports[1];
+	struct scsi_device *sdev;
+	unsigned long flags;
+
+	spin_lock_irqsave(ap->lock, flags);
+	sdev = ap->link.device[0].sdev;
+	if (sdev && scsi_device_get(sdev))
+		sdev = NULL;
+	spin_unlock_irqrestore(ap->lock, flags);
+
+	if (!sdev)
+		return;
+
+	if (sdev->no_uld_attach) {
+		ata_port_warn(ap, "exposing the surviving RAID-1 member\n");
+		sdev->no_uld_attach = 0;
+		if (scsi_device_reprobe(sdev))
+			ata_port_err(ap, "failed to attach RAID-1 member\n");
+	}
+
+	scsi_device_put(sdev);
+}
+
+/**
+ * Drops a port out of the RAID-1 mirror. Losing port 1 leaves port 0
+ * running alone on the JBOD micro-code. Losing port 0 leaves its device
+ * failing every command, the copy on port 1 is made visible instead, see
+ * sata_oxnas_raid_failover(). There is no rebuild, the member stays failed
+ * until the driver is reloaded.
+ */
+static void sata_oxnas_raid_fail(struct ata_port *ap)
+{
+	struct sata_oxnas_host_priv *hd = ap->host->private_data;
+
+	if (!hd->raid1 || test_and_set_bit(ap->port_no, &hd->raid_failed))
+		return;
+
+	ata_port_err(ap, "RAID-1 member failed, mirror degraded\n");
+
+	if (!ap->port_no && !test_bit(1, &hd->raid_failed))
+		schedule_work(&hd->raid_work);
+}
+
+static ssize_t raid_status_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct ata_host *host = dev_get_drvdata(dev);
+	struct sata_oxnas_host_priv *hd = host->private_data;
+
+	if (!hd->raid1)
+		return sprintf(buf, "none\n");
+
+	switch (hd->raid_failed & (BIT(0) | BIT(1))) {
+	case 0:
+		return sprintf(buf, "clean\n");
+	case BIT(0):
+		return sprintf(buf, "degraded port0\n");
+	case BIT(1):
+		return sprintf(buf, "degraded port1\n");
+	default:
+		return sprintf(buf, "failed\n");
+	}
+}
+static DEVICE_ATTR_RO(raid_status);
+
+/**
+ * Keeps the upper level drivers off the RAID-1 member so that only the
+ * mirrored device on port 0 gets a block device. The member stays known
+ * to the SCSI layer for the failover.
+ */
+static int sata_oxnas_slave_config(struct scsi_device *sdev)
+{
+	struct ata_port *ap = ata_shost_to_port(sdev->host);
+	struct sata_oxnas_host_priv *hd = ap->host->private_data;
+
+	if (hd->raid1 && ap->port_no && !test_bit(0, &hd->raid_failed))
+		sdev->no_uld_attach = 1;
+
+	return ata_scsi_slave_config(sdev);
+}
+
 /**
  * Prepare as much as possible for a command without involving anything that is
  * shared between ports.
@@ -1814,9 +2004,10 @@ static void sata_oxnas_qc_prep(struct ata_queued_cmd *qc)
 			port_no);
 		qc->err_mask |= AC_ERR_ATA_BUS;
 		ata_qc_complete(qc);
+		sata_oxnas_raid_fail(qc->ap);
 	}
 
-	sata_oxnas_reset_ucode(qc->ap->host, 0, 0);
+	sata_oxnas_select_ucode(qc->ap);
 
 	/* both pio and dma commands use dma */
 	if (ata_is_dma(qc->tf.protocol) || ata_is_pio(qc->tf.protocol)) {
@@ -1966,11 +2157,43 @@ static void sata_oxnas_host_stop(struct ata_host *host_set)
 
 
 #define ERROR_HW_ACQUIRE_TIMEOUT_JIFFIES (10 * HZ)
+
+/**
+ * Wait for commands on the other ports to finish before the core is reset
+ * under them. New commands are refused while port_in_eh is set.
+ */
+static void sata_oxnas_wait_other_ports(struct ata_port *ap)
+{
+	struct sata_oxnas_host_priv *hd = ap->host->private_data;
+	unsigned long end = jiffies + ERROR_HW_ACQUIRE_TIMEOUT_JIFFIES;
+	unsigned long flags;
+	int busy, n;
+
+	do {
+		busy = 0;
+		spin_lock_irqsave(&hd->core_lock, flags);
+		for (n = 0; n < hd->n_ports; n++)
+			if (n != ap->port_no)
+				busy |= hd->port_lock_count[n];
+		spin_unlock_irqrestore(&hd->core_lock, flags);
+
+		if (!busy)
+			return;
+
+		msleep(10);
+	} while (time_before(jiffies, end));
+
+	ata_port_warn(ap, "other port still busy, resetting core anyway\n");
+}
+
 static void sata_oxnas_error_handler(struct ata_port *ap)
 {
 	DPRINTK("Enter port_no %d\n", ap->port_no);
 	sata_oxnas_freeze_host(ap);
 
+	if (independent_ports)
+		sata_oxnas_wait_other_ports(ap);
+
 	/* If the core is busy here, make it idle */
 	sata_oxnas_cleanup(ap->host);
 
@@ -2143,6 +2366,16 @@ static void sata_oxnas_port_irq(struct ata_port *ap, int force_error)
 	 * spurious interrupts when cleaning-up after a failed command, ignore
 	 * these too. */
 	if (likely(qc)) {
+		/* the micro-code flags a mirror member that failed the command */
+		if (pd->mirrored) {
+			u32 failed = ioread32(pd->core_base + CORE_FAILED_PORT_R);
+
+			if (failed & BIT(1))
+				sata_oxnas_raid_fail(ap->host->ports[1]);
+			if (failed & BIT(0))
+				sata_oxnas_raid_fail(ap);
+		}
+
 		/* get the status before any error cleanup */
 		qc->err_mask = ac_err_mask(sata_oxnas_check_status(ap));
 		if (force_error) {
@@ -2166,6 +2399,7 @@ static void sata_oxnas_port_irq(struct ata_port *ap, int force_error)
 
 		sata_oxnas_scr_read_port(ap, SCR_ERROR, &serror);
 		if (serror & (SERR_DEV_XCHG | SERR_PHYRDY_CHG)) {
+			sata_oxnas_raid_fail(ap);
 			ata_ehi_hotplugged(&ap->link.eh_info);
 			ata_port_freeze(ap);
 		}
@@ -2190,7 +2424,7 @@ static irqreturn_t sata_oxnas_interrupt(int irq, void *dev_instance)
 
 	/* loop until there are no more interrupts */
 	while ((int_status = (ioread32(core_base + CORE_INT_STATUS)) &
-		(COREINT_END | (COREINT_END << 1)))) {
+		(COREINT_END | (COREINT_END << 1) | COREINT_RAID_END))) {
 
 		/* clear any interrupt */
 		iowrite32(int_status, core_base + CORE_INT_CLEAR);
@@ -2202,7 +2436,7 @@ static irqreturn_t sata_oxnas_interrupt(int irq, void *dev_instance)
 		for (port_no = 0; port_no < hd->n_ports; ++port_no) {
 			/* check the raw end of command interrupt to see if the
 			 * port is done */
-			mask = (COREINT_END << port_no);
+			mask = sata_oxnas_end_mask(ah->ports[port_no]);
 			if (!(int_status & mask))
 				continue;
 
@@ -2212,8 +2446,11 @@ static irqreturn_t sata_oxnas_interrupt(int irq, void *dev_instance)
 			bug_present = (hd->current_ucode == UNKNOWN_MODE) &&
 				sata_oxnas_bug_6320_detect(ah->ports[port_no]);
 
+			/* the other port may be issuing on another CPU */
+			spin_lock(&ah->lock);
 			sata_oxnas_port_irq(ah->ports[port_no],
 						bug_present);
+			spin_unlock(&ah->lock);
 			ret = IRQ_HANDLED;
 		}
 	}
@@ -2230,6 +2467,7 @@ static struct scsi_host_template sata_oxnas_sht = {
 	.sg_tablesize = SATA_OXNAS_MAX_PRD,
 	.dma_boundary = ATA_DMA_BOUNDARY,
 	.unchecked_isa_dma  = 0,
+	.slave_configure = sata_oxnas_slave_config,
 };
 
 
@@ -2326,6 +2564,13 @@ static int sata_oxnas_probe(struct platform_device *ofdev)
 	host_priv->n_ports = n_ports;
 	host_priv->current_ucode = UNKNOWN_MODE;
 
+	if (hw_raid1 && n_ports != SATA_OXNAS_MAX_PORTS)
+		dev_warn(&ofdev->dev, "RAID-1 needs both ports, ignoring\n");
+	else
+		host_priv->raid1 = hw_raid1;
+
+	INIT_WORK(&host_priv->raid_work, sata_oxnas_raid_failover);
+
 	if (!of_address_to_resource(ofdev->dev.of_node, 5, &res)) {
 		host_priv->dma_base = res.start;
 		host_priv->dma_size = resource_size(&res);
@@ -2376,6 +2621,7 @@ static int sata_oxnas_probe(struct platform_device *ofdev)
 	}
 	host->private_data = host_priv;
 	host->iomap = port_base;
+	host_priv->host = host;
 
 	/* initialize core locking and queues */
 	init_waitqueue_head(&host_priv->fast_wait_queue);
@@ -2404,6 +2650,9 @@ static int sata_oxnas_probe(struct platform_device *ofdev)
 	ata_host_activate(host, irq, sata_oxnas_interrupt, SATA_OXNAS_IRQ_FLAG,
 			  &sata_oxnas_sht);
 
+	if (device_create_file(&ofdev->dev, &dev_attr_raid_status))
+		dev_warn(&ofdev->dev, "failed to create raid_status\n");
+
 	return 0;
 
 error_exit_with_cleanup:
@@ -2430,6 +2679,8 @@ static int sata_oxnas_remove(struct platform_device *ofdev)
 	struct ata_host *host = dev_get_drvdata(&ofdev->dev);
 	struct sata_oxnas_host_priv *host_priv = host->private_data;
 
+	device_remove_file(&ofdev->dev, &dev_attr_raid_status);
+	cancel_work_sync(&host_priv->raid_work);
 	ata_host_detach(host);
 
 	irq_dispose_mapping(host_priv->irq);
@@ -898,6 +898,7 @@ struct msdc_dma {
 	struct bd  *bd;                   /* pointer to bd array */
 	dma_addr_t gpd_addr;         /* the physical address of gpd array */
 	dma_addr_t bd_addr;          /* the physical address of bd array */
+	struct gpd gpd_tmpl;         /* gpd with hwo set and checksum */
 };
 
 struct msdc_host {
@@ -930,6 +931,10 @@ struct msdc_host {
 
 	struct delayed_work		card_delaywork;
 
+	struct workqueue_struct     *req_wq;        /* data request queue */
+	struct work_struct          req_work;
+	struct mmc_request          *req_pending;   /* request for req_work */
+
 	struct completion           cmd_done;
 	struct completion           xfer_done;
 	struct pm_message           pm_state;
@@ -99,6 +99,10 @@
 #define MAX_SGMT_SZ         (MAX_DMA_CNT)
 #define MAX_REQ_SZ          (MAX_SGMT_SZ * 8)
 
+/* data->host_cookie flags */
+#define MSDC_PREPARE_FLAG   BIT(0)  /* sg list is DMA mapped */
+#define MSDC_ASYNC_FLAG     BIT(1)  /* mapped by pre_req, unmapped by post_req */
+
 static int cd_active_low = 1;
 
 //=================================
@@ -1031,16 +1035,31 @@ static void msdc_dma_stop(struct msdc_host *host)
 	N_MSG(DMA, "DMA stop");
 }
 
-/* calc checksum */
-static u8 msdc_dma_calcs(u8 *buf, u32 len)
+/* calc checksum, buf must be word aligned and len a multiple of 4 */
+static u8 msdc_dma_calcs(const void *buf, u32 len)
 {
-	u32 i, sum = 0;
+	const u32 *p = buf;
+	u32 i, v, sum = 0;
+
+	/* add the bytes in two 16 bit lanes, a descriptor can't overflow them */
+	for (i = 0; i < len / 4; i++) {
+		v = p[i];
+		sum += (v & 0x00ff00ff) + ((v >> 8) & 0x00ff00ff);
+	}
+	sum += sum >> 16;
 
-	for (i = 0; i < len; i++)
-		sum += buf[i];
 	return 0xFF - (u8)sum;
 }
 
+/* physical address of the bd following bd[i], as linked by msdc_init_gpd_bd */
+static void *msdc_bd_next(struct msdc_dma *dma, u32 i)
+{
+	if (i >= MAX_BD_NUM - 1)
+		return NULL;
+
+	return (void *)(dma->bd_addr + sizeof(struct bd) * (i + 1));
+}
+
 /* gpd bd setup + dma registers */
 static void msdc_dma_config(struct msdc_host *host, struct msdc_dma *dma)
 {
@@ -1077,27 +1096,22 @@ static void msdc_dma_config(struct msdc_host *host, struct msdc_dma *dma)
 		gpd = dma->gpd;
 		bd  = dma->bd;
 
-		/* modify gpd*/
-		//gpd->intr = 0;
-		gpd->hwo = 1;  /* hw will clear it */
-		gpd->bdp = 1;
-		gpd->chksum = 0;  /* need to clear first. */
-		gpd->chksum = msdc_dma_calcs((u8 *)gpd, 16);
+		/* The descriptors live in uncached memory, so they are built
+		 * and checksummed on the stack and stored with one copy
+		 * instead of bitfield read-modify-writes. The gpd never
+		 * changes, its checksum is computed once at init. */
+		*gpd = dma->gpd_tmpl;
 
-		/* modify bd*/
 		for_each_sg(dma->sg, sg, dma->sglen, j) {
-			bd[j].blkpad = 0;
-			bd[j].dwpad = 0;
-			bd[j].ptr = (void *)sg_dma_address(sg);
-			bd[j].buflen = sg_dma_len(sg);
-
-			if (j == dma->sglen - 1)
-				bd[j].eol = 1;	/* the last bd */
-			else
-				bd[j].eol = 0;
-
-			bd[j].chksum = 0; /* checksume need to clear first */
-			bd[j].chksum = msdc_dma_calcs((u8 *)(&bd[j]), 16);
+			struct bd b = {
+				.eol = (j == dma->sglen - 1), /* the last bd */
+				.next = msdc_bd_next(dma, j),
+				.ptr = (void *)sg_dma_address(sg),
+				.buflen = sg_dma_len(sg),
+			};
+
+			b.chksum = msdc_dma_calcs(&b, 16);
+			bd[j] = b;
 		}
 
 		sdr_set_field(MSDC_DMA_CFG, MSDC_DMA_CFG_DECSEN, 1);
@@ -1134,6 +1148,34 @@ static void msdc_dma_setup(struct msdc_host *host, struct msdc_dma *dma,
 	msdc_dma_config(host, dma);
 }
 
+static void msdc_prepare_data(struct msdc_host *host, struct mmc_request *mrq)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!(data->host_cookie & MSDC_PREPARE_FLAG)) {
+		data->host_cookie |= MSDC_PREPARE_FLAG;
+		data->sg_count = dma_map_sg(mmc_dev(host->mmc), data->sg,
+					    data->sg_len,
+					    mmc_get_dma_dir(data));
+	}
+}
+
+static void msdc_unprepare_data(struct msdc_host *host,
+				struct mmc_request *mrq)
+{
+	struct mmc_data *data = mrq->data;
+
+	/* left mapped for post_req */
+	if (data->host_cookie & MSDC_ASYNC_FLAG)
+		return;
+
+	if (data->host_cookie & MSDC_PREPARE_FLAG) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     mmc_get_dma_dir(data));
+		data->host_cookie &= ~MSDC_PREPARE_FLAG;
+	}
+}
+
 static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	__must_hold(&host->lock)
 {
@@ -1193,9 +1235,7 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		if (msdc_command_start(host, cmd, 1, CMD_TIMEOUT) != 0)
 			goto done;
 
-		data->sg_count = dma_map_sg(mmc_dev(mmc), data->sg,
-					    data->sg_len,
-					    mmc_get_dma_dir(data));
+		msdc_prepare_data(host, mrq);
 		msdc_dma_setup(host, &host->dma, data->sg,
 			       data->sg_count);
 
@@ -1234,8 +1274,7 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 done:
 	if (data != NULL) {
 		host->data = NULL;
-		dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
-			     mmc_get_dma_dir(data));
+		msdc_unprepare_data(host, mrq);
 		host->blksz = 0;
 
 #if 0 // don't stop twice!
@@ -1648,8 +1687,7 @@ static int msdc_tune_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	return ret;
 }
 
-/* ops.request */
-static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
+static void msdc_handle_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
 	struct msdc_host *host = mmc_priv(mmc);
 
@@ -1715,6 +1753,59 @@ static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	return;
 }
 
+static void msdc_request_work(struct work_struct *work)
+{
+	struct msdc_host *host = container_of(work, struct msdc_host,
+					      req_work);
+
+	msdc_handle_request(host->mmc, host->req_pending);
+}
+
+/* ops.request */
+static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+
+	/* Data transfers run from the request workqueue, so the core can
+	 * prepare the next request in pre_req while this one is on the bus. */
+	if (mrq->data) {
+		host->req_pending = mrq;
+		queue_work(host->req_wq, &host->req_work);
+		return;
+	}
+
+	msdc_handle_request(mmc, mrq);
+}
+
+/* ops.pre_req */
+static void msdc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	msdc_prepare_data(host, mrq);
+	data->host_cookie |= MSDC_ASYNC_FLAG;
+}
+
+/* ops.post_req */
+static void msdc_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  int err)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie &= ~MSDC_ASYNC_FLAG;
+		msdc_unprepare_data(host, mrq);
+	}
+}
+
 /* called by ops.set_ios */
 static void msdc_set_buswidth(struct msdc_host *host, u32 width)
 {
@@ -1870,6 +1961,8 @@ static int msdc_ops_get_cd(struct mmc_host *mmc)
 
 static struct mmc_host_ops mt_msdc_ops = {
 	.request         = msdc_ops_request,
+	.pre_req         = msdc_pre_req,
+	.post_req        = msdc_post_req,
 	.set_ios         = msdc_ops_set_ios,
 	.get_ro          = msdc_ops_get_ro,
 	.get_cd          = msdc_ops_get_cd,
@@ -2192,9 +2285,14 @@ static void msdc_init_gpd_bd(struct msdc_host *host, struct msdc_dma *dma)
 	gpd->ptr = (void *)dma->bd_addr; /* physical address */
 	gpd->next = (void *)((u32)dma->gpd_addr + sizeof(struct gpd));
 
+	/* what msdc_dma_config hands to the hw for every request */
+	dma->gpd_tmpl = *gpd;
+	dma->gpd_tmpl.hwo = 1;  /* hw will clear it */
+	dma->gpd_tmpl.chksum = msdc_dma_calcs(&dma->gpd_tmpl, 16);
+
 	memset(bd, 0, sizeof(struct bd) * MAX_BD_NUM);
 	for (i = 0; i < (MAX_BD_NUM - 1); i++)
-		bd[i].next = (void *)(dma->bd_addr + sizeof(*bd) * (i + 1));
+		bd[i].next = msdc_bd_next(dma, i);
 }
 
 static int msdc_drv_probe(struct platform_device *pdev)
@@ -2299,6 +2397,16 @@ static int msdc_drv_probe(struct platform_device *pdev)
 	}
 	msdc_init_gpd_bd(host, &host->dma);
 
+	/* the request queue may be needed to write back memory */
+	host->req_wq = alloc_ordered_workqueue("msdc%d",
+					       WQ_MEM_RECLAIM | WQ_HIGHPRI,
+					       host->id);
+	if (!host->req_wq) {
+		ret = -ENOMEM;
+		goto release_mem;
+	}
+	INIT_WORK(&host->req_work, msdc_request_work);
+
 	INIT_DELAYED_WORK(&host->card_delaywork, msdc_tasklet_card);
 	spin_lock_init(&host->lock);
 	msdc_init_hw(host);
@@ -2334,6 +2442,7 @@ release:
 	platform_set_drvdata(pdev, NULL);
 	msdc_deinit_hw(host);
 	cancel_delayed_work_sync(&host->card_delaywork);
+	destroy_workqueue(host->req_wq);
 
 release_mem:
 	if (host->dma.gpd)
@@ -2367,6 +2476,7 @@ static int msdc_drv_remove(struct platform_device *pdev)
 	msdc_deinit_hw(host);
 
 	cancel_delayed_work_sync(&host->card_delaywork);
+	destroy_workqueue(host->req_wq);
 
 	dma_free_coherent(&pdev->dev, MAX_GPD_NUM * sizeof(struct gpd),
 			  host->dma.gpd, host->dma.gpd_addr);
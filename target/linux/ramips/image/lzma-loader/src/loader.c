@@ -26,7 +26,11 @@
 #include "config.h"
 #include "cache.h"
 #include "printf.h"
+#ifdef CONFIG_COMPRESS_GZIP
+#include "inflate.h"
+#else
 #include "LzmaDecode.h"
+#endif
 
 #define AR71XX_FLASH_START	0x1f000000
 #define AR71XX_FLASH_END	0x1fe00000
@@ -34,6 +38,7 @@
 #define KSEG0			0x80000000
 #define KSEG1			0xa0000000
 
+#define KSEG0ADDR(a)		((((unsigned)(a)) & 0x1fffffffU) | KSEG0)
 #define KSEG1ADDR(a)		((((unsigned)(a)) & 0x1fffffffU) | KSEG1)
 
 #undef LZMA_DEBUG
@@ -67,7 +72,9 @@ typedef struct image_header {
 extern unsigned char workspace[];
 extern void board_init(void);
 
+#ifndef CONFIG_COMPRESS_GZIP
 static CLzmaDecoderState lzma_state;
+#endif
 static unsigned char *lzma_data;
 static unsigned long lzma_datasize;
 static unsigned long lzma_outsize;
@@ -99,6 +106,63 @@ static __inline__ unsigned long get_be32(void *buf)
 	        (unsigned long) p[3]);
 }
 
+static __inline__ unsigned long get_le32(void *buf)
+{
+	unsigned char *p = buf;
+
+	return (((unsigned long) p[3] << 24) +
+	        ((unsigned long) p[2] << 16) +
+	        ((unsigned long) p[1] << 8) +
+	        (unsigned long) p[0]);
+}
+
+/* CP0 count, runs at half the CPU clock */
+static __inline__ unsigned long read_c0_count(void)
+{
+	unsigned long count;
+
+	__asm__ __volatile__ ("mfc0 %0, $9" : "=r" (count));
+
+	return count;
+}
+
+#ifdef CONFIG_COMPRESS_GZIP
+#define COMP_NAME		"gzip"
+#define COMP_RESULT_OK		INFLATE_OK
+#define COMP_RESULT_DATA_ERROR	INFLATE_DATA_ERROR
+
+static int comp_init_props(void)
+{
+	if (lzma_datasize < 18)
+		return INFLATE_HEADER_ERROR;
+
+	/* the uncompressed size is in the trailer */
+	lzma_outsize = get_le32(lzma_data + lzma_datasize - 4);
+
+	return INFLATE_OK;
+}
+
+static int comp_decompress(unsigned char *outStream)
+{
+	unsigned long osize = lzma_outsize;
+	int ret;
+
+	ret = gunzip(outStream, &osize, lzma_data, lzma_datasize, workspace);
+	if (ret == INFLATE_OK && osize != lzma_outsize)
+		ret = INFLATE_DATA_ERROR;
+
+	if (ret != INFLATE_OK)
+		DBG("gunzip error %d, osize:%d op:%d\n", ret, lzma_outsize, osize);
+
+	return ret;
+}
+#else
+#define COMP_NAME		"LZMA"
+#define COMP_RESULT_OK		LZMA_RESULT_OK
+#define COMP_RESULT_DATA_ERROR	LZMA_RESULT_DATA_ERROR
+#define comp_init_props		lzma_init_props
+#define comp_decompress		lzma_decompress
+
 static __inline__ unsigned char lzma_get_byte(void)
 {
 	unsigned char c;
@@ -158,6 +222,7 @@ static int lzma_decompress(unsigned char *outStream)
 
 	return ret;
 }
+#endif /* CONFIG_COMPRESS_GZIP */
 
 #if (LZMA_WRAPPER)
 static void lzma_init_data(void)
@@ -178,7 +243,8 @@ static void lzma_init_data(void)
 	unsigned long kernel_ofs;
 	unsigned long kernel_size;
 
-	flash_base = (unsigned char *) KSEG1ADDR(AR71XX_FLASH_START);
+	/* read the flash through the cache, the bootloader runs from there too */
+	flash_base = (unsigned char *) KSEG0ADDR(AR71XX_FLASH_START);
 
 	printf("Looking for OpenWrt image... ");
 
@@ -217,6 +283,7 @@ void loader_main(unsigned long reg_a0, unsigned long reg_a1,
 {
 	void (*kernel_entry) (unsigned long, unsigned long, unsigned long,
 			      unsigned long);
+	unsigned long t_start, t_found, t_decomp, t_flush;
 	int res;
 
 	board_init();
@@ -224,21 +291,24 @@ void loader_main(unsigned long reg_a0, unsigned long reg_a1,
 	printf("\n\nOpenWrt kernel loader for MIPS based SoC\n");
 	printf("Copyright (C) 2011 Gabor Juhos <juhosg@openwrt.org>\n");
 
+	t_start = read_c0_count();
 	lzma_init_data();
 
-	res = lzma_init_props();
-	if (res != LZMA_RESULT_OK) {
-		printf("Incorrect LZMA stream properties!\n");
+	res = comp_init_props();
+	if (res != COMP_RESULT_OK) {
+		printf("Incorrect " COMP_NAME " stream properties!\n");
 		halt();
 	}
 
 	printf("Decompressing kernel... ");
 
-	res = lzma_decompress((unsigned char *) kernel_la);
-	if (res != LZMA_RESULT_OK) {
+	t_found = read_c0_count();
+	res = comp_decompress((unsigned char *) kernel_la);
+	t_decomp = read_c0_count();
+	if (res != COMP_RESULT_OK) {
 		printf("failed, ");
 		switch (res) {
-		case LZMA_RESULT_DATA_ERROR:
+		case COMP_RESULT_DATA_ERROR:
 			printf("data error!\n");
 			break;
 		default:
@@ -249,7 +319,13 @@ void loader_main(unsigned long reg_a0, unsigned long reg_a1,
 		printf("done!\n");
 	}
 
+	t_flush = read_c0_count();
 	flush_cache(kernel_la, lzma_outsize);
+	t_flush = read_c0_count() - t_flush;
+
+	printf("Timing in CP0 count ticks: locate %u, " COMP_NAME " %u, "
+	       "cache flush %u\n", t_found - t_start, t_decomp - t_found,
+	       t_flush);
 
 	printf("Starting kernel at %08x...\n\n", kernel_la);
 
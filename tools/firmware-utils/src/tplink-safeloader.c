@@ -44,9 +44,13 @@
 
 #include <arpa/inet.h>
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "md5.h"
 
@@ -56,11 +60,45 @@
 
 #define MAX_PARTITIONS	32
 
-/** An image partition table entry */
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
+/**
+   An image partition table entry
+
+   Only the first data_len bytes are backed by data, the remainder of the
+   partition is 0xff padding (ending with a JFFS2 EOF mark if eof is set).
+   File contents point into a shared input mapping and are not owned by
+   the entry.
+*/
 struct image_partition_entry {
 	const char *name;
 	size_t size;
 	uint8_t *data;
+	size_t data_len;
+	bool eof;
+	bool shared;
+};
+
+/** An input file mapped into memory, shared by all images built from it */
+struct image_input {
+	const char *filename;
+	uint8_t *data;
+	size_t len;
+};
+
+/** A chunk of an image, data == NULL stands for 0xff padding */
+struct image_segment {
+	const uint8_t *data;
+	size_t len;
+};
+
+/** A firmware image described as a list of chunks */
+struct image_layout {
+	struct image_segment *segs;
+	size_t n_segs;
+	size_t len;
 };
 
 /** A flash partition table entry */
@@ -82,6 +120,13 @@ struct device_info {
 	const char *last_sysupgrade_partition;
 };
 
+/** One image to build in batch mode */
+struct build_job {
+	struct device_info info;
+	const char *output;
+	bool sysupgrade;
+};
+
 /** The content of the soft-version structure */
 struct __attribute__((__packed__)) soft_version {
 	uint32_t magic;
@@ -101,6 +146,9 @@ struct __attribute__((__packed__)) soft_version {
 
 static const uint8_t jffs2_eof_mark[4] = {0xde, 0xad, 0xc0, 0xde};
 
+/** Source of 0xff padding bytes */
+static uint8_t ff_buf[0x10000];
+
 
 /**
    Salt for the MD5 hash
@@ -1795,7 +1843,12 @@ static inline void put32(uint8_t *buf, uint32_t val) {
 
 /** Allocates a new image partition */
 static struct image_partition_entry alloc_image_partition(const char *name, size_t len) {
-	struct image_partition_entry entry = {name, len, malloc(len)};
+	struct image_partition_entry entry = {
+		.name = name,
+		.size = len,
+		.data = malloc(len),
+		.data_len = len,
+	};
 	if (!entry.data)
 		error(1, errno, "malloc");
 
@@ -1804,7 +1857,8 @@ static struct image_partition_entry alloc_image_partition(const char *name, size
 
 /** Frees an image partition */
 static void free_image_partition(struct image_partition_entry entry) {
-	free(entry.data);
+	if (!entry.shared)
+		free(entry.data);
 }
 
 static time_t source_date_epoch = -1;
@@ -1869,7 +1923,7 @@ static struct image_partition_entry make_soft_version(uint32_t rev) {
 	else if (time(&t) == (time_t)(-1))
 		error(1, errno, "time");
 
-	struct tm *tm = localtime(&t);
+	struct tm tm_buf, *tm = localtime_r(&t, &tm_buf);
 
 	s->magic = htonl(0x0000000c);
 	s->zero = 0;
@@ -1920,39 +1974,56 @@ static struct image_partition_entry make_support_list(struct device_info *info)
 	return entry;
 }
 
-/** Creates a new image partition with an arbitrary name from a file */
-static struct image_partition_entry read_file(const char *part_name, const char *filename, bool add_jffs2_eof, struct flash_partition_entry *file_system_partition) {
+/** Maps an input file into memory */
+static void map_input(struct image_input *in, const char *filename) {
 	struct stat statbuf;
 
-	if (stat(filename, &statbuf) < 0)
+	in->filename = filename;
+	in->data = NULL;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		error(1, errno, "unable to open file `%s'", filename);
+
+	if (fstat(fd, &statbuf) < 0)
 		error(1, errno, "unable to stat file `%s'", filename);
 
-	size_t len = statbuf.st_size;
+	in->len = statbuf.st_size;
 
-	if (add_jffs2_eof) {
-		if (file_system_partition)
-			len = ALIGN(len + file_system_partition->base, 0x10000) + sizeof(jffs2_eof_mark) - file_system_partition->base;
-		else
-			len = ALIGN(len, 0x10000) + sizeof(jffs2_eof_mark);
+	if (in->len) {
+		in->data = mmap(NULL, in->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->data == MAP_FAILED)
+			error(1, errno, "unable to map file `%s'", filename);
 	}
 
-	struct image_partition_entry entry = alloc_image_partition(part_name, len);
+	close(fd);
+}
 
-	FILE *file = fopen(filename, "rb");
-	if (!file)
-		error(1, errno, "unable to open file `%s'", filename);
+/** Unmaps an input file */
+static void unmap_input(struct image_input *in) {
+	if (in->data)
+		munmap(in->data, in->len);
+}
 
-	if (fread(entry.data, statbuf.st_size, 1, file) != 1)
-		error(1, errno, "unable to read file `%s'", filename);
+/** Creates a new image partition with an arbitrary name from an input file */
+static struct image_partition_entry read_file(const char *part_name, const struct image_input *in, bool add_jffs2_eof, struct flash_partition_entry *file_system_partition) {
+	size_t len = in->len;
 
 	if (add_jffs2_eof) {
-		uint8_t *eof = entry.data + statbuf.st_size, *end = entry.data+entry.size;
-
-		memset(eof, 0xff, end - eof - sizeof(jffs2_eof_mark));
-		memcpy(end - sizeof(jffs2_eof_mark), jffs2_eof_mark, sizeof(jffs2_eof_mark));
+		if (file_system_partition)
+			len = ALIGN(len + file_system_partition->base, 0x10000) + sizeof(jffs2_eof_mark) - file_system_partition->base;
+		else
+			len = ALIGN(len, 0x10000) + sizeof(jffs2_eof_mark);
 	}
 
-	fclose(file);
+	struct image_partition_entry entry = {
+		.name = part_name,
+		.size = len,
+		.data = in->data,
+		.data_len = in->len,
+		.eof = add_jffs2_eof,
+		.shared = true,
+	};
 
 	return entry;
 }
@@ -1967,6 +2038,92 @@ static struct image_partition_entry put_data(const char *part_name, const char *
 	return entry;
 }
 
+/** Appends a chunk to an image layout, padding is split to fit into ff_buf */
+static void layout_add(struct image_layout *layout, const uint8_t *data, size_t len) {
+	while (len) {
+		size_t n = len;
+
+		if (!data && n > sizeof(ff_buf))
+			n = sizeof(ff_buf);
+
+		layout->segs = realloc(layout->segs, (layout->n_segs + 1) * sizeof(*layout->segs));
+		if (!layout->segs)
+			error(1, errno, "realloc");
+
+		layout->segs[layout->n_segs++] = (struct image_segment){data, n};
+		layout->len += n;
+
+		if (data)
+			data += n;
+		len -= n;
+	}
+}
+
+/** Appends an image partition including its padding to an image layout */
+static void layout_add_partition(struct image_layout *layout, const struct image_partition_entry *part) {
+	size_t pad = part->size - part->data_len;
+
+	layout_add(layout, part->data, part->data_len);
+
+	if (part->eof) {
+		layout_add(layout, NULL, pad - sizeof(jffs2_eof_mark));
+		layout_add(layout, jffs2_eof_mark, sizeof(jffs2_eof_mark));
+	} else {
+		layout_add(layout, NULL, pad);
+	}
+}
+
+/** Writes an image layout to a file without copying it into a single buffer */
+static void layout_write(const struct image_layout *layout, const char *output) {
+	struct iovec iov[IOV_MAX];
+	size_t i = 0, n;
+
+	int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		error(1, errno, "unable to open output file");
+
+	while (i < layout->n_segs) {
+		for (n = 0; n < IOV_MAX && i + n < layout->n_segs; n++) {
+			const struct image_segment *seg = &layout->segs[i + n];
+
+			iov[n].iov_base = (void *)(seg->data ? seg->data : ff_buf);
+			iov[n].iov_len = seg->len;
+		}
+
+		i += n;
+
+		struct iovec *v = iov;
+		while (n) {
+			ssize_t w = writev(fd, v, n);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				error(1, errno, "unable to write output file");
+			}
+
+			/* Skip over whatever has been written by a short write */
+			while (n && (size_t)w >= v->iov_len) {
+				w -= v->iov_len;
+				v++;
+				n--;
+			}
+
+			if (n) {
+				v->iov_base = (uint8_t *)v->iov_base + w;
+				v->iov_len -= w;
+			}
+		}
+	}
+
+	if (close(fd))
+		error(1, errno, "unable to write output file");
+}
+
+/** Frees an image layout */
+static void free_layout(struct image_layout *layout) {
+	free(layout->segs);
+}
+
 /**
    Copies a list of image partitions into an image buffer and generates the image partition table while doing so
 
@@ -1994,7 +2151,7 @@ static struct image_partition_entry put_data(const char *part_name, const char *
 
    I think partition-table must be the first partition in the firmware image.
 */
-static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *flash_parts, const struct image_partition_entry *parts) {
+static void put_partitions(uint8_t *buffer, struct image_layout *layout, const struct flash_partition_entry *flash_parts, const struct image_partition_entry *parts) {
 	size_t i, j;
 	char *image_pt = (char *)buffer, *end = image_pt + 0x800;
 
@@ -2010,7 +2167,7 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 
 		assert(flash_parts[j].name);
 
-		memcpy(buffer + base, parts[i].data, parts[i].size);
+		layout_add_partition(layout, &parts[i]);
 
 		size_t len = end-image_pt;
 		size_t w = snprintf(image_pt, len, "fwup-ptn %s base 0x%05x size 0x%05x\t\r\n", parts[i].name, (unsigned)base, (unsigned)parts[i].size);
@@ -2024,13 +2181,26 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 	}
 }
 
-/** Generates and writes the image MD5 checksum */
-static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
+/** Generates and writes the MD5 checksum of the image starting at offset skip */
+static void put_md5(uint8_t *md5, const struct image_layout *layout, size_t skip) {
 	MD5_CTX ctx;
+	size_t i;
 
 	MD5_Init(&ctx);
 	MD5_Update(&ctx, md5_salt, (unsigned int)sizeof(md5_salt));
-	MD5_Update(&ctx, buffer, len);
+
+	for (i = 0; i < layout->n_segs; i++) {
+		const struct image_segment *seg = &layout->segs[i];
+
+		if (skip >= seg->len) {
+			skip -= seg->len;
+			continue;
+		}
+
+		MD5_Update(&ctx, (void *)(seg->data ? seg->data + skip : ff_buf), (unsigned int)(seg->len - skip));
+		skip = 0;
+	}
+
 	MD5_Final(md5, &ctx);
 }
 
@@ -2050,30 +2220,26 @@ static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
      1014-1813    Image partition table (2048 bytes, padded with 0xff)
      1814-xxxx    Firmware partitions
 */
-static void * generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, size_t *len) {
-	*len = 0x1814;
-
-	size_t i;
-	for (i = 0; parts[i].name; i++)
-		*len += parts[i].size;
-
-	uint8_t *image = malloc(*len);
-	if (!image)
+static uint8_t * generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, struct image_layout *layout) {
+	uint8_t *header = malloc(0x1814);
+	if (!header)
 		error(1, errno, "malloc");
 
-	memset(image, 0xff, *len);
-	put32(image, *len);
+	memset(header, 0xff, 0x1814);
 
 	if (info->vendor) {
 		size_t vendor_len = strlen(info->vendor);
-		put32(image+0x14, vendor_len);
-		memcpy(image+0x18, info->vendor, vendor_len);
+		put32(header+0x14, vendor_len);
+		memcpy(header+0x18, info->vendor, vendor_len);
 	}
 
-	put_partitions(image + 0x1014, info->partitions, parts);
-	put_md5(image+0x04, image+0x14, *len-0x14);
+	layout_add(layout, header, 0x1814);
+	put_partitions(header + 0x1014, layout, info->partitions, parts);
+
+	put32(header, layout->len);
+	put_md5(header+0x04, layout, 0x14);
 
-	return image;
+	return header;
 }
 
 /**
@@ -2083,7 +2249,7 @@ static void * generate_factory_image(struct device_info *info, const struct imag
    should be generalized when TP-LINK starts building its safeloader into hardware with
    different flash layouts.
 */
-static void * generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, size_t *len) {
+static void generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, struct image_layout *layout) {
 	size_t i, j;
 	size_t flash_first_partition_index = 0;
 	size_t flash_last_partition_index = 0;
@@ -2115,20 +2281,20 @@ static void * generate_sysupgrade_image(struct device_info *info, const struct i
 
 	assert(image_last_partition);
 
-	*len = flash_last_partition->base - flash_first_partition->base + image_last_partition->size;
-
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	memset(image, 0xff, *len);
+	size_t len = flash_last_partition->base - flash_first_partition->base + image_last_partition->size;
 
 	for (i = flash_first_partition_index; i <= flash_last_partition_index; i++) {
 		for (j = 0; image_parts[j].name; j++) {
 			if (!strcmp(info->partitions[i].name, image_parts[j].name)) {
+				size_t offset = info->partitions[i].base - flash_first_partition->base;
+
 				if (image_parts[j].size > info->partitions[i].size)
 					error(1, 0, "%s partition too big (more than %u bytes)", info->partitions[i].name, (unsigned)info->partitions[i].size);
-				memcpy(image + info->partitions[i].base - flash_first_partition->base, image_parts[j].data, image_parts[j].size);
+				if (offset < layout->len)
+					error(1, 0, "%s partition overlaps the previous one", info->partitions[i].name);
+
+				layout_add(layout, NULL, offset - layout->len);
+				layout_add_partition(layout, &image_parts[j]);
 				break;
 			}
 
@@ -2136,13 +2302,13 @@ static void * generate_sysupgrade_image(struct device_info *info, const struct i
 		}
 	}
 
-	return image;
+	assert(layout->len == len);
 }
 
 /** Generates an image according to a given layout and writes it to a file */
 static void build_image(const char *output,
-		const char *kernel_image,
-		const char *rootfs_image,
+		const struct image_input *kernel_image,
+		const struct image_input *rootfs_image,
 		uint32_t rev,
 		bool add_jffs2_eof,
 		bool sysupgrade,
@@ -2170,27 +2336,23 @@ static void build_image(const char *output,
 		os_image_partition = &info->partitions[firmware_partition_index];
 		file_system_partition = &info->partitions[firmware_partition_index + 1];
 
-		struct stat kernel;
-		if (stat(kernel_image, &kernel) < 0)
-			error(1, errno, "unable to stat file `%s'", kernel_image);
-
-		if (kernel.st_size > firmware_partition->size)
+		if (kernel_image->len > firmware_partition->size)
 			error(1, 0, "kernel overflowed firmware partition\n");
 
 		for (i = MAX_PARTITIONS-1; i >= firmware_partition_index + 1; i--)
 			info->partitions[i+1] = info->partitions[i];
 
 		file_system_partition->name = "file-system";
-		file_system_partition->base = firmware_partition->base + kernel.st_size;
+		file_system_partition->base = firmware_partition->base + kernel_image->len;
 
 		/* Align partition start to erase blocks for factory images only */
 		if (!sysupgrade)
-			file_system_partition->base = ALIGN(firmware_partition->base + kernel.st_size, 0x10000);
+			file_system_partition->base = ALIGN(firmware_partition->base + kernel_image->len, 0x10000);
 
 		file_system_partition->size = firmware_partition->size - file_system_partition->base;
 
 		os_image_partition->name = "os-image";
-		os_image_partition->size = kernel.st_size;
+		os_image_partition->size = kernel_image->len;
 	}
 
 	parts[0] = make_partition_table(info->partitions);
@@ -2223,23 +2385,17 @@ static void build_image(const char *output,
 		parts[5] = put_data("extra-para", mdat, 11);
 	}
 
-	size_t len;
-	void *image;
+	struct image_layout layout = {};
+	uint8_t *header = NULL;
 	if (sysupgrade)
-		image = generate_sysupgrade_image(info, parts, &len);
+		generate_sysupgrade_image(info, parts, &layout);
 	else
-		image = generate_factory_image(info, parts, &len);
-
-	FILE *file = fopen(output, "wb");
-	if (!file)
-		error(1, errno, "unable to open output file");
+		header = generate_factory_image(info, parts, &layout);
 
-	if (fwrite(image, len, 1, file) != 1)
-		error(1, 0, "unable to write output file");
+	layout_write(&layout, output);
 
-	fclose(file);
-
-	free(image);
+	free_layout(&layout);
+	free(header);
 
 	for (i = 0; parts[i].name; i++)
 		free_image_partition(parts[i]);
@@ -2261,6 +2417,9 @@ static void usage(const char *argv0) {
 		"  -V <rev>        sets the revision number to <rev>\n"
 		"  -j              add jffs2 end-of-filesystem markers\n"
 		"  -S              create sysupgrade instead of factory image\n"
+		"  -b <file>       build all images listed in <file> (\"-\" for stdin), one\n"
+		"                  \"<board> <output> [factory|sysupgrade]\" per line\n"
+		"  -t <threads>    number of images to build in parallel with -b\n"
 		"Extract an old image:\n"
 		"  -x <file>       extract all oem firmware partition\n"
 		"  -d <dir>        destination to extract the firmware partition\n"
@@ -2599,18 +2758,134 @@ static void convert_firmware(const char *input, const char *output)
 	fclose(input_file);
 }
 
+static struct build_job *jobs;
+static size_t n_jobs, next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct build_args {
+	const struct image_input *kernel_image;
+	const struct image_input *rootfs_image;
+	uint32_t rev;
+	bool add_jffs2_eof;
+};
+
+/** Builds queued jobs until none are left */
+static void * build_worker(void *arg) {
+	const struct build_args *args = arg;
+
+	while (true) {
+		pthread_mutex_lock(&job_lock);
+		size_t i = next_job++;
+		pthread_mutex_unlock(&job_lock);
+
+		if (i >= n_jobs)
+			return NULL;
+
+		build_image(jobs[i].output, args->kernel_image, args->rootfs_image,
+			    args->rev, args->add_jffs2_eof, jobs[i].sysupgrade, &jobs[i].info);
+	}
+}
+
+/**
+   Reads the batch list, one job per line:
+
+     <board> <output> [factory|sysupgrade]
+
+   Empty lines and lines starting with # are ignored.
+*/
+static void read_batch(const char *filename, bool sysupgrade) {
+	FILE *file = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+	char line[PATH_MAX + 128];
+
+	if (!file)
+		error(1, errno, "unable to open batch file `%s'", filename);
+
+	while (fgets(line, sizeof(line), file)) {
+		char *board = strtok(line, " \t\r\n");
+		char *output = strtok(NULL, " \t\r\n");
+		char *type = strtok(NULL, " \t\r\n");
+
+		if (!board || board[0] == '#')
+			continue;
+
+		if (!output)
+			error(1, 0, "no output filename for board %s", board);
+
+		struct device_info *info = find_board(board);
+		if (!info)
+			error(1, 0, "unsupported board %s", board);
+
+		jobs = realloc(jobs, (n_jobs + 1) * sizeof(*jobs));
+		if (!jobs)
+			error(1, errno, "realloc");
+
+		/* Each job gets its own copy as build_image() rewrites the partition table */
+		jobs[n_jobs].info = *info;
+		jobs[n_jobs].output = strdup(output);
+		jobs[n_jobs].sysupgrade = sysupgrade;
+
+		if (type && !strcmp(type, "sysupgrade"))
+			jobs[n_jobs].sysupgrade = true;
+		else if (type && !strcmp(type, "factory"))
+			jobs[n_jobs].sysupgrade = false;
+		else if (type)
+			error(1, 0, "unknown image type %s", type);
+
+		if (!jobs[n_jobs].output)
+			error(1, errno, "strdup");
+
+		n_jobs++;
+	}
+
+	if (file != stdin)
+		fclose(file);
+}
+
+/** Builds all images of the batch list, using up to n_threads threads */
+static void build_batch(const struct build_args *args, unsigned n_threads) {
+	pthread_t *threads = NULL;
+	unsigned i;
+
+	if (n_threads > n_jobs)
+		n_threads = n_jobs;
+
+	if (n_threads > 1) {
+		threads = calloc(n_threads, sizeof(*threads));
+		if (!threads)
+			error(1, errno, "calloc");
+	}
+
+	for (i = 1; i < n_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, build_worker, (void *)args);
+		if (ret)
+			error(1, ret, "pthread_create");
+	}
+
+	build_worker((void *)args);
+
+	for (i = 1; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (i = 0; i < n_jobs; i++)
+		free((char *)jobs[i].output);
+	free(jobs);
+}
+
 int main(int argc, char *argv[]) {
 	const char *board = NULL, *kernel_image = NULL, *rootfs_image = NULL, *output = NULL;
 	const char *extract_image = NULL, *output_directory = NULL, *convert_image = NULL;
+	const char *batch = NULL;
 	bool add_jffs2_eof = false, sysupgrade = false;
-	unsigned rev = 0;
+	unsigned rev = 0, n_threads = 1;
 	struct device_info *info;
 	set_source_date_epoch();
+	memset(ff_buf, 0xff, sizeof(ff_buf));
 
 	while (true) {
 		int c;
 
-		c = getopt(argc, argv, "B:k:r:o:V:jSh:x:d:z:");
+		c = getopt(argc, argv, "B:k:r:o:V:jSh:x:d:z:b:t:");
 		if (c == -1)
 			break;
 
@@ -2659,6 +2934,16 @@ int main(int argc, char *argv[]) {
 			convert_image = optarg;
 			break;
 
+		case 'b':
+			batch = optarg;
+			break;
+
+		case 't':
+			n_threads = strtoul(optarg, NULL, 0);
+			if (!n_threads)
+				n_threads = 1;
+			break;
+
 		default:
 			usage(argv[0]);
 			return 1;
@@ -2675,7 +2960,27 @@ int main(int argc, char *argv[]) {
 		if (!output)
 			error(1, 0, "Can not convert a factory/oem image into sysupgrade image without output file. Use -o <file>");
 		convert_firmware(convert_image, output);
+	} else if (batch) {
+		struct image_input kernel, rootfs;
+
+		if (!kernel_image)
+			error(1, 0, "no kernel image has been specified");
+		if (!rootfs_image)
+			error(1, 0, "no rootfs image has been specified");
+
+		read_batch(batch, sysupgrade);
+
+		map_input(&kernel, kernel_image);
+		map_input(&rootfs, rootfs_image);
+
+		struct build_args args = {&kernel, &rootfs, rev, add_jffs2_eof};
+		build_batch(&args, n_threads);
+
+		unmap_input(&kernel);
+		unmap_input(&rootfs);
 	} else {
+		struct image_input kernel, rootfs;
+
 		if (!board)
 			error(1, 0, "no board has been specified");
 		if (!kernel_image)
@@ -2690,7 +2995,13 @@ int main(int argc, char *argv[]) {
 		if (info == NULL)
 			error(1, 0, "unsupported board %s", board);
 
-		build_image(output, kernel_image, rootfs_image, rev, add_jffs2_eof, sysupgrade, info);
+		map_input(&kernel, kernel_image);
+		map_input(&rootfs, rootfs_image);
+
+		build_image(output, &kernel, &rootfs, rev, add_jffs2_eof, sysupgrade, info);
+
+		unmap_input(&kernel);
+		unmap_input(&rootfs);
 	}
 
 	return 0;